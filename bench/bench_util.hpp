@@ -0,0 +1,167 @@
+#ifndef __BENCH_UTIL_H__
+#define __BENCH_UTIL_H__
+
+// 基准测试公共工具: 进程内起一个监听端口把连接交给EventLoop, 以及阻塞式客户端收发帧
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "event_loop.hpp"
+#include "global.hpp"
+
+// 监听本地端口, 后台线程接受连接并交给EventLoop
+class BenchAcceptor {
+public:
+    explicit BenchAcceptor(EventLoop* loop, CodecType codec = CodecType::Binary) : _loop(loop), _codec(codec), _stop(false) {
+        _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        if (bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listen_fd, SOMAXCONN) < 0) {
+            perror("bench listen");
+            exit(1);
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(_listen_fd, (struct sockaddr*)&addr, &len);
+        _port = ntohs(addr.sin_port);
+        _thread = std::thread([this] {
+            while (!_stop) {
+                int fd = accept(_listen_fd, nullptr, nullptr);
+                if (fd < 0) {
+                    continue;
+                }
+                if (_stop) {
+                    close(fd);
+                    break;
+                }
+                std::vector<int> conns{fd};
+                _loop->NotifyNewCons(conns, _codec);
+            }
+        });
+    }
+    ~BenchAcceptor() {
+        _stop = true;
+        // 连一次自己, 让accept返回
+        close(connect_to(_port));
+        _thread.join();
+        close(_listen_fd);
+    }
+    int port() const { return _port; }
+    // 设置在监听socket上, accept出来的连接继承, 用来限制内核发送缓冲
+    void set_sndbuf(int bytes) {
+        setsockopt(_listen_fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+    }
+
+    static int connect_to(int port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("bench connect");
+            exit(1);
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return fd;
+    }
+private:
+    EventLoop* _loop;
+    CodecType _codec;
+    std::atomic<bool> _stop;
+    int _listen_fd;
+    int _port;
+    std::thread _thread;
+};
+
+// 进程内连接: socketpair的一端经RegisterConn交给EventLoop, 返回另一端; 不经过TCP协议栈, 结果只反映事件循环本身
+inline int bench_socketpair(EventLoop* loop, CodecType codec = CodecType::Binary) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("bench socketpair");
+        exit(1);
+    }
+    std::vector<int> conns{sv[1]};
+    loop->NotifyNewCons(conns, codec);
+    return sv[0];
+}
+
+inline std::string bench_encode(uint16_t type, const std::string& body) {
+    std::string out(HEAD_LEN + body.size(), '\0');
+    uint16_t t = htons(type);
+    uint16_t l = htons(body.size());
+    memcpy(&out[0], &t, 2);
+    memcpy(&out[2], &l, 2);
+    memcpy(&out[4], body.data(), body.size());
+    return out;
+}
+
+inline bool bench_write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w <= 0) {
+            return false;
+        }
+        p += w;
+        n -= w;
+    }
+    return true;
+}
+
+inline bool bench_read_all(int fd, char* p, size_t n) {
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r <= 0) {
+            return false;
+        }
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+// 读一个完整帧, 返回消息类型, 失败返回-1
+inline int bench_read_frame(int fd, std::string& body) {
+    char head[HEAD_LEN];
+    if (!bench_read_all(fd, head, HEAD_LEN)) {
+        return -1;
+    }
+    uint16_t t, l;
+    memcpy(&t, head, 2);
+    memcpy(&l, head + 2, 2);
+    body.resize(ntohs(l));
+    if (!bench_read_all(fd, &body[0], body.size())) {
+        return -1;
+    }
+    return ntohs(t);
+}
+
+inline double bench_now_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 计算分位数, samples会被排序
+inline double bench_percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t idx = std::min(samples.size() - 1, (size_t)(p * samples.size()));
+    return samples[idx];
+}
+
+#endif
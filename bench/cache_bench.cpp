@@ -0,0 +1,146 @@
+// 回复缓存: 同一个查询经处理函数和命中缓存的延迟与吞吐
+// 用法: cache_bench [requests=100000] [keys=64] [depth=16] [rows=32]
+// 处理函数模拟一次只读查询: 按键生成rows行结果并格式化成文本回复, 约rows*24字节
+// handler  不开缓存, 每个请求都经过处理函数
+// hit      开缓存, 先把keys个键各请求一次预热, 之后全部命中
+// miss     开缓存, 每个请求的键都不同, 测记录回复和淘汰的额外开销
+// 每种模式先测深度1的往返延迟, 再测深度depth的流水线吞吐; 连接是socketpair, 单个IO线程
+#include <iostream>
+#include "bench_util.hpp"
+#include "msg_dispatcher.hpp"
+#include "response_cache.hpp"
+#include "session.hpp"
+
+static const uint16_t kQueryType = 7;
+
+static std::string query(const std::string& key, int rows) {
+    uint64_t h = std::hash<std::string>()(key);
+    std::string out;
+    char line[64];
+    for (int i = 0; i < rows; i++) {
+        h = h * 6364136223846793005ull + 1442695040888963407ull;
+        int n = snprintf(line, sizeof(line), "%s:%d=%llu\n", key.c_str(), i, (unsigned long long)(h >> 20));
+        out.append(line, n);
+    }
+    return out;
+}
+
+struct CacheResult {
+    double _p50_us;
+    double _p99_us;
+    double _kreq_per_sec;
+};
+
+static std::string key_of(bool unique, uint64_t i, int keys) {
+    return "k" + std::to_string(unique ? i : i % keys);
+}
+
+static CacheResult run_case(bool cache, bool unique, int requests, int keys, int depth) {
+    ResponseCacheConfig::Replace(ResponseCacheConfig(cache ? std::unordered_set<uint16_t>{kQueryType}
+                                                           : std::unordered_set<uint16_t>{}, 16 << 20));
+    EventLoop loop(1);
+    int fd = bench_socketpair(&loop);
+    std::string body;
+    uint64_t seq = 0;
+    // 预热: 命中模式下每个键先请求一次
+    if (cache && !unique) {
+        for (int i = 0; i < keys; i++) {
+            std::string req = bench_encode(kQueryType, key_of(false, seq++, keys));
+            bench_write_all(fd, req.data(), req.size());
+            bench_read_frame(fd, body);
+        }
+    }
+    CacheResult res;
+    std::vector<double> samples;
+    int rounds = std::max(1, requests / 10);
+    for (int i = 0; i < rounds; i++) {
+        std::string req = bench_encode(kQueryType, key_of(unique, seq++, keys));
+        double start = bench_now_us();
+        bench_write_all(fd, req.data(), req.size());
+        if (bench_read_frame(fd, body) != kQueryType) {
+            std::cerr << "read frame failed" << std::endl;
+            exit(1);
+        }
+        samples.push_back(bench_now_us() - start);
+    }
+    res._p50_us = bench_percentile(samples, 0.5);
+    res._p99_us = bench_percentile(samples, 0.99);
+
+    int sent = 0;
+    int received = 0;
+    double start = bench_now_us();
+    while (received < requests) {
+        std::string batch;
+        while (sent < requests && sent - received < depth) {
+            batch += bench_encode(kQueryType, key_of(unique, seq++, keys));
+            sent++;
+        }
+        bench_write_all(fd, batch.data(), batch.size());
+        if (bench_read_frame(fd, body) != kQueryType) {
+            std::cerr << "read frame failed" << std::endl;
+            exit(1);
+        }
+        received++;
+    }
+    res._kreq_per_sec = requests / (bench_now_us() - start) * 1e3;
+    close(fd);
+    loop.StopIOThread();
+    return res;
+}
+
+int main(int argc, char* argv[]) {
+    int requests = argc > 1 ? atoi(argv[1]) : 100000;
+    int keys = argc > 2 ? atoi(argv[2]) : 64;
+    int depth = argc > 3 ? atoi(argv[3]) : 16;
+    int rows = argc > 4 ? atoi(argv[4]) : 32;
+
+    MsgDispatcher::Inst().Register(kQueryType, [rows](std::shared_ptr<Session> sess, uint16_t type,
+                                                      const std::string& key) {
+        sess->Send(type, query(key, rows));
+    });
+
+    // 缓存的回复必须和处理函数的回复逐字节相同, 失效后重新经过处理函数
+    {
+        ResponseCacheConfig::Replace(ResponseCacheConfig({kQueryType}, 16 << 20));
+        EventLoop loop(1);
+        int fd = bench_socketpair(&loop);
+        std::string req = bench_encode(kQueryType, "check");
+        std::string first, second;
+        bench_write_all(fd, req.data(), req.size());
+        bench_read_frame(fd, first);
+        bench_write_all(fd, req.data(), req.size());
+        bench_read_frame(fd, second);
+        uint64_t hits = ResponseCacheStats::Inst()._hits.load();
+        ResponseCache::Invalidate(kQueryType);
+        bench_write_all(fd, req.data(), req.size());
+        bench_read_frame(fd, second);
+        if (first != query("check", rows) || second != first || hits != 1 ||
+            ResponseCacheStats::Inst()._hits.load() != 1) {
+            std::cerr << "cached reply mismatch" << std::endl;
+            return 1;
+        }
+        close(fd);
+        loop.StopIOThread();
+    }
+
+    struct Mode {
+        const char* _name;
+        bool _cache;
+        bool _unique;
+    };
+    const Mode modes[] = {
+        {"handler", false, false},
+        {"hit", true, false},
+        {"miss", true, true},
+    };
+    printf("%d requests, %d keys, reply %zu B, depth %d\n", requests, keys, query("k0", rows).size(), depth);
+    for (auto& mode : modes) {
+        auto res = run_case(mode._cache, mode._unique, requests, keys, depth);
+        printf("%-8s rtt p50 %6.1f us  p99 %6.1f us   pipelined %8.1f kreq/s\n", mode._name, res._p50_us,
+               res._p99_us, res._kreq_per_sec);
+    }
+    auto& stats = ResponseCacheStats::Inst();
+    printf("cache hits %lu misses %lu evictions %lu\n", (unsigned long)stats._hits.load(),
+           (unsigned long)stats._misses.load(), (unsigned long)stats._evictions.load());
+    return 0;
+}
@@ -0,0 +1,122 @@
+// 分隔符扫描与帧解析吞吐, 对比SIMD实现与逐字节循环
+// 用法: codec_bench [megabytes=64] [line_len=80] [rounds=5]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <memory>
+#include "codec.hpp"
+#include "session.hpp"
+#include "simd_scan.hpp"
+
+static size_t naive_find_byte(const char* p, size_t n, char c) {
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] == c) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static size_t naive_find_crlfcrlf(const char* p, size_t n) {
+    for (size_t i = 0; i + 3 < n; i++) {
+        if (p[i] == '\r' && p[i + 1] == '\n' && p[i + 2] == '\r' && p[i + 3] == '\n') {
+            return i;
+        }
+    }
+    return n;
+}
+
+// 按分隔符切分整个缓冲区, 返回找到的分隔符数量
+template<typename Fn>
+static size_t count_delims(const std::string& buf, Fn find, size_t delim_len) {
+    size_t count = 0;
+    size_t off = 0;
+    while (off < buf.size()) {
+        size_t pos = find(buf.data() + off, buf.size() - off);
+        if (pos == buf.size() - off) {
+            break;
+        }
+        count++;
+        off += pos + delim_len;
+    }
+    return count;
+}
+
+template<typename Fn>
+static double measure_gbps(const std::string& buf, int rounds, Fn fn, size_t& result) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        result = fn();
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (double)buf.size() * rounds / sec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? atoi(argv[1]) : 64;
+    size_t line_len = argc > 2 ? atoi(argv[2]) : 80;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    std::mt19937 rng(42);
+
+    // 文本行: 长度在line_len附近随机
+    std::string lines;
+    lines.reserve(megabytes << 20);
+    while (lines.size() < (megabytes << 20)) {
+        size_t n = line_len / 2 + rng() % line_len;
+        for (size_t i = 0; i < n; i++) {
+            lines.push_back('a' + rng() % 26);
+        }
+        lines.push_back('\n');
+    }
+
+    // HTTP请求: 典型的健康检查请求头
+    std::string requests;
+    const std::string req = "GET /health HTTP/1.1\r\nHost: example.com\r\nUser-Agent: probe/1.0\r\n"
+                            "Accept: */*\r\nX-Request-Id: 0123456789abcdef0123456789abcdef\r\n\r\n";
+    while (requests.size() < (megabytes << 20)) {
+        requests += req;
+    }
+
+    printf("simd level: %s, %zu MB, line_len ~%zu\n", simd_level(), megabytes, line_len);
+    size_t naive_cnt = 0, simd_cnt = 0;
+    double naive = measure_gbps(lines, rounds, [&] {
+        return count_delims(lines, [](const char* p, size_t n) { return naive_find_byte(p, n, '\n'); }, 1);
+    }, naive_cnt);
+    double simd = measure_gbps(lines, rounds, [&] {
+        return count_delims(lines, [](const char* p, size_t n) { return simd_find_byte(p, n, '\n'); }, 1);
+    }, simd_cnt);
+    printf("line scan      naive %6.2f GB/s   simd %6.2f GB/s   (%zu/%zu lines)\n", naive, simd, naive_cnt, simd_cnt);
+
+    naive = measure_gbps(requests, rounds, [&] {
+        return count_delims(requests, naive_find_crlfcrlf, 4);
+    }, naive_cnt);
+    simd = measure_gbps(requests, rounds, [&] {
+        return count_delims(requests, simd_find_crlfcrlf, 4);
+    }, simd_cnt);
+    printf("header-end     naive %6.2f GB/s   simd %6.2f GB/s   (%zu/%zu requests)\n", naive, simd, naive_cnt, simd_cnt);
+
+    // 完整的codec解析, 包括构造帧
+    auto decode_all = [](Codec* codec, const std::string& buf) {
+        size_t frames = 0;
+        size_t off = 0;
+        while (off < buf.size()) {
+            std::shared_ptr<DataBuf> frame;
+            ssize_t used = codec->decode(buf.data() + off, buf.size() - off, frame);
+            if (used <= 0) {
+                break;
+            }
+            off += used;
+            frames++;
+        }
+        return frames;
+    };
+    size_t frames = 0;
+    double line_codec = measure_gbps(lines, rounds, [&] { return decode_all(GetCodec(CodecType::Line), lines); }, frames);
+    printf("LineCodec      %6.2f GB/s   (%zu frames)\n", line_codec, frames);
+    double http_codec = measure_gbps(requests, rounds, [&] { return decode_all(GetCodec(CodecType::Http), requests); }, frames);
+    printf("HttpCodec      %6.2f GB/s   (%zu frames)\n", http_codec, frames);
+    return 0;
+}
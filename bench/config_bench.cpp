@@ -0,0 +1,98 @@
+// 配置读取开销, 以及重载期间读者是否受影响
+// 用法: config_bench [iters=20000000] [threads=4] [reload_ms=1]
+// lookup   ConfigMgr::get<int>按名字查表并解析字符串
+// key      ConfigKey<int>::get, 一次原子读加下标访问
+// reload   threads个线程读ConfigKey, 另一个线程每reload_ms毫秒改写文件并Reload, 统计读者吞吐和重载耗时
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "bench_util.hpp"
+#include "configmgr.hpp"
+#include "logger.hpp"
+
+static void write_config(const std::string& path, int budget) {
+    std::ofstream out(path, std::ios::trunc);
+    out << "[server]\nport = 12345\nthread_num = 2\ntask_budget = " << budget << "\nread_budget_frames = 64\n"
+        << "rebalance_ratio = 2.0\ntrace_file = event_server_trace.json\n";
+}
+
+int main(int argc, char* argv[]) {
+    long iters = argc > 1 ? atol(argv[1]) : 20000000;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    int reload_ms = argc > 3 ? atoi(argv[3]) : 1;
+
+    char path[] = "/tmp/config_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    write_config(path, 1024);
+    auto& cfg = ConfigMgr::Inst();
+    if (!cfg.loadFromFile(path)) {
+        return 1;
+    }
+    static ConfigKey<int> key("server.task_budget", 0);
+
+    volatile long sink = 0;
+    double start = bench_now_us();
+    for (long i = 0; i < iters; i++) {
+        sink = sink + cfg.get<int>("server.task_budget", 0);
+    }
+    double lookup_ns = (bench_now_us() - start) * 1000 / iters;
+    start = bench_now_us();
+    for (long i = 0; i < iters; i++) {
+        sink = sink + key.get();
+    }
+    double key_ns = (bench_now_us() - start) * 1000 / iters;
+    printf("%-8s %8.2f ns/get\n", "lookup", lookup_ns);
+    printf("%-8s %8.2f ns/get\n", "key", key_ns);
+
+    // 每次重载都会打一行日志
+    Logger::SetLevel(LogLevel::Warn);
+    std::atomic<bool> stop{false};
+    std::atomic<long> reads{0};
+    std::atomic<long> bad{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < threads; t++) {
+        readers.emplace_back([&] {
+            long n = 0;
+            long wrong = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 1024; i++) {
+                    int v = key.get();
+                    wrong += (v != 1024 && v != 2048);
+                }
+                n += 1024;
+            }
+            reads += n;
+            bad += wrong;
+        });
+    }
+    std::vector<double> reload_us;
+    double deadline = bench_now_us() + 2e6;
+    start = bench_now_us();
+    for (int i = 0; bench_now_us() < deadline; i++) {
+        write_config(path, (i & 1) ? 1024 : 2048);
+        double t0 = bench_now_us();
+        cfg.Reload();
+        reload_us.push_back(bench_now_us() - t0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(reload_ms));
+    }
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    double elapsed = (bench_now_us() - start) / 1e6;
+    size_t reloads = reload_us.size();
+    printf("%-8s %8.1f M gets/s over %d threads, %zu reloads (p50 %.1f us, p99 %.1f us), %ld bad values, version %lu\n",
+           "reload", reads.load() / elapsed / 1e6, threads, reloads, bench_percentile(reload_us, 0.5),
+           bench_percentile(reload_us, 0.99), bad.load(), (unsigned long)cfg.version());
+    unlink(path);
+    return sink == 0 || bad.load() != 0;
+}
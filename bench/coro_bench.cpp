@@ -0,0 +1,104 @@
+// 协程会话与回调路径的回显吞吐对比
+// 用法: coro_bench [conns=64] [depth=8] [seconds=2] [body=64] [threads=2]
+#include <iostream>
+#include "bench_util.hpp"
+#include "coro.hpp"
+
+struct BenchResult {
+    double _msgs_per_sec;
+    double _p50_us;
+    double _p99_us;
+};
+
+static BenchResult run_echo(int conns, int depth, double seconds, int body_len, int threads, const char* name) {
+    EventLoop loop(threads);
+    BenchAcceptor acceptor(&loop);
+    std::vector<int> fds;
+    for (int i = 0; i < conns; i++) {
+        fds.push_back(BenchAcceptor::connect_to(acceptor.port()));
+    }
+    std::string frame = bench_encode(1001, std::string(body_len, 'x'));
+    std::string batch;
+    for (int i = 0; i < depth; i++) {
+        batch += frame;
+    }
+
+    // 先跑一轮, 确保所有连接都已注册
+    std::string body;
+    for (int fd : fds) {
+        bench_write_all(fd, frame.data(), frame.size());
+        bench_read_frame(fd, body);
+    }
+#ifdef EVENT_SERVER_COROUTINE
+    if (GetCoroutineHandler()) {
+        std::cout << "  " << name << ": live coroutine frames " << CoFramePool::live_frames()
+                  << ", bytes per connection " << CoFramePool::live_bytes() / conns + sizeof(CoState) << std::endl;
+    }
+#endif
+
+    std::vector<double> rounds;
+    uint64_t msgs = 0;
+    double start = bench_now_us();
+    double deadline = start + seconds * 1e6;
+    while (bench_now_us() < deadline) {
+        double t0 = bench_now_us();
+        for (int fd : fds) {
+            bench_write_all(fd, batch.data(), batch.size());
+        }
+        for (int fd : fds) {
+            for (int i = 0; i < depth; i++) {
+                if (bench_read_frame(fd, body) < 0) {
+                    std::cerr << "read echo failed" << std::endl;
+                    exit(1);
+                }
+            }
+        }
+        rounds.push_back(bench_now_us() - t0);
+        msgs += (uint64_t)conns * depth;
+    }
+    double elapsed = (bench_now_us() - start) / 1e6;
+    for (int fd : fds) {
+        close(fd);
+    }
+    loop.StopIOThread();
+    BenchResult res;
+    res._msgs_per_sec = msgs / elapsed;
+    res._p50_us = bench_percentile(rounds, 0.5);
+    res._p99_us = bench_percentile(rounds, 0.99);
+    return res;
+}
+
+#ifdef EVENT_SERVER_COROUTINE
+static CoTask echo_coroutine(std::shared_ptr<Session> sess) {
+    while (auto frame = co_await sess->read_frame()) {
+        co_await sess->send(frame._type, frame._data);
+    }
+}
+#endif
+
+static void print_result(const char* name, const BenchResult& r) {
+    printf("%-10s %12.0f msg/s   round p50 %8.1f us   p99 %8.1f us\n", name, r._msgs_per_sec, r._p50_us, r._p99_us);
+}
+
+int main(int argc, char* argv[]) {
+    int conns = argc > 1 ? atoi(argv[1]) : 64;
+    int depth = argc > 2 ? atoi(argv[2]) : 8;
+    double seconds = argc > 3 ? atof(argv[3]) : 2;
+    int body_len = argc > 4 ? atoi(argv[4]) : 64;
+    int threads = argc > 5 ? atoi(argv[5]) : 2;
+
+    auto callback = run_echo(conns, depth, seconds, body_len, threads, "callback");
+#ifdef EVENT_SERVER_COROUTINE
+    SetCoroutineHandler(echo_coroutine);
+    auto coroutine = run_echo(conns, depth, seconds, body_len, threads, "coroutine");
+    SetCoroutineHandler(nullptr);
+#endif
+    printf("conns=%d depth=%d body=%d threads=%d\n", conns, depth, body_len, threads);
+    print_result("callback", callback);
+#ifdef EVENT_SERVER_COROUTINE
+    print_result("coroutine", coroutine);
+#else
+    printf("coroutine  disabled (EVENT_SERVER_COROUTINE=OFF)\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,159 @@
+// 一个连接不停地流水线灌请求时, 其他轻量连接的延迟
+// 用法: fairness_bench [seconds=2] [light_conns=32] [work_us=2] [codec=binary|line]
+// 重连接阻塞写, 每批64帧, 每帧在处理函数里忙等work_us且不回复; 轻连接每5ms同时发一个ping, 测回包延迟
+// unbounded   不限制每轮的读取, 重连接读到EAGAIN才轮到其他连接
+// budget      每个连接每轮最多64帧/256KB, 用完后排到其他就绪连接后面
+#include <csignal>
+#include <iostream>
+#include <sys/epoll.h>
+#include "bench_util.hpp"
+#include "msg_dispatcher.hpp"
+#include "session.hpp"
+
+static const uint16_t kPingType = 1;
+static const uint16_t kBulkType = 2;
+static std::atomic<uint64_t> g_bulk_done{0};
+
+struct FairnessResult {
+    double _p50_us;
+    double _p99_us;
+    double _p999_us;
+    size_t _pings;
+    size_t _timeouts;           // 5秒内没有收齐回包的轮数, 出现后本轮结束
+    double _bulk_per_sec;
+};
+
+// 回包都很小, epoll报告可读时一整帧已经到达
+static bool read_reply(int fd, bool line) {
+    if (!line) {
+        std::string body;
+        return bench_read_frame(fd, body) == kPingType;
+    }
+    char c;
+    while (read(fd, &c, 1) == 1) {
+        if (c == '\n') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static FairnessResult run_case(double seconds, int light_conns, bool line) {
+    EventLoop loop(1);
+    BenchAcceptor acceptor(&loop, line ? CodecType::Line : CodecType::Binary);
+    int heavy = BenchAcceptor::connect_to(acceptor.port());
+    std::vector<int> light;
+    int ep = epoll_create1(0);
+    for (int i = 0; i < light_conns; i++) {
+        int fd = BenchAcceptor::connect_to(acceptor.port());
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+        light.push_back(fd);
+    }
+    uint64_t bulk0 = g_bulk_done.load();
+
+    std::atomic<bool> stop{false};
+    std::thread flooder([&] {
+        std::string batch;
+        for (int i = 0; i < 64; i++) {
+            batch += line ? std::string("bulk\n") : bench_encode(kBulkType, std::string(16, 'x'));
+        }
+        while (!stop && bench_write_all(heavy, batch.data(), batch.size())) {
+        }
+    });
+
+    std::string ping = line ? std::string("ping\n") : bench_encode(kPingType, "ping");
+    std::vector<double> samples;
+    size_t timeouts = 0;
+    std::vector<struct epoll_event> events(light_conns);
+    double start = bench_now_us();
+    double deadline = start + seconds * 1e6;
+    while (bench_now_us() < deadline && timeouts == 0) {
+        double t0 = bench_now_us();
+        for (int fd : light) {
+            bench_write_all(fd, ping.data(), ping.size());
+        }
+        int left = light_conns;
+        while (left > 0) {
+            int n = epoll_wait(ep, events.data(), light_conns, 5000);
+            if (n <= 0) {
+                timeouts++;
+                break;
+            }
+            double now = bench_now_us();
+            for (int i = 0; i < n; i++) {
+                if (!read_reply(light[events[i].data.u32], line)) {
+                    std::cerr << "read reply failed" << std::endl;
+                    exit(1);
+                }
+                samples.push_back(now - t0);
+                left--;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    double elapsed = (bench_now_us() - start) / 1e6;
+    stop = true;
+    shutdown(heavy, SHUT_RDWR);
+    flooder.join();
+    close(heavy);
+    for (int fd : light) {
+        close(fd);
+    }
+    close(ep);
+    loop.StopIOThread();
+    FairnessResult res;
+    res._pings = samples.size();
+    res._timeouts = timeouts;
+    res._p50_us = bench_percentile(samples, 0.5);
+    res._p99_us = bench_percentile(samples, 0.99);
+    res._p999_us = bench_percentile(samples, 0.999);
+    res._bulk_per_sec = (g_bulk_done.load() - bulk0) / elapsed;
+    return res;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    int light_conns = argc > 2 ? atoi(argv[2]) : 32;
+    int work_us = argc > 3 ? atoi(argv[3]) : 2;
+    bool line = argc > 4 && std::string(argv[4]) == "line";
+    signal(SIGPIPE, SIG_IGN);
+
+    auto spin = [work_us] {
+        double until = bench_now_us() + work_us;
+        while (bench_now_us() < until) {
+        }
+        g_bulk_done.fetch_add(1, std::memory_order_relaxed);
+    };
+    // 心跳没有注册处理函数, 原样回显
+    MsgDispatcher::Inst().Register(kBulkType, [spin](std::shared_ptr<Session>, uint16_t, const std::string&) {
+        spin();
+    });
+    MsgDispatcher::Inst().Register(LINE_MSG_TYPE, [spin](std::shared_ptr<Session> sess, uint16_t, const std::string& body) {
+        if (body == "ping") {
+            sess->Send(LINE_MSG_TYPE, body);
+            return;
+        }
+        spin();
+    });
+
+    struct Mode {
+        const char* _name;
+        LoopBudget _budget;
+    };
+    std::vector<Mode> modes = {
+        {"unbounded", LoopBudget{0, 0, 0}},
+        {"budget", LoopBudget{64, 256 * 1024, 1024}},
+    };
+    printf("%s codec, 1 flooding connection (%d us per frame), %d light connections\n", line ? "line" : "binary",
+           work_us, light_conns);
+    for (auto& mode : modes) {
+        LoopBudget::Replace(mode._budget);
+        auto res = run_case(seconds, light_conns, line);
+        printf("%-10s light p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  (%zu pings, %zu timeouts)   heavy %8.0f frames/s\n",
+               mode._name, res._p50_us, res._p99_us, res._p999_us, res._pings, res._timeouts, res._bulk_per_sec);
+    }
+    return 0;
+}
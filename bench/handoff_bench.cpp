@@ -0,0 +1,186 @@
+// 重启时新进程的首次accept耗时与重启窗口内被拒绝的连接数: 关闭后重新bind vs 通过Unix socket交接监听fd
+// 用法: handoff_bench [rounds=20]
+// 每轮fork一个子进程模拟新进程, 客户端线程在重启窗口内不停地连接, 统计ECONNREFUSED次数
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <poll.h>
+#include <atomic>
+#include "bench_util.hpp"
+#include "fd_handoff.hpp"
+
+static int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int local_port(int fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &len);
+    return ntohs(addr.sin_port);
+}
+
+// 跨进程可比较的单调时钟
+static double mono_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+struct RoundResult {
+    double _first_accept_us;
+    uint64_t _refused;
+};
+
+// 重启窗口内持续连接, 成功的连接进入backlog等待新进程accept
+class ConnectStorm {
+public:
+    explicit ConnectStorm(int port) : _port(port), _stop(false), _refused(0) {
+        _thread = std::thread([this] {
+            while (!_stop) {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                struct sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                addr.sin_port = htons(_port);
+                if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno == ECONNREFUSED) {
+                    _refused++;
+                }
+                close(fd);
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        });
+    }
+    uint64_t stop() {
+        _stop = true;
+        _thread.join();
+        return _refused;
+    }
+private:
+    int _port;
+    std::atomic<bool> _stop;
+    std::atomic<uint64_t> _refused;
+    std::thread _thread;
+};
+
+// 子进程: 拿到监听socket后accept第一个连接, 把时间写回管道; 等父进程停止连接后再退出, 避免退出时关闭监听socket被计为拒绝
+static void child_accept_first(int listen_fd, int pipe_fd, int exit_fd) {
+    int conn = accept(listen_fd, nullptr, nullptr);
+    double t = mono_us();
+    write(pipe_fd, &t, sizeof(t));
+    char c;
+    read(exit_fd, &c, 1);
+    close(conn);
+    _exit(0);
+}
+
+// 父进程等子进程报告首次accept, 先停掉连接风暴再让子进程退出
+static RoundResult finish_round(pid_t pid, int pipes[2], int exits[2], ConnectStorm& storm, double t0) {
+    double t1 = 0;
+    read(pipes[0], &t1, sizeof(t1));
+    uint64_t refused = storm.stop();
+    write(exits[1], "x", 1);
+    waitpid(pid, nullptr, 0);
+    for (int i = 0; i < 2; i++) {
+        close(pipes[i]);
+        close(exits[i]);
+    }
+    return RoundResult{t1 - t0, refused};
+}
+
+static RoundResult cold_round(int port) {
+    int listen_fd = listen_on(port);
+    int pipes[2], exits[2];
+    pipe(pipes);
+    pipe(exits);
+    ConnectStorm storm(port);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    // 旧进程退出, 新进程重新创建监听socket
+    double t0 = mono_us();
+    close(listen_fd);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = listen_on(port);
+        child_accept_first(fd, pipes[1], exits[0]);
+    }
+    return finish_round(pid, pipes, exits, storm, t0);
+}
+
+static RoundResult handoff_round(int port, const std::string& path) {
+    int listen_fd = listen_on(port);
+    int upgrade_fd = HandoffListen(path);
+    int pipes[2], exits[2];
+    pipe(pipes);
+    pipe(exits);
+    ConnectStorm storm(port);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    // 新进程启动后连上交接socket, 旧进程把监听fd交出去后关闭自己的引用
+    double t0 = mono_us();
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::vector<ListenerInfo> listeners;
+        int hconn = -1;
+        if (!HandoffRecv(path, listeners, hconn) || !HandoffAck(hconn)) {
+            _exit(1);
+        }
+        child_accept_first(listeners[0]._fd, pipes[1], exits[0]);
+    }
+    struct pollfd pfd;
+    pfd.fd = upgrade_fd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, -1);
+    int conn = accept(upgrade_fd, nullptr, nullptr);
+    std::vector<ListenerInfo> listeners{ListenerInfo{listen_fd, port, CodecType::Binary}};
+    if (!HandoffSend(conn, listeners, 5000)) {
+        fprintf(stderr, "handoff failed\n");
+        exit(1);
+    }
+    close(conn);
+    close(listen_fd);
+    close(upgrade_fd);
+    unlink(path.c_str());
+    return finish_round(pid, pipes, exits, storm, t0);
+}
+
+static void print_rounds(const char* name, std::vector<RoundResult>& rs) {
+    std::vector<double> lat;
+    uint64_t refused = 0;
+    for (auto& r : rs) {
+        lat.push_back(r._first_accept_us);
+        refused += r._refused;
+    }
+    printf("%-8s first accept p50 %8.1f us   p99 %8.1f us   refused connects %llu (%.1f per restart)\n",
+           name, bench_percentile(lat, 0.5), bench_percentile(lat, 0.99),
+           (unsigned long long)refused, (double)refused / rs.size());
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    int probe = listen_on(0);
+    int port = local_port(probe);
+    close(probe);
+    std::string path = "/tmp/handoff_bench." + std::to_string(getpid()) + ".sock";
+
+    std::vector<RoundResult> cold, handoff;
+    for (int i = 0; i < rounds; i++) {
+        cold.push_back(cold_round(port));
+        handoff.push_back(handoff_round(port, path));
+    }
+    printf("rounds=%d port=%d\n", rounds, port);
+    print_rounds("rebind", cold);
+    print_rounds("handoff", handoff);
+    return 0;
+}
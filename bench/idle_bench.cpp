@@ -0,0 +1,98 @@
+// 空闲连接的用户态内存: 每个连接的RSS和堆占用
+// 用法: idle_bench [counts=100000,1000000] [threads=2]
+// synthetic: 按RegisterConn的方式创建Session并放入会话表, 不占用fd, 可以直接测到百万级
+// sockets:   真实的本地回环连接交给EventLoop, 数量受RLIMIT_NOFILE限制(客户端和服务端各占一个fd)
+#include <malloc.h>
+#include <sys/resource.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include "bench_util.hpp"
+#include "session.hpp"
+
+static long rss_kb() {
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            return atol(line.c_str() + 6);
+        }
+    }
+    return 0;
+}
+
+static size_t heap_bytes() {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static void print_line(const char* mode, size_t conns, long rss0, long rss1, size_t heap0, size_t heap1) {
+    printf("%-10s conns %8zu   rss %7.1f B/conn   heap %7.1f B/conn\n", mode, conns,
+           (rss1 - rss0) * 1024.0 / conns, (double)(heap1 - heap0) / conns);
+}
+
+static void run_synthetic(size_t conns) {
+    malloc_trim(0);
+    long rss0 = rss_kb();
+    size_t heap0 = heap_bytes();
+    {
+        std::unordered_map<int, std::shared_ptr<Session>> sessions;
+        for (size_t i = 0; i < conns; i++) {
+            int fd = (int)i + 3;
+            sessions[fd] = std::make_shared<Session>(fd, nullptr);
+        }
+        print_line("synthetic", conns, rss0, rss_kb(), heap0, heap_bytes());
+    }
+}
+
+static void run_sockets(size_t conns, int threads) {
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    size_t limit = rl.rlim_cur > 256 ? (rl.rlim_cur - 256) / 2 : 0;
+    if (conns > limit) {
+        printf("sockets    conns %8zu   skipped, RLIMIT_NOFILE %llu allows %zu\n", conns, (unsigned long long)rl.rlim_cur, limit);
+        conns = limit;
+    }
+    if (conns == 0) {
+        return;
+    }
+    EventLoop loop(threads);
+    BenchAcceptor acceptor(&loop);
+    // 先建一个连接并等待它注册, 让线程栈/epoll数组等一次性开销不计入
+    std::vector<int> fds;
+    fds.push_back(BenchAcceptor::connect_to(acceptor.port()));
+    while (loop.SessionCount() < 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    malloc_trim(0);
+    long rss0 = rss_kb();
+    size_t heap0 = heap_bytes();
+    for (size_t i = 1; i < conns; i++) {
+        fds.push_back(BenchAcceptor::connect_to(acceptor.port()));
+    }
+    while (loop.SessionCount() < conns) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // 客户端fd的vector也在堆上, 扣掉
+    size_t client_heap = fds.capacity() * sizeof(int);
+    print_line("sockets", conns - 1, rss0, rss_kb() - (long)(client_heap / 1024), heap0, heap_bytes() - client_heap);
+    for (int fd : fds) {
+        close(fd);
+    }
+    loop.StopIOThread();
+}
+
+int main(int argc, char* argv[]) {
+    std::string counts = argc > 1 ? argv[1] : "100000,1000000";
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+    printf("sizeof(Session) %zu\n", sizeof(Session));
+    std::stringstream ss(counts);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t n = strtoul(item.c_str(), nullptr, 10);
+        run_synthetic(n);
+        run_sockets(n, threads);
+    }
+    return 0;
+}
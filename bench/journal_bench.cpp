@@ -0,0 +1,136 @@
+// 落盘消息吞吐: 每个请求都要落盘后才回确认
+// 用法: journal_bench [seconds=2] [conns=16] [depth=8] [body=128] [threads=2] [dir=/tmp]
+// off      不落盘, 处理函数直接回确认, 作为上限
+// inline   处理函数自己write+fdatasync后回确认, 每条消息一次fdatasync, IO线程阻塞在磁盘上
+// journal  开启日志, IO线程只追加内存缓冲, 写线程一次fdatasync覆盖一批记录(组提交)
+// 每个连接保持depth个请求未确认, 统计确认数/秒和确认时延; 连接是socketpair
+#include <csignal>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include "bench_util.hpp"
+#include "journal.hpp"
+#include "msg_dispatcher.hpp"
+#include "session.hpp"
+
+static const uint16_t kOrderType = 9;
+
+struct JournalResult {
+    double _acks_per_sec;
+    double _p50_us;
+    double _p99_us;
+};
+
+static JournalResult run_case(double seconds, int conns, int depth, const std::string& body, int threads) {
+    EventLoop loop(threads);
+    std::vector<int> fds;
+    std::vector<std::deque<double>> sent(conns);
+    for (int i = 0; i < conns; i++) {
+        fds.push_back(bench_socketpair(&loop));
+    }
+    std::string req = bench_encode(kOrderType, body);
+    std::string batch;
+    for (int i = 0; i < depth; i++) {
+        batch += req;
+    }
+    double now = bench_now_us();
+    for (int i = 0; i < conns; i++) {
+        bench_write_all(fds[i], batch.data(), batch.size());
+        sent[i].assign(depth, now);
+    }
+    std::vector<double> samples;
+    std::string reply;
+    size_t acks = 0;
+    double start = bench_now_us();
+    double deadline = start + seconds * 1e6;
+    while (bench_now_us() < deadline) {
+        for (int i = 0; i < conns; i++) {
+            if (bench_read_frame(fds[i], reply) != kOrderType) {
+                std::cerr << "read frame failed" << std::endl;
+                exit(1);
+            }
+            now = bench_now_us();
+            samples.push_back(now - sent[i].front());
+            sent[i].pop_front();
+            acks++;
+            bench_write_all(fds[i], req.data(), req.size());
+            sent[i].push_back(now);
+        }
+    }
+    double elapsed = (bench_now_us() - start) / 1e6;
+    for (int fd : fds) {
+        close(fd);
+    }
+    loop.StopIOThread();
+    JournalResult res;
+    res._acks_per_sec = acks / elapsed;
+    res._p50_us = bench_percentile(samples, 0.5);
+    res._p99_us = bench_percentile(samples, 0.99);
+    return res;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    int conns = argc > 2 ? atoi(argv[2]) : 16;
+    int depth = argc > 3 ? atoi(argv[3]) : 8;
+    size_t body_len = argc > 4 ? atoi(argv[4]) : 128;
+    int threads = argc > 5 ? atoi(argv[5]) : 2;
+    std::string base = argc > 6 ? argv[6] : "/tmp";
+    std::string body(std::min<size_t>(body_len, BUFF_SIZE), 'o');
+    // 结束时客户端直接关闭, 服务端可能还在回确认
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string dir = base + "/journal_bench.XXXXXX";
+    if (mkdtemp(&dir[0]) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string inline_path = dir + "/inline.log";
+    int inline_fd = -1;
+    bool inline_sync = false;
+    MsgDispatcher::Inst().Register(kOrderType, [&](std::shared_ptr<Session> sess, uint16_t type,
+                                                   const std::string& data) {
+        if (inline_sync) {
+            std::string rec;
+            Journal::EncodeRecord(rec, type, data.data(), data.size());
+            if (write(inline_fd, rec.data(), rec.size()) < 0 || fdatasync(inline_fd) < 0) {
+                perror("inline write");
+                exit(1);
+            }
+        }
+        sess->Send(type, "ok");
+    });
+
+    printf("%d conns x %d outstanding, %zu B body, %d io threads, journal in %s\n", conns, depth, body.size(),
+           threads, dir.c_str());
+    // 不落盘
+    JournalConfig::Replace(JournalConfig({}, dir));
+    auto res = run_case(seconds, conns, depth, body, threads);
+    printf("%-8s %9.0f acks/s  p50 %8.1f us  p99 %8.1f us\n", "off", res._acks_per_sec, res._p50_us, res._p99_us);
+
+    inline_fd = open(inline_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    inline_sync = true;
+    res = run_case(seconds, conns, depth, body, threads);
+    inline_sync = false;
+    close(inline_fd);
+    unlink(inline_path.c_str());
+    printf("%-8s %9.0f acks/s  p50 %8.1f us  p99 %8.1f us\n", "inline", res._acks_per_sec, res._p50_us, res._p99_us);
+
+    JournalConfig::Replace(JournalConfig({kOrderType}, dir));
+    res = run_case(seconds, conns, depth, body, threads);
+    auto& stats = JournalStats::Inst();
+    printf("%-8s %9.0f acks/s  p50 %8.1f us  p99 %8.1f us  (%lu records in %lu fdatasync, %.1f per sync)\n",
+           "journal", res._acks_per_sec, res._p50_us, res._p99_us, (unsigned long)stats._records.load(),
+           (unsigned long)stats._syncs.load(), (double)stats._records.load() / std::max<uint64_t>(1, stats._syncs.load()));
+
+    // 读回刚写的日志, 记录数应与落盘数一致
+    size_t replayed = Journal::Replay(dir, [&](uint16_t type, const std::string& data) {
+        return type == kOrderType && data == body;
+    });
+    printf("replayed %zu records\n", replayed);
+    for (auto& path : Journal::ListSegments(dir)) {
+        unlink(path.c_str());
+    }
+    rmdir(dir.c_str());
+    return replayed == stats._records.load() ? 0 : 1;
+}
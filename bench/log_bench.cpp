@@ -0,0 +1,69 @@
+// 日志调用方的开销: 异步日志与直接fprintf对比, 模拟断连风暴时IO线程上的日志
+// 用法: log_bench [calls_per_thread=1000000] [threads=2] [output=/dev/null]
+// async_raw   直接Logger::Write, 不经过调用点限流, 环满时丢弃
+// async_site  LOG_INFO宏, 同一调用点每线程每秒只输出kSiteBurst条
+// fprintf     stdio加锁并同步写出, 改动前的做法
+#include <iostream>
+#include "bench_util.hpp"
+#include "logger.hpp"
+
+template <typename Func>
+static void run_case(const char* name, long calls, int threads, Func&& func) {
+    std::vector<std::thread> workers;
+    std::vector<double> ns_per_call(threads);
+    std::vector<double> max_us(threads);
+    uint64_t dropped0 = Logger::Dropped();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            double worst = 0;
+            double t0 = bench_now_us();
+            for (long i = 0; i < calls; i++) {
+                double c0 = (i & 1023) == 0 ? bench_now_us() : 0;
+                func(i);
+                if (c0 > 0) {
+                    worst = std::max(worst, bench_now_us() - c0);
+                }
+            }
+            ns_per_call[t] = (bench_now_us() - t0) * 1000.0 / calls;
+            max_us[t] = worst;
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    double avg = 0, worst = 0;
+    for (int t = 0; t < threads; t++) {
+        avg += ns_per_call[t] / threads;
+        worst = std::max(worst, max_us[t]);
+    }
+    printf("%-11s %8.1f ns/call   max sampled %8.1f us   dropped %llu\n", name, avg, worst,
+           (unsigned long long)(Logger::Dropped() - dropped0));
+}
+
+int main(int argc, char* argv[]) {
+    long calls = argc > 1 ? atol(argv[1]) : 1000000;
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+    std::string output = argc > 3 ? argv[3] : "/dev/null";
+    Logger::Init(output, LogLevel::Info);
+    FILE* fp = fopen(output.c_str(), "a");
+    if (fp == nullptr) {
+        perror("open output");
+        return 1;
+    }
+
+    run_case("async_raw", calls, threads, [](long i) {
+        Logger::Write(LogLevel::Info, 0, "read peer closed , fd is %d", (int)i);
+    });
+    run_case("async_site", calls, threads, [](long i) {
+        LOG_INFO("read peer closed , fd is %d", (int)i);
+    });
+    run_case("filtered", calls, threads, [](long i) {
+        LOG_DEBUG("read peer closed , fd is %d", (int)i);
+    });
+    run_case("fprintf", calls, threads, [fp](long i) {
+        fprintf(fp, "read peer closed , fd is %d\n", (int)i);
+        fflush(fp);
+    });
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,372 @@
+// 事件循环回归基准: 固定种子生成每个连接的请求序列, 固定总帧数, 多次运行看吞吐的波动和分阶段耗时
+// 用法: loop_bench [script=all] [transport=unix|tcp] [runs=5] [frames=200000] [conns=16] [threads=1] [seed=42]
+//                  [compress=off|on]
+// unix   连接是socketpair, 一端经RegisterConn交给EventLoop, 不经过TCP协议栈
+// tcp    经回环TCP连接, 用于对比协议栈带来的波动
+// 脚本:
+//   echo      深度1, 32字节, 原样回显
+//   pipeline  深度16, 64字节, 原样回显
+//   mixed     深度8, 包体16-2048字节对数均匀分布, 一半回显一半经处理函数计算校验和后回复
+//   bulk      深度4, 16字节请求, 处理函数回复32KB, 主要压发送路径
+//   snapshot  深度4, 16字节请求, 处理函数从64份4-16KB的类JSON行情快照中挑一份回复, 每次单独编码
+//   fanout    同snapshot, 但回复是预先建好的SharedFrame, 同一份快照发给所有连接时只编码(压缩)一次
+// compress=on时客户端连上后先发特性协商帧开启压缩, 收到的压缩帧都解压校验长度; 报告每个回复在线上的字节数
+// 分阶段耗时需要以-DEVENT_SERVER_STAGE_STATS=ON编译
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include "bench_util.hpp"
+#include "compress.hpp"
+#include "configmgr.hpp"
+#include "lz_codec.hpp"
+#include "msg_dispatcher.hpp"
+#include "session.hpp"
+#include "stage_stats.hpp"
+
+static const uint16_t kEchoType = 1;
+static const uint16_t kSumType = 2;
+static const uint16_t kBulkType = 3;
+static const uint16_t kSnapshotType = 4;
+static const uint16_t kFanoutType = 5;
+
+struct Script {
+    const char* _name;
+    int _depth;
+    size_t _min_body;
+    size_t _max_body;
+    int _handler_pct;       // 经处理函数的比例, 其余原样回显
+    uint16_t _handler_type;
+};
+
+static const Script kScripts[] = {
+    {"echo", 1, 32, 32, 0, kSumType},
+    {"pipeline", 16, 64, 64, 0, kSumType},
+    {"mixed", 8, 16, BUFF_SIZE, 50, kSumType},
+    {"bulk", 4, 16, 16, 100, kBulkType},
+    {"snapshot", 4, 16, 16, 100, kSnapshotType},
+    {"fanout", 4, 16, 16, 100, kFanoutType},
+};
+
+static const size_t kSnapshots = 64;
+
+// 固定种子生成的行情快照: 字段名重复, 数值随机, 压缩率接近真实的JSON推送
+static std::vector<std::string> make_snapshots() {
+    std::mt19937 rng(7);
+    std::vector<std::string> out;
+    for (size_t i = 0; i < kSnapshots; i++) {
+        size_t len = 4096 + rng() % (12 * 1024);
+        std::string s = "[";
+        char rec[160];
+        while (s.size() < len) {
+            int n = snprintf(rec, sizeof(rec),
+                             "{\"id\":%u,\"sym\":\"S%03u\",\"bid\":%u.%02u,\"ask\":%u.%02u,\"qty\":%u,\"ts\":%lu},",
+                             (unsigned)(rng() % 100000), (unsigned)(rng() % 500), (unsigned)(100 + rng() % 50),
+                             (unsigned)(rng() % 100), (unsigned)(100 + rng() % 50), (unsigned)(rng() % 100),
+                             (unsigned)(rng() % 10000), 1697712345000ul + rng() % 100000);
+            s.append(rec, n);
+        }
+        s.resize(len);
+        out.push_back(std::move(s));
+    }
+    return out;
+}
+
+// 每个连接一个发生器, 同样的种子和连接下标总是生成同样的帧序列
+class FrameScript {
+public:
+    FrameScript(const Script& script, uint64_t seed, int conn) : _script(script), _rng(seed * 1000003 + conn) {}
+    void next(std::string& out) {
+        size_t len = _script._min_body;
+        if (_script._max_body > _script._min_body) {
+            std::uniform_real_distribution<double> dist(std::log((double)_script._min_body), std::log((double)_script._max_body));
+            len = (size_t)std::exp(dist(_rng));
+        }
+        uint16_t type = kEchoType;
+        if (_script._handler_pct > 0 && (int)(_rng() % 100) < _script._handler_pct) {
+            type = _script._handler_type;
+        }
+        static const std::string pattern = [] {
+            std::string p(BUFF_SIZE, '\0');
+            for (size_t i = 0; i < p.size(); i++) {
+                p[i] = 'a' + i % 26;
+            }
+            return p;
+        }();
+        out += bench_encode(type, pattern.substr(0, len));
+    }
+private:
+    const Script& _script;
+    std::mt19937_64 _rng;
+};
+
+struct Client {
+    int _fd;
+    std::unique_ptr<FrameScript> _script;
+    std::string _out;
+    size_t _out_off = 0;
+    std::string _in;
+    std::deque<double> _sent_at;
+    size_t _sent = 0;
+    size_t _recv = 0;
+    size_t _quota = 0;
+    bool _compress = false;
+};
+
+struct RunResult {
+    double _msgs_per_sec;
+    double _p50_us;
+    double _p99_us;
+    double _wire_bytes;     // 客户端收到的字节数
+    double _raw_bytes;      // 解压后的回复字节数(含头部)
+    uint64_t _packed;       // 服务器压缩的帧数
+};
+
+static bool flush_out(Client& c) {
+    while (c._out_off < c._out.size()) {
+        ssize_t n = write(c._fd, c._out.data() + c._out_off, c._out.size() - c._out_off);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c._out_off += n;
+    }
+    c._out.clear();
+    c._out_off = 0;
+    return true;
+}
+
+static RunResult run_once(const Script& script, bool tcp, size_t frames, int conns, int threads, uint64_t seed,
+                          bool compress) {
+    EventLoop loop(threads);
+    std::unique_ptr<BenchAcceptor> acceptor;
+    if (tcp) {
+        acceptor.reset(new BenchAcceptor(&loop));
+    }
+    std::vector<Client> clients(conns);
+    int ep = epoll_create1(0);
+    for (int i = 0; i < conns; i++) {
+        Client& c = clients[i];
+        c._fd = tcp ? BenchAcceptor::connect_to(acceptor->port()) : bench_socketpair(&loop);
+        fcntl(c._fd, F_SETFL, fcntl(c._fd, F_GETFL) | O_NONBLOCK);
+        c._script.reset(new FrameScript(script, seed, i));
+        c._quota = frames / conns + (i < (int)(frames % conns) ? 1 : 0);
+        if (compress) {
+            // 协商帧排在所有请求前面, 之后收发的长度字段都只有14位
+            c._out = bench_encode(FEATURE_MSG_TYPE, std::string(1, (char)FEATURE_COMPRESS));
+            c._compress = true;
+        }
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, c._fd, &ev);
+    }
+
+    std::vector<double> samples;
+    samples.reserve(frames);
+    std::vector<struct epoll_event> events(conns);
+    std::vector<char> buf(256 * 1024);
+    std::vector<char> scratch(64 * 1024);
+    size_t done = 0;
+    double wire = 0;
+    double raw = 0;
+    uint64_t packed_before = CompressStats::Inst()._frames.load();
+    double start = bench_now_us();
+    // 每个连接保持depth个请求在途, 收到一个回复补发一个
+    auto top_up = [&](Client& c) {
+        while (c._sent < c._quota && c._sent - c._recv < (size_t)script._depth) {
+            c._script->next(c._out);
+            c._sent_at.push_back(bench_now_us());
+            c._sent++;
+        }
+        if (!flush_out(c)) {
+            std::cerr << "client write failed" << std::endl;
+            exit(1);
+        }
+    };
+    for (auto& c : clients) {
+        top_up(c);
+    }
+    while (done < frames) {
+        int n = epoll_wait(ep, events.data(), conns, 5000);
+        if (n <= 0) {
+            std::cerr << "loop_bench stalled, " << done << " of " << frames << " replies" << std::endl;
+            exit(1);
+        }
+        for (int i = 0; i < n; i++) {
+            Client& c = clients[events[i].data.u32];
+            ssize_t r = read(c._fd, buf.data(), buf.size());
+            if (r <= 0) {
+                if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    continue;
+                }
+                std::cerr << "client read failed" << std::endl;
+                exit(1);
+            }
+            c._in.append(buf.data(), r);
+            wire += r;
+            size_t off = 0;
+            while (c._in.size() - off >= HEAD_LEN) {
+                uint16_t t, l;
+                memcpy(&t, c._in.data() + off, 2);
+                memcpy(&l, c._in.data() + off + 2, 2);
+                uint16_t len_field = ntohs(l);
+                size_t body_len = c._compress ? (len_field & ~HEAD_FLAG_MASK) : len_field;
+                size_t frame_len = HEAD_LEN + body_len;
+                if (c._in.size() - off < frame_len) {
+                    break;
+                }
+                const char* body = c._in.data() + off + HEAD_LEN;
+                off += frame_len;
+                if (ntohs(t) == FEATURE_MSG_TYPE) {
+                    if (body_len != 1 || !(body[0] & FEATURE_COMPRESS)) {
+                        std::cerr << "compression not accepted" << std::endl;
+                        exit(1);
+                    }
+                    continue;
+                }
+                if (c._compress && (len_field & HEAD_COMPRESS_FLAG)) {
+                    uint32_t raw_len;
+                    memcpy(&raw_len, body, 4);
+                    raw_len = ntohl(raw_len);
+                    if (raw_len > scratch.size() ||
+                        lz_decompress(body + 4, body_len - 4, scratch.data(), scratch.size()) != (ssize_t)raw_len) {
+                        std::cerr << "inflate reply failed" << std::endl;
+                        exit(1);
+                    }
+                    raw += HEAD_LEN + raw_len;
+                }
+                else {
+                    raw += frame_len;
+                }
+                samples.push_back(bench_now_us() - c._sent_at.front());
+                c._sent_at.pop_front();
+                c._recv++;
+                done++;
+            }
+            c._in.erase(0, off);
+            top_up(c);
+        }
+        // 回复积压在客户端发送缓冲时继续尝试写
+        for (auto& c : clients) {
+            if (c._out_off < c._out.size()) {
+                flush_out(c);
+            }
+        }
+    }
+    double elapsed = (bench_now_us() - start) / 1e6;
+    for (auto& c : clients) {
+        close(c._fd);
+    }
+    close(ep);
+    loop.StopIOThread();
+    RunResult res;
+    res._msgs_per_sec = frames / elapsed;
+    res._p50_us = bench_percentile(samples, 0.5);
+    res._p99_us = bench_percentile(samples, 0.99);
+    res._wire_bytes = wire;
+    res._raw_bytes = raw;
+    res._packed = CompressStats::Inst()._frames.load() - packed_before;
+    return res;
+}
+
+int main(int argc, char* argv[]) {
+    std::string which = argc > 1 ? argv[1] : "all";
+    bool tcp = argc > 2 && std::string(argv[2]) == "tcp";
+    int runs = argc > 3 ? atoi(argv[3]) : 5;
+    size_t frames = argc > 4 ? atol(argv[4]) : 200000;
+    int conns = argc > 5 ? atoi(argv[5]) : 16;
+    int threads = argc > 6 ? atoi(argv[6]) : 1;
+    uint64_t seed = argc > 7 ? strtoull(argv[7], nullptr, 10) : 42;
+    bool compress = argc > 8 && std::string(argv[8]) == "on";
+    if (compress) {
+        // 压缩开关从配置读取, 写一份临时配置打开它
+        char path[] = "/tmp/loop_bench.XXXXXX";
+        int fd = mkstemp(path);
+        std::string ini = "[compress]\nenabled = true\nmin_bytes = 2048\n";
+        if (fd < 0 || write(fd, ini.data(), ini.size()) != (ssize_t)ini.size() ||
+            !ConfigMgr::Inst().loadFromFile(path)) {
+            std::cerr << "write temp config failed" << std::endl;
+            return 1;
+        }
+        close(fd);
+        unlink(path);
+    }
+
+    MsgDispatcher::Inst().Register(kSumType, [](std::shared_ptr<Session> sess, uint16_t type, const std::string& body) {
+        uint32_t h = 2166136261u;
+        for (unsigned char ch : body) {
+            h = (h ^ ch) * 16777619u;
+        }
+        std::string reply = body;
+        memcpy(&reply[0], &h, std::min(reply.size(), sizeof(h)));
+        sess->Send(type, reply);
+    });
+    std::string bulk(32 * 1024, 'b');
+    MsgDispatcher::Inst().Register(kBulkType, [bulk](std::shared_ptr<Session> sess, uint16_t type, const std::string&) {
+        sess->Send(type, bulk);
+    });
+    static const std::vector<std::string> snapshots = make_snapshots();
+    static const std::vector<std::shared_ptr<const SharedFrame>> shared = [] {
+        std::vector<std::shared_ptr<const SharedFrame>> out;
+        for (auto& s : snapshots) {
+            out.push_back(std::make_shared<const SharedFrame>(kFanoutType, s));
+        }
+        return out;
+    }();
+    // 请求包体相同, 按连接和请求次数轮流挑快照
+    MsgDispatcher::Inst().Register(kSnapshotType, [](std::shared_ptr<Session> sess, uint16_t type, const std::string&) {
+        static thread_local size_t next = 0;
+        sess->Send(type, snapshots[next++ % kSnapshots]);
+    });
+    MsgDispatcher::Inst().Register(kFanoutType, [](std::shared_ptr<Session> sess, uint16_t, const std::string&) {
+        static thread_local size_t next = 0;
+        sess->Send(shared[next++ % kSnapshots]);
+    });
+
+    printf("%s transport, %zu frames per run, %d conns, %d io threads, seed %lu, compress %s\n", tcp ? "tcp" : "unix",
+           frames, conns, threads, seed, compress ? "on" : "off");
+#ifndef EVENT_SERVER_STAGE_STATS
+    printf("stage timings disabled, rebuild with -DEVENT_SERVER_STAGE_STATS=ON\n");
+#endif
+    for (const Script& script : kScripts) {
+        if (which != "all" && which != script._name) {
+            continue;
+        }
+        StageStats::Reset();
+        std::vector<double> rates;
+        std::vector<double> p99s;
+        double wire = 0;
+        double raw = 0;
+        uint64_t packed = 0;
+        for (int r = 0; r < runs; r++) {
+            auto res = run_once(script, tcp, frames, conns, threads, seed, compress);
+            rates.push_back(res._msgs_per_sec);
+            p99s.push_back(res._p99_us);
+            wire += res._wire_bytes;
+            raw += res._raw_bytes;
+            packed += res._packed;
+        }
+        double lo = *std::min_element(rates.begin(), rates.end());
+        double hi = *std::max_element(rates.begin(), rates.end());
+        double median = bench_percentile(rates, 0.5);
+        printf("%-9s %9.0f msg/s median  spread %5.1f%%  (min %.0f max %.0f)  p99 median %7.1f us\n", script._name,
+               median, (hi - lo) * 100 / median, lo, hi, bench_percentile(p99s, 0.5));
+        double replies = (double)frames * runs;
+        printf("          wire %8.0f B/reply (raw %8.0f, ratio %.2f)  %8.1f MB/s on the wire  %lu frames compressed\n",
+               wire / replies, raw / replies, raw > 0 ? wire / raw : 0, wire / replies * median / 1e6, packed);
+#ifdef EVENT_SERVER_STAGE_STATS
+        StageTotals totals = StageStats::Collect();
+        double total_frames = (double)frames * runs;
+        for (int s = 0; s < (int)Stage::Count; s++) {
+            if (totals._calls[s] == 0) {
+                continue;
+            }
+            printf("          %-9s %8.1f ns/frame  %8.1f ns/call  %10lu calls\n", StageStats::Name((Stage)s),
+                   totals._ns[s] / total_frames, (double)totals._ns[s] / totals._calls[s], totals._calls[s]);
+        }
+#endif
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+// 过载时关键请求的延迟: 若干连接按处理能力的load倍灌入低优先级的批量消息, 同时一个连接按固定间隔发关键请求
+// 用法: overload_bench [seconds=2] [work_us=20] [load=2] [bulk_conns=4] [target_ms=5]
+// 每条消息在处理函数里忙等work_us, 批量消息不回复, 关键请求原样回复
+// off     不开启过载保护, 关键请求排在积压的批量消息后面
+// codel   开启过载保护, 批量消息类型配置为shed_types, 过载时在分发前丢弃
+#include <csignal>
+#include <iostream>
+#include "bench_util.hpp"
+#include "msg_dispatcher.hpp"
+#include "overload.hpp"
+#include "session.hpp"
+
+static const uint16_t kCriticalType = 1;
+static const uint16_t kBulkType = 2;
+static std::atomic<uint64_t> g_bulk_done{0};
+
+static void spin_us(int us) {
+    double until = bench_now_us() + us;
+    while (bench_now_us() < until) {
+    }
+}
+
+struct OverloadResult {
+    double _p50_us;
+    double _p99_us;
+    size_t _requests;
+    size_t _timeouts;
+    double _bulk_per_sec;
+    uint64_t _shed;
+};
+
+static OverloadResult run_case(double seconds, int bulk_conns, double bulk_rate) {
+    EventLoop loop(1);
+    BenchAcceptor acceptor(&loop);
+    std::vector<int> bulk_fds;
+    for (int i = 0; i < bulk_conns; i++) {
+        bulk_fds.push_back(BenchAcceptor::connect_to(acceptor.port()));
+    }
+    int fd = BenchAcceptor::connect_to(acceptor.port());
+    // 不开启保护时关键请求要等内核缓冲区里的积压全部处理完, 超时后记为失败
+    struct timeval tv = {3, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    uint64_t shed0 = OverloadStats::Inst()._shed.load();
+    uint64_t bulk0 = g_bulk_done.load();
+
+    // 开环按固定速率发送, 不因服务端变慢而减速; 服务端完全读不动时才由TCP背压阻塞
+    std::atomic<bool> stop{false};
+    std::thread flooder([&] {
+        const int kBatch = 64;
+        std::string batch;
+        for (int i = 0; i < kBatch; i++) {
+            batch += bench_encode(kBulkType, std::string(32, 'x'));
+        }
+        double next = bench_now_us();
+        for (size_t i = 0; !stop; i++) {
+            if (!bench_write_all(bulk_fds[i % bulk_fds.size()], batch.data(), batch.size())) {
+                break;
+            }
+            next += kBatch * 1e6 / bulk_rate;
+            double wait = next - bench_now_us();
+            if (wait > 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds((int64_t)wait));
+            }
+        }
+    });
+
+    std::vector<double> samples;
+    size_t timeouts = 0;
+    std::string req = bench_encode(kCriticalType, "ping");
+    std::string body;
+    double start = bench_now_us();
+    double deadline = start + seconds * 1e6;
+    while (bench_now_us() < deadline) {
+        double t0 = bench_now_us();
+        bench_write_all(fd, req.data(), req.size());
+        if (bench_read_frame(fd, body) != kCriticalType) {
+            timeouts++;
+            break;
+        }
+        samples.push_back(bench_now_us() - t0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double elapsed = (bench_now_us() - start) / 1e6;
+    stop = true;
+    // 先关闭批量连接, 阻塞在写上的线程会因为出错返回
+    for (int bfd : bulk_fds) {
+        shutdown(bfd, SHUT_RDWR);
+    }
+    flooder.join();
+    for (int bfd : bulk_fds) {
+        close(bfd);
+    }
+    close(fd);
+    loop.StopIOThread();
+    OverloadResult res;
+    res._requests = samples.size();
+    res._timeouts = timeouts;
+    res._p50_us = bench_percentile(samples, 0.5);
+    res._p99_us = bench_percentile(samples, 0.99);
+    res._bulk_per_sec = (g_bulk_done.load() - bulk0) / elapsed;
+    res._shed = OverloadStats::Inst()._shed.load() - shed0;
+    return res;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    int work_us = argc > 2 ? atoi(argv[2]) : 20;
+    double load = argc > 3 ? atof(argv[3]) : 2;
+    int bulk_conns = argc > 4 ? atoi(argv[4]) : 4;
+    int target_ms = argc > 5 ? atoi(argv[5]) : 5;
+    double bulk_rate = load * 1e6 / work_us;
+    signal(SIGPIPE, SIG_IGN);
+
+    MsgDispatcher::Inst().Register(kCriticalType, [work_us](std::shared_ptr<Session> sess, uint16_t, const std::string& body) {
+        spin_us(work_us);
+        sess->Send(kCriticalType, body);
+    });
+    MsgDispatcher::Inst().Register(kBulkType, [work_us](std::shared_ptr<Session>, uint16_t, const std::string&) {
+        spin_us(work_us);
+        g_bulk_done.fetch_add(1, std::memory_order_relaxed);
+    });
+
+    struct Mode {
+        const char* _name;
+        OverloadConfig _cfg;
+    };
+    std::vector<Mode> modes = {
+        {"off", OverloadConfig(false, target_ms, 100, {})},
+        {"codel", OverloadConfig(true, target_ms, 100, {kBulkType})},
+    };
+    printf("work %d us per message, capacity ~%d msg/s, bulk offered %.0f msg/s on %d connections\n", work_us,
+           1000000 / work_us, bulk_rate, bulk_conns);
+    for (auto& mode : modes) {
+        OverloadConfig::Replace(mode._cfg);
+        auto res = run_case(seconds, bulk_conns, bulk_rate);
+        printf("%-6s critical p50 %9.1f us  p99 %9.1f us  (%zu reqs, %zu timeouts)   bulk done %8.0f/s  shed %lu\n",
+               mode._name, res._p50_us, res._p99_us, res._requests, res._timeouts, res._bulk_per_sec, res._shed);
+    }
+    return 0;
+}
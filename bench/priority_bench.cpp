@@ -0,0 +1,111 @@
+// 大流量下控制消息的延迟: 一个连接上持续请求大块回包, 同时周期性发心跳, 测心跳回包的排队时间
+// 用法: priority_bench [seconds=2] [outstanding=64] [bulk_kb=60] [threads=2]
+// 客户端保持outstanding个大块请求未完成, 服务端发送队列里始终积压约outstanding*bulk_kb的数据
+// fifo      所有消息一个队列, 心跳排在积压数据后面
+// strict    心跳优先级0, 大块数据优先级1
+// weighted  同上, 权重8:1
+#include <csignal>
+#include <iostream>
+#include "bench_util.hpp"
+#include "msg_dispatcher.hpp"
+#include "send_priority.hpp"
+#include "session.hpp"
+
+static const uint16_t kPingType = 1;
+static const uint16_t kBulkType = 2;
+static const int kKernelBuf = 128 * 1024;
+
+struct PriorityResult {
+    double _p50_us;
+    double _p99_us;
+    double _bulk_mb_per_sec;
+    size_t _pings;
+};
+
+static PriorityResult run_case(double seconds, int outstanding, int threads) {
+    EventLoop loop(threads);
+    BenchAcceptor acceptor(&loop);
+    // 回环上内核缓冲会自动增长到几MB, 积压全在内核里, 应用层的优先级无从发挥;
+    // 两端缓冲限制在256KB左右, 相当于一条带宽时延积不大的真实链路
+    acceptor.set_sndbuf(kKernelBuf);
+    int fd = BenchAcceptor::connect_to(acceptor.port());
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &kKernelBuf, sizeof(kKernelBuf));
+    std::string bulk_req = bench_encode(kBulkType, "");
+    std::string batch;
+    for (int i = 0; i < outstanding; i++) {
+        batch += bulk_req;
+    }
+    bench_write_all(fd, batch.data(), batch.size());
+
+    std::vector<double> samples;
+    std::string body;
+    size_t bulk_bytes = 0;
+    double ping_sent = 0;
+    double start = bench_now_us();
+    double deadline = start + seconds * 1e6;
+    // 每收到outstanding/4个大块回包发一次心跳, 心跳回来之前不再发
+    int since_ping = 0;
+    while (bench_now_us() < deadline) {
+        int type = bench_read_frame(fd, body);
+        if (type < 0) {
+            std::cerr << "read frame failed" << std::endl;
+            exit(1);
+        }
+        if (type == kPingType) {
+            samples.push_back(bench_now_us() - ping_sent);
+            ping_sent = 0;
+            continue;
+        }
+        bulk_bytes += body.size() + HEAD_LEN;
+        bench_write_all(fd, bulk_req.data(), bulk_req.size());
+        if (ping_sent == 0 && ++since_ping >= std::max(1, outstanding / 4)) {
+            since_ping = 0;
+            std::string ping = bench_encode(kPingType, "ping");
+            ping_sent = bench_now_us();
+            bench_write_all(fd, ping.data(), ping.size());
+        }
+    }
+    double elapsed = (bench_now_us() - start) / 1e6;
+    close(fd);
+    loop.StopIOThread();
+    PriorityResult res;
+    res._pings = samples.size();
+    res._p50_us = bench_percentile(samples, 0.5);
+    res._p99_us = bench_percentile(samples, 0.99);
+    res._bulk_mb_per_sec = bulk_bytes / elapsed / 1e6;
+    return res;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    int outstanding = argc > 2 ? atoi(argv[2]) : 64;
+    size_t bulk_len = (argc > 3 ? atoi(argv[3]) : 60) * 1024;
+    int threads = argc > 4 ? atoi(argv[4]) : 2;
+    bulk_len = std::min<size_t>(bulk_len, 65535);
+    // 结束时客户端直接关闭, 服务端还有积压数据
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string bulk(bulk_len, 'b');
+    MsgDispatcher::Inst().Register(kBulkType, [bulk](std::shared_ptr<Session> sess, uint16_t, const std::string&) {
+        sess->Send(kBulkType, bulk);
+    });
+    // 心跳没有注册处理函数, 原样回显
+
+    struct Mode {
+        const char* _name;
+        SendPriorityConfig _cfg;
+    };
+    std::vector<Mode> modes = {
+        {"fifo", SendPriorityConfig(1, 0, {}, {})},
+        {"strict", SendPriorityConfig(2, 1, {{kPingType, 0}}, {})},
+        {"weighted", SendPriorityConfig(2, 1, {{kPingType, 0}}, {8, 1})},
+    };
+    printf("outstanding %d x %zu B bulk replies\n", outstanding, bulk_len);
+    for (auto& mode : modes) {
+        SendPriorityConfig::Replace(mode._cfg);
+        auto res = run_case(seconds, outstanding, threads);
+        printf("%-9s ping p50 %8.1f us  p99 %8.1f us  (%zu pings)   bulk %7.1f MB/s\n", mode._name,
+               res._p50_us, res._p99_us, res._pings, res._bulk_mb_per_sec);
+    }
+    return 0;
+}
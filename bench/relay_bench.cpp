@@ -0,0 +1,159 @@
+// 中继模式: splice与read/write拷贝的吞吐和小包往返延迟, 以及直连后端作为基线
+// 用法: relay_bench [mbytes=256] [rtt_count=20000] [threads=2]
+// 后端是进程内的回显服务, 每个连接一个阻塞线程; 客户端一个线程写一个线程读
+#include <sys/resource.h>
+#include <iostream>
+#include <mutex>
+#include "bench_util.hpp"
+#include "relay.hpp"
+
+// 阻塞式回显后端
+class EchoBackend {
+public:
+    EchoBackend() : _stop(false) {
+        _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listen_fd, SOMAXCONN) < 0) {
+            perror("backend listen");
+            exit(1);
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(_listen_fd, (struct sockaddr*)&addr, &len);
+        _port = ntohs(addr.sin_port);
+        _thread = std::thread([this] {
+            while (!_stop) {
+                int fd = accept(_listen_fd, nullptr, nullptr);
+                if (fd < 0 || _stop) {
+                    if (fd >= 0) {
+                        close(fd);
+                    }
+                    continue;
+                }
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                std::lock_guard<std::mutex> lk(_mtx);
+                _conns.emplace_back([fd] {
+                    std::vector<char> buf(65536);
+                    ssize_t n;
+                    while ((n = read(fd, buf.data(), buf.size())) > 0) {
+                        if (!bench_write_all(fd, buf.data(), n)) {
+                            break;
+                        }
+                    }
+                    close(fd);
+                });
+            }
+        });
+    }
+    ~EchoBackend() {
+        _stop = true;
+        close(BenchAcceptor::connect_to(_port));
+        _thread.join();
+        close(_listen_fd);
+        // 中继侧关闭后后端连接都会读到EOF退出
+        std::lock_guard<std::mutex> lk(_mtx);
+        for (auto& t : _conns) {
+            t.join();
+        }
+    }
+    int port() const { return _port; }
+private:
+    std::atomic<bool> _stop;
+    int _listen_fd;
+    int _port;
+    std::thread _thread;
+    std::mutex _mtx;
+    std::vector<std::thread> _conns;
+};
+
+static double cpu_sec() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// 一个线程持续写, 本线程读回全部数据, 返回MB/s
+static double run_throughput(int port, size_t total) {
+    int fd = BenchAcceptor::connect_to(port);
+    std::thread writer([fd, total] {
+        std::vector<char> buf(65536, 'x');
+        size_t sent = 0;
+        while (sent < total) {
+            size_t n = std::min(buf.size(), total - sent);
+            if (!bench_write_all(fd, buf.data(), n)) {
+                break;
+            }
+            sent += n;
+        }
+    });
+    std::vector<char> buf(65536);
+    size_t got = 0;
+    double t0 = bench_now_us();
+    while (got < total) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    double us = bench_now_us() - t0;
+    writer.join();
+    close(fd);
+    return got / us;
+}
+
+static void run_rtt(int port, int count, double& p50, double& p99) {
+    int fd = BenchAcceptor::connect_to(port);
+    char msg[64], back[64];
+    memset(msg, 'y', sizeof(msg));
+    std::vector<double> samples;
+    samples.reserve(count);
+    for (int i = 0; i < count; i++) {
+        double t0 = bench_now_us();
+        if (!bench_write_all(fd, msg, sizeof(msg)) || !bench_read_all(fd, back, sizeof(back))) {
+            break;
+        }
+        samples.push_back(bench_now_us() - t0);
+    }
+    close(fd);
+    p50 = bench_percentile(samples, 0.5);
+    p99 = bench_percentile(samples, 0.99);
+}
+
+static void run_mode(const char* name, int port, size_t total, int rtt_count) {
+    double c0 = cpu_sec();
+    double mbps = run_throughput(port, total);
+    double cpu = cpu_sec() - c0;
+    double p50, p99;
+    run_rtt(port, rtt_count, p50, p99);
+    printf("%-8s %8.1f MB/s   cpu %6.2f s/GB   rtt p50 %6.1f us  p99 %6.1f us\n", name, mbps,
+           cpu / (total / 1e9), p50, p99);
+}
+
+int main(int argc, char* argv[]) {
+    size_t total = (argc > 1 ? atol(argv[1]) : 256) << 20;
+    int rtt_count = argc > 2 ? atoi(argv[2]) : 20000;
+    int threads = argc > 3 ? atoi(argv[3]) : 2;
+    EchoBackend backend;
+
+    // cpu包含回显后端和客户端, 各模式之间只差中继这一段
+    run_mode("direct", backend.port(), total, rtt_count);
+    for (bool copy : {false, true}) {
+        EventLoop loop(threads);
+        RelayConfig cfg;
+        cfg._backend_host = "127.0.0.1";
+        cfg._backend_port = backend.port();
+        cfg._pool_size = 8;
+        cfg._copy = copy;
+        loop.EnableRelay(cfg);
+        BenchAcceptor acceptor(&loop, CodecType::Relay);
+        run_mode(copy ? "copy" : "splice", acceptor.port(), total, rtt_count);
+        loop.StopIOThread();
+    }
+    return 0;
+}
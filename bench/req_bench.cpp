@@ -0,0 +1,254 @@
+// 快慢请求混合时的吞吐和尾延迟: 按序完成 vs 带请求id乱序完成
+// 用法: req_bench [seconds=2] [conns=8] [depth=4] [slow_pct=5] [slow_us=1000] [workers=64] [threads=2]
+// 每个连接保持depth个请求未回复, 其中slow_pct%是慢请求, 处理时要等slow_us(模拟阻塞的后端调用), 快请求直接回复
+// inline     慢请求在IO线程内等待, 同一线程上所有连接都被挡住
+// ordered    慢请求Defer后交给工作线程, 回复按请求顺序发出, 连接上排在慢请求后面的快请求跟着等
+// unordered  客户端使用扩展头部带请求id, 快请求的回复立即发出
+// 连接是socketpair, 客户端用poll同时收所有连接
+#include <csignal>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <unordered_map>
+#include "bench_util.hpp"
+#include "msg_dispatcher.hpp"
+#include "session.hpp"
+
+static const uint16_t kFastType = 1;
+static const uint16_t kSlowType = 2;
+
+enum class Mode { Inline, Ordered, Unordered };
+static Mode g_mode;
+static int g_slow_us;
+
+// 工作线程池, 模拟处理慢请求的后端
+class WorkerPool {
+public:
+    explicit WorkerPool(int n) : _stop(false) {
+        for (int i = 0; i < n; i++) {
+            _threads.emplace_back([this] { run(); });
+        }
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lk(_mtx);
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto& t : _threads) {
+            t.join();
+        }
+    }
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lk(_mtx);
+            _jobs.push_back(std::move(job));
+        }
+        _cv.notify_one();
+    }
+private:
+    void run() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lk(_mtx);
+                _cv.wait(lk, [this] { return _stop || !_jobs.empty(); });
+                if (_stop && _jobs.empty()) {
+                    return;
+                }
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+            job();
+        }
+    }
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::deque<std::function<void()>> _jobs;
+    bool _stop;
+    std::vector<std::thread> _threads;
+};
+
+static WorkerPool* g_pool;
+
+struct Outstanding {
+    double _sent_us;
+    bool _slow;
+};
+
+struct Conn {
+    int _fd;
+    std::string _in;
+    uint32_t _next_id = 1;
+    std::deque<Outstanding> _fifo;                      // 按序回复
+    std::unordered_map<uint32_t, Outstanding> _by_id;   // 按id回复
+};
+
+struct ReqResult {
+    double _replies_per_sec;
+    double _fast_p50_us;
+    double _fast_p99_us;
+    double _slow_p50_us;
+    double _slow_p99_us;
+};
+
+static std::string encode_req(bool with_id, uint16_t type, uint32_t id, const std::string& body) {
+    if (!with_id) {
+        return bench_encode(type, body);
+    }
+    std::string out(HEAD_LEN + HEAD_REQ_ID_LEN + body.size(), '\0');
+    uint16_t t = htons(type);
+    uint16_t l = htons(body.size() | HEAD_REQ_ID_FLAG);
+    uint32_t i = htonl(id);
+    memcpy(&out[0], &t, 2);
+    memcpy(&out[2], &l, 2);
+    memcpy(&out[4], &i, 4);
+    memcpy(&out[8], body.data(), body.size());
+    return out;
+}
+
+static void send_req(Conn& c, bool with_id, bool slow, const std::string& body, double now) {
+    uint32_t id = c._next_id++;
+    std::string req = encode_req(with_id, slow ? kSlowType : kFastType, id, body);
+    if (with_id) {
+        c._by_id[id] = Outstanding{now, slow};
+    }
+    else {
+        c._fifo.push_back(Outstanding{now, slow});
+    }
+    bench_write_all(c._fd, req.data(), req.size());
+}
+
+static ReqResult run_case(Mode mode, double seconds, int conns, int depth, double slow_ratio, int threads) {
+    g_mode = mode;
+    bool with_id = mode == Mode::Unordered;
+    EventLoop loop(threads);
+    std::mt19937 rng(42);
+    std::bernoulli_distribution pick_slow(slow_ratio);
+    std::string body(32, 'r');
+    std::vector<Conn> cs(conns);
+    std::vector<struct pollfd> pfds(conns);
+    double now = bench_now_us();
+    for (int i = 0; i < conns; i++) {
+        cs[i]._fd = bench_socketpair(&loop);
+        pfds[i].fd = cs[i]._fd;
+        pfds[i].events = POLLIN;
+        for (int d = 0; d < depth; d++) {
+            send_req(cs[i], with_id, pick_slow(rng), body, now);
+        }
+    }
+    std::vector<double> fast, slow;
+    size_t replies = 0;
+    size_t head_len = with_id ? HEAD_LEN + HEAD_REQ_ID_LEN : HEAD_LEN;
+    char buf[65536];
+    double start = bench_now_us();
+    double deadline = start + seconds * 1e6;
+    while ((now = bench_now_us()) < deadline) {
+        if (poll(pfds.data(), pfds.size(), 100) <= 0) {
+            continue;
+        }
+        for (int i = 0; i < conns; i++) {
+            if (!(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            Conn& c = cs[i];
+            ssize_t n = read(c._fd, buf, sizeof(buf));
+            if (n <= 0) {
+                std::cerr << "read failed" << std::endl;
+                exit(1);
+            }
+            c._in.append(buf, n);
+            size_t pos = 0;
+            now = bench_now_us();
+            while (c._in.size() - pos >= head_len) {
+                uint16_t l;
+                memcpy(&l, &c._in[pos + 2], 2);
+                size_t len = ntohs(l);
+                if (with_id) {
+                    len &= ~HEAD_FLAG_MASK;
+                }
+                if (c._in.size() - pos < head_len + len) {
+                    break;
+                }
+                Outstanding o;
+                if (with_id) {
+                    uint32_t id;
+                    memcpy(&id, &c._in[pos + HEAD_LEN], 4);
+                    auto it = c._by_id.find(ntohl(id));
+                    if (it == c._by_id.end()) {
+                        std::cerr << "unknown request id " << ntohl(id) << std::endl;
+                        exit(1);
+                    }
+                    o = it->second;
+                    c._by_id.erase(it);
+                }
+                else {
+                    o = c._fifo.front();
+                    c._fifo.pop_front();
+                }
+                pos += head_len + len;
+                (o._slow ? slow : fast).push_back(now - o._sent_us);
+                replies++;
+                send_req(c, with_id, pick_slow(rng), body, now);
+            }
+            c._in.erase(0, pos);
+        }
+    }
+    double elapsed = (bench_now_us() - start) / 1e6;
+    for (auto& c : cs) {
+        close(c._fd);
+    }
+    loop.StopIOThread();
+    ReqResult res;
+    res._replies_per_sec = replies / elapsed;
+    res._fast_p50_us = bench_percentile(fast, 0.5);
+    res._fast_p99_us = bench_percentile(fast, 0.99);
+    res._slow_p50_us = bench_percentile(slow, 0.5);
+    res._slow_p99_us = bench_percentile(slow, 0.99);
+    return res;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    int conns = argc > 2 ? atoi(argv[2]) : 8;
+    int depth = argc > 3 ? atoi(argv[3]) : 4;
+    double slow_pct = argc > 4 ? atof(argv[4]) : 5;
+    g_slow_us = argc > 5 ? atoi(argv[5]) : 1000;
+    int workers = argc > 6 ? atoi(argv[6]) : 64;
+    int threads = argc > 7 ? atoi(argv[7]) : 2;
+    // 结束时客户端直接关闭, 工作线程可能还在回复
+    signal(SIGPIPE, SIG_IGN);
+
+    WorkerPool pool(workers);
+    g_pool = &pool;
+    MsgDispatcher::Inst().Register(kFastType, [](std::shared_ptr<Session> sess, uint16_t type, const std::string& data) {
+        sess->Send(type, data);
+    });
+    MsgDispatcher::Inst().Register(kSlowType, [](std::shared_ptr<Session> sess, uint16_t type, const std::string& data) {
+        if (g_mode == Mode::Inline) {
+            std::this_thread::sleep_for(std::chrono::microseconds(g_slow_us));
+            sess->Send(type, data);
+            return;
+        }
+        DeferredReq req = sess->Defer();
+        g_pool->post([sess, req, type, data] {
+            std::this_thread::sleep_for(std::chrono::microseconds(g_slow_us));
+            sess->Reply(req, type, data);
+        });
+    });
+
+    printf("%d conns x %d outstanding, %.1f%% slow (%d us), %d workers, %d io threads\n", conns, depth, slow_pct,
+           g_slow_us, workers, threads);
+    const std::pair<const char*, Mode> cases[] = {
+        {"inline", Mode::Inline}, {"ordered", Mode::Ordered}, {"unordered", Mode::Unordered}};
+    for (auto& c : cases) {
+        auto res = run_case(c.second, seconds, conns, depth, slow_pct / 100, threads);
+        printf("%-10s %9.0f replies/s  fast p50 %8.1f us p99 %8.1f us  slow p50 %8.1f us p99 %8.1f us\n", c.first,
+               res._replies_per_sec, res._fast_p50_us, res._fast_p99_us, res._slow_p50_us, res._slow_p99_us);
+    }
+    return 0;
+}
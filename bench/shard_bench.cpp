@@ -0,0 +1,141 @@
+// 分片状态与全局锁的键查找/更新吞吐, 随IO线程数的扩展性
+// 用法: shard_bench [threads=1,2,4] [seconds=1] [keys=100000] [depth=64]
+// sharded  每个IO线程保持depth个请求在途, 一半Get一半Incr, 键随机; 其他分片的键经线程间的环往返
+// mutex    同样的键和操作比例, 所有IO线程共用一个加锁的unordered_map
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include "bench_util.hpp"
+#include "shard.hpp"
+
+static std::vector<std::string> g_keys;
+static std::atomic<bool> g_stop{false};
+
+struct Worker {
+    uint64_t _rng;
+    std::atomic<uint64_t> _ops{0};
+    uint64_t next() {
+        _rng ^= _rng << 13;
+        _rng ^= _rng >> 7;
+        _rng ^= _rng << 17;
+        return _rng;
+    }
+};
+
+static void issue(Worker* w) {
+    if (g_stop.load(std::memory_order_relaxed)) {
+        return;
+    }
+    uint64_t r = w->next();
+    const std::string& key = g_keys[r % g_keys.size()];
+    auto cb = [w](const ShardReply&) {
+        w->_ops.fetch_add(1, std::memory_order_relaxed);
+        issue(w);
+    };
+    if (r & (1ull << 40)) {
+        ShardStore::Get(key, cb);
+    }
+    else {
+        ShardStore::Incr(key, 1, cb);
+    }
+}
+
+struct LockedStore {
+    std::mutex _mtx;
+    std::unordered_map<std::string, int64_t> _map;
+};
+
+// 每次在IO线程内执行一批操作后重新入队, 让IO线程照常跑事件循环
+static void locked_batch(Worker* w, LockedStore* store, IOThread* thr) {
+    if (g_stop.load(std::memory_order_relaxed)) {
+        return;
+    }
+    for (int i = 0; i < 256; i++) {
+        uint64_t r = w->next();
+        const std::string& key = g_keys[r % g_keys.size()];
+        std::lock_guard<std::mutex> lk(store->_mtx);
+        if (r & (1ull << 40)) {
+            auto iter = store->_map.find(key);
+            (void)iter;
+        }
+        else {
+            store->_map[key] += 1;
+        }
+    }
+    w->_ops.fetch_add(256, std::memory_order_relaxed);
+    thr->run_in_loop([w, store, thr] { locked_batch(w, store, thr); });
+}
+
+static double run_case(bool sharded, int threads, double seconds, int depth) {
+    EventLoop loop(threads);
+    LockedStore store;
+    if (sharded) {
+        loop.EnableShards();
+    }
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex mtx;
+    g_stop = false;
+    loop.RunInEachThread([&] {
+        Worker* w;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            workers.emplace_back(new Worker());
+            w = workers.back().get();
+            w->_rng = 0x9E3779B97F4A7C15ull * workers.size();
+        }
+        if (sharded) {
+            for (int i = 0; i < depth; i++) {
+                issue(w);
+            }
+        }
+        else {
+            locked_batch(w, &store, IOThread::current());
+        }
+    });
+    // 预热后再计时
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto total = [&] {
+        std::lock_guard<std::mutex> lk(mtx);
+        uint64_t n = 0;
+        for (auto& w : workers) {
+            n += w->_ops.load(std::memory_order_relaxed);
+        }
+        return n;
+    };
+    uint64_t ops0 = total();
+    double t0 = bench_now_us();
+    std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(seconds * 1e6)));
+    uint64_t ops = total() - ops0;
+    double elapsed = (bench_now_us() - t0) / 1e6;
+    g_stop = true;
+    // 等在途请求和批处理结束, Worker才能释放
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    loop.StopIOThread();
+    return ops / elapsed / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    std::string thread_list = argc > 1 ? argv[1] : "1,2,4";
+    double seconds = argc > 2 ? atof(argv[2]) : 1;
+    int keys = argc > 3 ? atoi(argv[3]) : 100000;
+    int depth = argc > 4 ? atoi(argv[4]) : 64;
+    for (int i = 0; i < keys; i++) {
+        g_keys.push_back("user:" + std::to_string(i));
+    }
+    printf("cpus %u keys %d depth %d, 50%% get 50%% incr\n", std::thread::hardware_concurrency(), keys, depth);
+    double base_sharded = 0, base_mutex = 0;
+    std::stringstream ss(thread_list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int threads = atoi(item.c_str());
+        double sharded = run_case(true, threads, seconds, depth);
+        double locked = run_case(false, threads, seconds, depth);
+        if (base_sharded == 0) {
+            base_sharded = sharded / threads;
+            base_mutex = locked / threads;
+        }
+        printf("threads %2d   sharded %6.2f Mops/s (x%.2f)   mutex %6.2f Mops/s (x%.2f)\n", threads,
+               sharded, sharded / base_sharded, locked, locked / base_mutex);
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+// 飞行记录器单条记录的开销, 以及导出Chrome trace的耗时
+// 用法: trace_bench [events_per_thread=10000000] [threads=2]
+// 直接调用FlightRecorder, 与EVENT_SERVER_TRACE开关无关; 开关对整体吞吐的影响用coro_bench在两种构建下对比
+#include <iostream>
+#include "bench_util.hpp"
+#include "flight_recorder.hpp"
+
+int main(int argc, char* argv[]) {
+    long events = argc > 1 ? atol(argv[1]) : 10000000;
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+
+    std::vector<std::thread> workers;
+    std::vector<double> ns_per_event(threads);
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([t, events, &ns_per_event] {
+            FlightRecorder* rec = FlightRecorder::local();
+            double t0 = bench_now_us();
+            for (long i = 0; i < events; i++) {
+                rec->record(TraceEvent::FrameDecoded, t, (uint32_t)i);
+            }
+            ns_per_event[t] = (bench_now_us() - t0) * 1000.0 / events;
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    double t0 = bench_now_us();
+    std::string json = FlightRecorder::DumpChromeTrace();
+    double dump_ms = (bench_now_us() - t0) / 1000.0;
+
+    printf("events=%ld threads=%d ring=%zu\n", events, threads, FlightRecorder::kCapacity);
+    for (int t = 0; t < threads; t++) {
+        printf("thread %d   %6.2f ns/event\n", t, ns_per_event[t]);
+    }
+    printf("dump       %6.1f ms   %zu bytes\n", dump_ms, json.size());
+    return 0;
+}
@@ -0,0 +1,161 @@
+// UDP接收吞吐: IOThread的recvmmsg批量路径 对比 每个数据报一次recvfrom的朴素循环
+// 用法: udp_bench [datagrams=1000000] [body=32] [threads=1] [batch=32]
+#include <iostream>
+#include <fcntl.h>
+#include "bench_util.hpp"
+#include "msg_dispatcher.hpp"
+#include "udp_channel.hpp"
+
+static std::atomic<uint64_t> g_received(0);
+// 接收线程的CPU时间, 单核机器上发送端与接收端抢占CPU, 墙钟pps不稳定, 以每个数据报的CPU开销为准
+static std::atomic<int64_t> g_cpu_start(0);
+static std::atomic<int64_t> g_cpu_end(0);
+
+static int64_t thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void on_datagram() {
+    if (g_received.fetch_add(1, std::memory_order_relaxed) == 0) {
+        g_cpu_start = thread_cpu_ns();
+    }
+    g_cpu_end = thread_cpu_ns();
+}
+
+// 绑定端口0拿到一个空闲端口号
+static int pick_udp_port() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+// 用sendmmsg尽快发出count个数据报, 发送端不成为瓶颈
+static void blast(int port, uint64_t count, int body_len) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+    std::string frame = bench_encode(2001, std::string(body_len, 'u'));
+    const int kBatch = 64;
+    struct mmsghdr msgs[kBatch];
+    struct iovec iov;
+    iov.iov_base = &frame[0];
+    iov.iov_len = frame.size();
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < kBatch; i++) {
+        msgs[i].msg_hdr.msg_iov = &iov;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    uint64_t sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(fd, msgs, std::min<uint64_t>(kBatch, count - sent), 0);
+        if (n > 0) {
+            sent += n;
+        }
+    }
+    close(fd);
+}
+
+// 接收端持续收包, 直到连续200ms没有新数据
+static double wait_drain(std::atomic<uint64_t>& counter, uint64_t expect, double start_us) {
+    uint64_t last = 0;
+    double last_change = bench_now_us();
+    double last_recv = start_us;
+    while (counter.load() < expect) {
+        usleep(1000);
+        uint64_t cur = counter.load();
+        if (cur != last) {
+            last = cur;
+            last_change = bench_now_us();
+            last_recv = last_change;
+        }
+        else if (bench_now_us() - last_change > 200000) {
+            break;
+        }
+    }
+    if (counter.load() >= expect) {
+        last_recv = bench_now_us();
+    }
+    return (last_recv - start_us) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t count = argc > 1 ? atoll(argv[1]) : 1000000;
+    int body_len = argc > 2 ? atoi(argv[2]) : 32;
+    int threads = argc > 3 ? atoi(argv[3]) : 1;
+    int batch = argc > 4 ? atoi(argv[4]) : 32;
+    printf("datagrams=%llu body=%d threads=%d batch=%d\n", (unsigned long long)count, body_len, threads, batch);
+
+    // 批量路径: 帧经过MsgDispatcher分发到处理函数
+    {
+        MsgDispatcher::Inst().Register(2001, [](std::shared_ptr<Session>, uint16_t, const std::string&) {
+            on_datagram();
+        });
+        EventLoop loop(threads);
+        int port = pick_udp_port();
+        loop.AddUdpListener(port);
+        usleep(50000);
+        double start = bench_now_us();
+        std::thread sender([&] { blast(port, count, body_len); });
+        double sec = wait_drain(g_received, count, start);
+        sender.join();
+        uint64_t got = g_received.load();
+        double cpu_ns = (double)(g_cpu_end - g_cpu_start) / std::max<uint64_t>(got, 1);
+        printf("recvmmsg   %10.0f pps wall   %7.0f ns cpu/datagram (%10.0f pps/core)   received %llu (%.1f%%)\n",
+               got / sec, cpu_ns, 1e9 / cpu_ns, (unsigned long long)got, 100.0 * got / count);
+        loop.StopIOThread();
+    }
+
+    // 朴素路径: 单线程阻塞recvfrom, 每个数据报一次系统调用, 同样解析帧并经过MsgDispatcher分发
+    {
+        std::atomic<uint64_t>& received = g_received;
+        received = 0;
+        int port = pick_udp_port();
+        int fd = UdpChannel::open_socket(port, false);
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+        struct timeval tv = {0, 100000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        std::atomic<bool> stop(false);
+        std::thread receiver([&] {
+            char buf[BUFF_SIZE + HEAD_LEN];
+            struct sockaddr_storage peer;
+            while (!stop) {
+                socklen_t len = sizeof(peer);
+                ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)&peer, &len);
+                if (n >= HEAD_LEN) {
+                    uint16_t t, l;
+                    memcpy(&t, buf, 2);
+                    memcpy(&l, buf + 2, 2);
+                    std::string body(buf + HEAD_LEN, std::min<size_t>(ntohs(l), n - HEAD_LEN));
+                    std::shared_ptr<Session> sess;
+                    MsgDispatcher::Inst().Dispatch(sess, ntohs(t), body);
+                }
+            }
+        });
+        double start = bench_now_us();
+        std::thread sender([&] { blast(port, count, body_len); });
+        double sec = wait_drain(received, count, start);
+        sender.join();
+        stop = true;
+        receiver.join();
+        close(fd);
+        uint64_t got = received.load();
+        double cpu_ns = (double)(g_cpu_end - g_cpu_start) / std::max<uint64_t>(got, 1);
+        printf("recvfrom   %10.0f pps wall   %7.0f ns cpu/datagram (%10.0f pps/core)   received %llu (%.1f%%)\n",
+               got / sec, cpu_ns, 1e9 / cpu_ns, (unsigned long long)got, 100.0 * got / count);
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+class DataBuf;
+
+// 每个监听端口对应一种帧格式
+enum class CodecType {
+    Binary = 0,     // 内置二进制头部(type + length), 走内嵌头部/DataBuf状态机
+    Line,           // 以\n分隔的文本行, 消息类型固定为LINE_MSG_TYPE
+    Http,           // HTTP/1.1 keep-alive请求, 消息类型固定为HTTP_MSG_TYPE
+    Relay,          // 不解析, 与后端连接配对后原样转发, 见relay.hpp
+};
+
+// 帧编解码接口, 实现必须无状态, 所有连接共享同一个实例
+class Codec {
+public:
+    virtual ~Codec() = default;
+    // 从buf中解析一帧, 返回消耗的字节数; 0表示数据不完整; -1表示协议错误需要断开
+    virtual ssize_t decode(const char* buf, size_t len, std::shared_ptr<DataBuf>& frame) = 0;
+    // 把处理函数的回复编码成线上格式
+    virtual void encode(uint16_t msg_type, const std::string& body, std::string& out) = 0;
+};
+
+// 文本行协议, 回复时追加\n
+class LineCodec : public Codec {
+public:
+    ssize_t decode(const char* buf, size_t len, std::shared_ptr<DataBuf>& frame) override;
+    void encode(uint16_t msg_type, const std::string& body, std::string& out) override;
+};
+
+// 最小化的HTTP/1.1请求解析, 仅支持Content-Length包体, 不支持chunked
+// 解析出的帧内容为"METHOD TARGET\n" + 请求包体
+// 回复时msg_type即HTTP状态码, 例如Send(200, "ok")
+class HttpCodec : public Codec {
+public:
+    ssize_t decode(const char* buf, size_t len, std::shared_ptr<DataBuf>& frame) override;
+    void encode(uint16_t msg_type, const std::string& body, std::string& out) override;
+};
+
+// Binary返回nullptr, 表示使用内置的头部状态机
+Codec* GetCodec(CodecType type);
+
+#endif
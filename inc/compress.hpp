@@ -0,0 +1,57 @@
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// [compress] 配置, 随配置重载生效
+//   enabled = false         是否接受客户端的压缩协商, 只影响之后的协商
+//   min_bytes = 2048        包体达到这个长度才尝试压缩
+// 客户端发一帧FEATURE_MSG_TYPE协商, 包体第一个字节是请求的特性位, 服务器回同类型一帧, 包体是接受的特性位.
+// 接受FEATURE_COMPRESS后该连接两个方向的长度字段都只取低14位, 置HEAD_COMPRESS_FLAG的帧包体为
+// [4字节原长度, 网络字节序][LZ4块]; 压缩后省不到1/8的包体原样发送
+bool CompressAccepted();
+
+class DataBuf;
+
+// 按协商好的二进制帧格式(带请求id/压缩)编码一帧, out至少要有BinaryFrameBound字节; 返回帧长度,
+// 包体超过14位又压不到14位以内时返回0
+size_t BinaryFrameBound(size_t len, bool with_id, bool compress);
+size_t EncodeBinaryFrame(char* out, uint16_t type, const char* body, size_t len, bool with_id, uint32_t req_id,
+                         bool compress);
+// 解压收到的压缩包体, 原长度超过max_len或数据损坏时返回空
+std::shared_ptr<DataBuf> InflateFrame(const DataBuf& frame, size_t max_len);
+
+struct CompressStats {
+    std::atomic<uint64_t> _frames{0};       // 压缩发送的帧数
+    std::atomic<uint64_t> _raw_bytes{0};    // 这些帧压缩前的包体字节数
+    std::atomic<uint64_t> _wire_bytes{0};   // 压缩后的包体字节数(含原长度)
+    std::atomic<uint64_t> _skipped{0};      // 达到阈值但压缩不划算, 原样发送的帧数
+    std::atomic<uint64_t> _inflated{0};     // 收到并解压的帧数
+    static CompressStats& Inst() {
+        static CompressStats stats;
+        return stats;
+    }
+};
+
+// 广播帧: 同一条消息发给很多连接时只编码一次, 压缩也只做一次. 按连接的帧格式(是否带请求id, 是否压缩)
+// 各缓存一份, 第一次用到时编码, 之后的连接只复制编码好的字节; 推送帧的请求id为0. 文本协议的连接每次单独编码
+class SharedFrame {
+public:
+    SharedFrame(uint16_t type, std::string body) : _type(type), _body(std::move(body)) {}
+    uint16_t type() const { return _type; }
+    const std::string& body() const { return _body; }
+    // 可以在任意线程调用; 这种格式放不下时返回空串
+    const std::string& encoded(bool with_id, bool compress) const;
+private:
+    uint16_t _type;
+    std::string _body;
+    mutable std::once_flag _once[4];
+    mutable std::string _enc[4];
+};
+
+#endif
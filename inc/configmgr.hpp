@@ -1,43 +1,183 @@
 #ifndef __CONFIG_MGR_H__
 #define __CONFIG_MGR_H__
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 一个键解析好的值, 按句柄的类型取其中一个字段
+struct ConfigValue {
+    long _num = 0;
+    double _real = 0;
+    bool _flag = false;
+    std::string _str;
+};
+
+// 一次加载得到的不可变快照, 通过原子指针发布(RCU); 旧快照不释放, 读者拿到的指针和引用一直有效.
+// 重载只在SIGHUP或配置文件变化时发生, 每个快照只有几KB
+struct ConfigSnapshot {
+    uint64_t _version = 0;
+    std::unordered_map<std::string, std::string> _kv;
+    std::vector<ConfigValue> _values;       // 按ConfigKey句柄下标, 加载时解析好
+};
 
 class ConfigMgr {
 public:
+    enum class Kind : uint8_t { Num, Real, Flag, Str };
+
+    // 解析文件并发布新快照; 失败时保留当前快照. 之后Reload重新读同一个文件
     bool loadFromFile(const std::string& filepath);
+    bool Reload();
+    const std::string& path() const { return _path; }
 
+    // 按名字查找并解析, 适合启动阶段; 热路径使用ConfigKey
     template<typename T>
     T get(const std::string& key, const T& defaultValue) const {
-        auto it = kv_.find(key);
-        if (it == kv_.end())    return defaultValue;
+        const ConfigSnapshot* snap = snapshot();
+        auto it = snap->_kv.find(key);
+        if (it == snap->_kv.end())    return defaultValue;
         return fromString<T>(it->second);
     }
 
     bool hasKey(const std::string& key) const {
-        return kv_.count(key) > 0;
+        return snapshot()->_kv.count(key) > 0;
     }
 
+    const ConfigSnapshot* snapshot() const { return _snap.load(std::memory_order_acquire); }
+    // 每次加载文件加一(注册新句柄不变), IO线程每轮比较一次, 变化时刷新本地拷贝
+    uint64_t version() const { return snapshot()->_version; }
+
+    // 注册一个键, 返回句柄下标; 已有快照会补上这个键的值
+    size_t Register(const std::string& key, Kind kind, const ConfigValue& def);
+    // 重载成功后在调用Reload的线程内回调, 返回的id用于注销; 回调内不能注册或注销
+    int AddListener(std::function<void()> func);
+    void RemoveListener(int id);
+
     static ConfigMgr& Inst() {
         static ConfigMgr mgr;
         return mgr;
     }
 private:
-    ConfigMgr() = default;
+    ConfigMgr();
     ConfigMgr(const ConfigMgr&) = delete;
     ConfigMgr& operator=(const ConfigMgr&) = delete;
-    std::string section_;
-    std::unordered_map<std::string, std::string> kv_;
+    // 用kv构造新快照并发布, 调用方持有_mtx
+    void publish(std::unordered_map<std::string, std::string>&& kv, uint64_t version);
+
+    struct KeyDef {
+        std::string _key;
+        Kind _kind;
+        ConfigValue _def;
+    };
+    std::atomic<const ConfigSnapshot*> _snap;
+    std::mutex _mtx;                                    // 保护下面的字段, 串行化加载和注册
+    std::string _path;
+    std::vector<KeyDef> _keys;
+    std::vector<std::unique_ptr<ConfigSnapshot>> _retired;
+    std::mutex _listener_mtx;                           // 保护回调列表, 回调期间一直持有
+    std::vector<std::pair<int, std::function<void()>>> _listeners;
+    int _next_listener;
 
     template<typename T>
     static T fromString(const std::string& s);
 };
 
-#endif
-
 template <typename T>
 inline T ConfigMgr::fromString(const std::string &s)
 {
     return T();
 }
+
+// 特化实现在configmgr.cpp中, 必须在此声明, 否则调用方会内联上面的通用版本
+template<> int ConfigMgr::fromString<int>(const std::string& s);
+template<> long ConfigMgr::fromString<long>(const std::string& s);
+template<> double ConfigMgr::fromString<double>(const std::string& s);
+template<> bool ConfigMgr::fromString<bool>(const std::string& s);
+template<> std::string ConfigMgr::fromString<std::string>(const std::string& s);
+
+template <typename T> struct ConfigKind;
+template <> struct ConfigKind<int> {
+    static const ConfigMgr::Kind kKind = ConfigMgr::Kind::Num;
+    static ConfigValue Make(int v) { ConfigValue c; c._num = v; return c; }
+    static int Get(const ConfigValue& c) { return (int)c._num; }
+};
+template <> struct ConfigKind<long> {
+    static const ConfigMgr::Kind kKind = ConfigMgr::Kind::Num;
+    static ConfigValue Make(long v) { ConfigValue c; c._num = v; return c; }
+    static long Get(const ConfigValue& c) { return c._num; }
+};
+template <> struct ConfigKind<double> {
+    static const ConfigMgr::Kind kKind = ConfigMgr::Kind::Real;
+    static ConfigValue Make(double v) { ConfigValue c; c._real = v; return c; }
+    static double Get(const ConfigValue& c) { return c._real; }
+};
+template <> struct ConfigKind<bool> {
+    static const ConfigMgr::Kind kKind = ConfigMgr::Kind::Flag;
+    static ConfigValue Make(bool v) { ConfigValue c; c._flag = v; return c; }
+    static bool Get(const ConfigValue& c) { return c._flag; }
+};
+template <> struct ConfigKind<std::string> {
+    static const ConfigMgr::Kind kKind = ConfigMgr::Kind::Str;
+    static ConfigValue Make(const std::string& v) { ConfigValue c; c._str = v; return c; }
+    static const std::string& Get(const ConfigValue& c) { return c._str; }
+};
+
+// 预先解析的键: 构造时注册一次, get()只是一次原子读加下标访问, 不查表也不解析字符串.
+// 一般定义成函数内的static; 值格式错误时使用默认值
+template <typename T>
+class ConfigKey {
+public:
+    ConfigKey(const std::string& key, const T& def) : _def(ConfigKind<T>::Make(def)) {
+        _id = ConfigMgr::Inst().Register(key, ConfigKind<T>::kKind, _def);
+    }
+    decltype(auto) get() const {
+        const ConfigSnapshot* snap = ConfigMgr::Inst().snapshot();
+        return ConfigKind<T>::Get(_id < snap->_values.size() ? snap->_values[_id] : _def);
+    }
+private:
+    size_t _id;
+    ConfigValue _def;
+};
+
+// 由配置派生的对象(解析好的消息类型表, 换算好的单位等), 配置重载后第一次访问时重建;
+// 旧对象和快照一样不释放. Replace之后固定不变, 不再跟随配置, 供基准测试切换策略
+template <typename T>
+class ConfigDerived {
+public:
+    explicit ConfigDerived(T (*make)()) : _make(make), _cur(nullptr), _pinned(false) {}
+    const T& get() {
+        auto* cur = _cur.load(std::memory_order_acquire);
+        if (cur && (cur->first == ConfigMgr::Inst().version() || _pinned.load(std::memory_order_relaxed))) {
+            return cur->second;
+        }
+        return rebuild(nullptr);
+    }
+    void replace(const T& value) { rebuild(&value); }
+private:
+    const T& rebuild(const T* value) {
+        std::lock_guard<std::mutex> lk(_mtx);
+        uint64_t version = ConfigMgr::Inst().version();
+        auto* cur = _cur.load(std::memory_order_relaxed);
+        if (value == nullptr && cur && (cur->first == version || _pinned.load(std::memory_order_relaxed))) {
+            return cur->second;
+        }
+        auto next = std::make_unique<std::pair<uint64_t, T>>(version, value ? *value : _make());
+        _cur.store(next.get(), std::memory_order_release);
+        _pinned.store(value != nullptr, std::memory_order_relaxed);
+        _all.push_back(std::move(next));
+        return _all.back()->second;
+    }
+    T (*_make)();
+    std::atomic<std::pair<uint64_t, T>*> _cur;
+    std::atomic<bool> _pinned;
+    std::mutex _mtx;
+    std::vector<std::unique_ptr<std::pair<uint64_t, T>>> _all;
+};
+
+#endif
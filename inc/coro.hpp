@@ -0,0 +1,115 @@
+#ifndef __CORO_H__
+#define __CORO_H__
+
+// C++20协程会话接口, 需要打开EVENT_SERVER_COROUTINE编译选项
+// 协程总是在Session的属主IOThread内恢复执行, 不会额外切换线程:
+//   CoTask handler(std::shared_ptr<Session> sess) {
+//       while (auto frame = co_await sess->read_frame()) {
+//           co_await sess->send(frame._type, frame._data);
+//           co_await sleep_for(10);
+//       }
+//   }
+#ifdef EVENT_SERVER_COROUTINE
+
+#include <coroutine>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include "session.hpp"
+#include "io_thread.hpp"
+
+// 协程帧内存池, 按64字节分档的线程本地空闲链表, 超过1KB的帧直接malloc
+class CoFramePool {
+public:
+    static void* alloc(size_t size);
+    static void free(void* p, size_t size);
+    // 当前存活的协程帧数量和字节数
+    static size_t live_frames();
+    static size_t live_bytes();
+};
+
+// 会话协程的返回类型, 创建后立即执行直到第一次挂起, 结束时自动释放协程帧
+// 以std::shared_ptr<Session>为参数的协程结束时会关闭该连接
+class CoTask {
+public:
+    struct promise_type {
+        promise_type() = default;
+        template<typename... Args>
+        promise_type(std::shared_ptr<Session> sess, Args&&...) : _sess(std::move(sess)) {}
+        CoTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void();
+        void unhandled_exception();
+        static void* operator new(size_t size) { return CoFramePool::alloc(size); }
+        static void operator delete(void* p, size_t size) { CoFramePool::free(p, size); }
+        std::shared_ptr<Session> _sess;
+    };
+};
+
+// read_frame的结果, 连接关闭后_closed为true
+struct CoFrame {
+    uint16_t _type;
+    std::string _data;
+    bool _closed;
+    explicit operator bool() const { return !_closed; }
+};
+
+// 每个Session上的协程状态, 随Session一起迁移
+struct CoState {
+    std::coroutine_handle<> _read_waiter;           // 挂起在read_frame上的协程
+    std::coroutine_handle<> _send_waiter;           // 挂起在send上等待发送队列排空的协程
+    std::vector<std::shared_ptr<DataBuf>> _inbox;   // 协程未在等待时收到的帧
+    bool _closed = false;                           // 连接已关闭
+    bool _done = false;                             // 协程已结束, 发送队列排空后关闭连接
+    bool _send_ok = true;
+};
+
+class ReadFrameAwaiter {
+public:
+    explicit ReadFrameAwaiter(Session* sess) : _sess(sess) {}
+    bool await_ready() const;
+    void await_suspend(std::coroutine_handle<> h);
+    CoFrame await_resume();
+private:
+    Session* _sess;
+};
+
+class SendAwaiter {
+public:
+    SendAwaiter(Session* sess, int msg_type, const std::string& data);
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> h);
+    // 数据全部写入内核返回true, 连接出错或已关闭返回false
+    bool await_resume();
+private:
+    Session* _sess;
+    std::shared_ptr<DataBuf> _buf;
+    int _res;
+};
+
+class SleepAwaiter {
+public:
+    explicit SleepAwaiter(int ms) : _ms(ms) {}
+    bool await_ready() const { return _ms <= 0; }
+    // 不在IO线程内时不挂起
+    bool await_suspend(std::coroutine_handle<> h);
+    void await_resume() {}
+private:
+    int _ms;
+};
+
+// 挂起当前协程ms毫秒, 到期后在Session的属主线程上恢复
+inline SleepAwaiter sleep_for(int ms) { return SleepAwaiter(ms); }
+
+using CoHandler = std::function<CoTask(std::shared_ptr<Session>)>;
+// 安装后新连接都由该协程处理, 需在EventLoop创建之前设置
+void SetCoroutineHandler(CoHandler handler);
+const CoHandler& GetCoroutineHandler();
+
+// 在sess的属主线程上恢复协程h
+void ResumeSession(std::shared_ptr<Session> sess, std::coroutine_handle<> h);
+
+#endif
+
+#endif
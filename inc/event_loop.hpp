@@ -4,18 +4,61 @@
 #include <vector>
 #include <memory>
 #include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include "io_thread.hpp"
+#include "relay.hpp"
+#include "shard.hpp"
 
 class EventLoop {
 public:
     EventLoop(int thread_num);
     ~EventLoop();
-    void NotifyNewCons(std::vector<int>& conns);
+    void NotifyNewCons(std::vector<int>& conns, CodecType codec = CodecType::Binary);
     void StopIOThread();
+    // 运行时调整IO线程数量, 缩容时被移除线程上的Session会迁移到剩余线程
+    bool ScaleTo(int thread_num);
+    // 按各线程上一个采样周期的负载, 把最忙线程上的热点Session迁往最闲的线程
+    void Rebalance();
+    // 每个IO线程各自绑定一个SO_REUSEPORT的UDP socket, 扩容的新线程也会加入
+    bool AddUdpListener(int port);
+    // 关闭所有UDP socket, 热升级交接后由新进程接收数据报
+    void CloseUdpListeners();
+    // 所有IO线程开启中继模式, 扩容的新线程也会建立自己的后端连接池
+    void EnableRelay(const RelayConfig& cfg);
+    // 每个IO线程拥有一个分片, 处理函数通过ShardStore访问; 开启后线程数固定, 只能在启动阶段调用一次
+    void EnableShards();
+    // 在每个IO线程内执行一次func
+    void RunInEachThread(std::function<void()> func);
+    // 所有IO线程上的Session总数
+    size_t SessionCount();
+    // 所有IO线程都过载, 没有开启过载保护时总是false
+    bool Overloaded();
 private:
+    void rebalance_loop();
+    // 配置了重平衡间隔且线程没有在运行时启动
+    void start_rebalance();
+    void stop_rebalance();
     std::vector<std::unique_ptr<IOThread>> _work_threads;
+    std::vector<std::unique_ptr<IOThread>> _retired;    // 缩容移除的线程, 已经退出, 只负责转交迟到的任务
+    std::mutex _thr_mtx;                            // 保护_work_threads, 分发连接/扩缩容/重平衡互斥
     std::atomic<size_t> _next_idx;
     int _thread_num;
+    bool add_udp_socket(IOThread* thr);
+    int _udp_port;                                  // 0表示没有UDP监听
+    int _udp_batch;
+    bool _udp_gro;
+    bool _udp_gso;
+    std::unique_ptr<ShardRouter> _shard_router;     // 开启分片后才创建, 生命周期覆盖所有IO线程
+    RelayConfig _relay_cfg;                         // _backend_port为0表示没有开启中继
+    std::thread _rebalance_thread;
+    std::mutex _rebalance_ctl;                      // 串行化重平衡线程的启动和停止
+    std::mutex _rebalance_mtx;
+    std::condition_variable _rebalance_cv;
+    bool _rebalance_stop;
+    std::atomic<bool> _rebalance_running;
+    int _cfg_listener;                              // 配置重载回调的id
 };
 
-#endif
\ No newline at end of file
+#endif
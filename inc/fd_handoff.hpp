@@ -0,0 +1,31 @@
+#ifndef __FD_HANDOFF_H__
+#define __FD_HANDOFF_H__
+
+#include <string>
+#include <vector>
+#include "codec.hpp"
+
+// 热升级时新旧进程之间交接监听socket:
+//   旧进程在Unix socket上等待, 新进程启动时连上来, 旧进程用SCM_RIGHTS把所有监听fd发过去,
+//   新进程把fd加入自己的epoll、其余启动步骤都成功后回一个确认字节, 旧进程收到确认才停止accept并开始排空Session.
+//   新进程没有确认(例如启动失败退出)时旧进程继续服务, 监听socket从头到尾没有关闭过, 不会拒绝连接
+struct ListenerInfo {
+    int _fd;
+    int _port;
+    CodecType _codec;
+};
+
+// 在path上监听交接请求(会先删除残留的socket文件), 返回非阻塞的监听fd, 失败返回-1
+int HandoffListen(const std::string& path);
+
+// 旧进程: 把listeners发给新进程conn, 等待确认最多timeout_ms毫秒, 确认后返回true
+bool HandoffSend(int conn, const std::vector<ListenerInfo>& listeners, int timeout_ms);
+
+// 新进程: 连接path上的旧进程并接收监听socket, 成功时out_conn返回交接连接, 启动完成后交给HandoffAck;
+// 没有旧进程或交接失败返回false, 不修改out_conn
+bool HandoffRecv(const std::string& path, std::vector<ListenerInfo>& listeners, int& out_conn);
+
+// 新进程: 回复确认并关闭交接连接, 之后旧进程关闭监听socket; 启动失败时不要调用, 进程退出即关闭连接
+bool HandoffAck(int conn);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef __FLIGHT_RECORDER_H__
+#define __FLIGHT_RECORDER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// 飞行记录器: 每个线程一个固定大小的环形缓冲, 只有本线程写入, 写满后覆盖最旧的记录
+// 打开EVENT_SERVER_TRACE编译选项后TRACE_EVENT才会记录, 关闭时宏展开为空, 没有任何开销
+// 导出为Chrome trace JSON, 可以直接拖进chrome://tracing或ui.perfetto.dev查看
+
+enum class TraceEvent : uint8_t {
+    PollBegin = 0,      // 进入epoll_wait
+    PollEnd,            // epoll_wait返回, arg为就绪事件数
+    LoopBegin,          // 一轮事件处理开始
+    LoopEnd,            // 一轮事件处理结束(包括定时器和UDP发送)
+    TaskBegin,          // 开始处理跨线程任务队列
+    TaskEnd,            // 任务队列处理完, arg为任务数
+    FrameDecoded,       // 收到完整的一帧, arg为消息类型
+    HandlerBegin,       // 处理函数开始, arg为消息类型
+    HandlerEnd,         // 处理函数结束
+    WriteFlushed,       // 发送队列写空, arg为本次写入字节数
+    WriteEagain,        // 写到EAGAIN, 剩余数据等待EPOLLOUT
+    Count,
+};
+
+class FlightRecorder {
+public:
+    // 每个线程的环形缓冲容量, 必须是2的幂
+    static const size_t kCapacity = 1 << 16;
+
+    // 当前线程的记录器, 第一次调用时创建并注册, 线程退出后仍保留供导出
+    static FlightRecorder* local() {
+        FlightRecorder* rec = t_local;
+        return rec ? rec : create_local();
+    }
+    // 取时间戳, x86上用rdtsc, 其他平台退化为steady_clock纳秒
+    static uint64_t now_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // 写入一条记录, 只在本线程调用; 两个字宽的原子写, 导出线程读到的是完整的记录
+    void record(TraceEvent ev, int fd, uint32_t arg) {
+        uint64_t idx = _head.load(std::memory_order_relaxed);
+        Slot& slot = _slots[idx & (kCapacity - 1)];
+        slot._ticks.store(now_ticks(), std::memory_order_relaxed);
+        slot._info.store(pack(ev, fd, arg), std::memory_order_relaxed);
+        _head.store(idx + 1, std::memory_order_release);
+    }
+
+    // 导出所有线程的记录为Chrome trace JSON
+    static std::string DumpChromeTrace();
+    // 写入文件, 成功返回true
+    static bool DumpChromeTraceToFile(const std::string& path);
+
+private:
+    explicit FlightRecorder(int tid) : _head(0), _tid(tid), _slots(new Slot[kCapacity]) {}
+
+    struct Slot {
+        std::atomic<uint64_t> _ticks{0};
+        std::atomic<uint64_t> _info{0};     // 高8位事件, 中间24位fd, 低32位参数
+    };
+
+    static uint64_t pack(TraceEvent ev, int fd, uint32_t arg) {
+        return ((uint64_t)ev << 56) | ((uint64_t)(fd & 0xFFFFFF) << 32) | arg;
+    }
+    static FlightRecorder* create_local();
+    void dump(std::string& out, double ns_per_tick, uint64_t base_ticks, int pid, bool& first) const;
+
+    std::atomic<uint64_t> _head;            // 已写入的记录总数
+    int _tid;
+    std::unique_ptr<Slot[]> _slots;
+
+    static inline thread_local FlightRecorder* t_local = nullptr;
+    static std::mutex _registry_mtx;
+    static std::vector<std::unique_ptr<FlightRecorder>> _registry;
+};
+
+#ifdef EVENT_SERVER_TRACE
+#define TRACE_EVENT(ev, fd, arg) FlightRecorder::local()->record((ev), (fd), (uint32_t)(arg))
+#else
+#define TRACE_EVENT(ev, fd, arg) ((void)0)
+#endif
+
+#endif
@@ -5,6 +5,26 @@
 #define HEAD_LEN 4
 #define HEAD_ID_LEN 2
 #define HEAD_LEN_LEN 2
+// 二进制头部长度字段的高两位是标志位, 普通帧的包体不超过BUFF_SIZE, 旧客户端不会置位
+// HEAD_REQ_ID_FLAG: 头部后面跟4字节请求id(网络字节序), 包体长度取低14位; 连接上第一次出现后,
+// 之后两个方向的每一帧都必须带请求id, 回复带上对应请求的id, 服务器主动推送的帧id为0; 只用于TCP
+#define HEAD_REQ_ID_FLAG 0x8000
+// HEAD_COMPRESS_FLAG: 包体是压缩过的, 只在协商了FEATURE_COMPRESS的连接上出现, 格式见compress.hpp;
+// 协商之后两个方向的包体长度都取低14位
+#define HEAD_COMPRESS_FLAG 0x4000
+#define HEAD_FLAG_MASK 0xC000
+#define HEAD_REQ_ID_LEN 4
+#define HEAD_EXT_MAX_BODY 0x3FFF
+
+// 文本协议的消息类型, 用于分发到处理函数
+#define LINE_MSG_TYPE 0xFF01
+#define HTTP_MSG_TYPE 0xFF02
+// 二进制TCP连接的特性协商帧, 由IO线程直接回复, 不交给处理函数
+#define FEATURE_MSG_TYPE 0xFF03
+#define FEATURE_COMPRESS 0x01
+// 文本协议每次read的大小以及单帧最大缓存
+#define CODEC_READ_SIZE 16384
+#define CODEC_MAX_FRAME 65536
 
 #define IO_CONTINUE 2
 #define IO_EAGAIN 1
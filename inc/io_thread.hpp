@@ -9,26 +9,52 @@
 #include <atomic>
 #include <unordered_map>
 #include <algorithm>
+#include <vector>
+#include <functional>
+#include <chrono>
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/eventfd.h>
 #include "defer.hpp"
+#include "codec.hpp"
+#include "configmgr.hpp"
+
+class Session;
+class IOThread;
+class SharedFrame;
 
 enum class TaskType {
-    RegisterConn, SendData, Shutdown
+    RegisterConn, SendData, Shutdown,
+    MigrateIn,      // 接收其他线程迁移过来的Session
+    MigrateOut,     // 把本线程的Session迁移到其他线程
+    Functor,        // 在IO线程内执行任意回调
+    Reply           // 完成异步请求, 字段同SendData
 };
 
 class IOTask {
 public:
     IOTask(int fd, TaskType type, std::string data="", int msgtype=0) :
-    _fd(fd), _type(type), _data(data), _msgtype(msgtype) {}
+    _fd(fd), _type(type), _data(data), _msgtype(msgtype), _req_id(0), _req_seq(0), _budget(0), _hops(0), _codec(CodecType::Binary) {}
     ~IOTask() = default;
     TaskType _type;
     int _fd;
     // 下面的字段在发送时才生效
     std::string _data;
     int _msgtype;
+    std::shared_ptr<const SharedFrame> _frame;  // SendData: 非空时发送广播帧, 忽略_data和_msgtype
+    // 下面的字段在Reply时才生效, 见DeferredReq
+    uint32_t _req_id;
+    uint32_t _req_seq;
+    // 下面的字段在迁移时才生效
+    std::shared_ptr<Session> _sess;         // MigrateIn: 迁入的Session; SendData: 发送方Session(可为空)
+    std::vector<IOThread*> _targets;        // MigrateOut: 迁移目标线程, 多个目标时轮流分配
+    uint64_t _budget;                       // MigrateOut: 迁出的负载总量, 0表示全部迁出
+    uint8_t _hops;                          // SendData: 按fd发送时已经转交的次数
+    // 下面的字段在Functor时才生效
+    std::function<void()> _func;
+    // 下面的字段在注册连接时才生效
+    CodecType _codec;
 };
 
 class NoneCopy {
@@ -39,7 +65,38 @@ private:
     NoneCopy& operator=(const NoneCopy&) = delete;
 };
 
-class Session;
+class DataBuf;
+struct DeferredReq;
+class UdpChannel;
+struct RelayConfig;
+struct RelayPair;
+class BackendPool;
+class Shard;
+class ShardRouter;
+class OverloadDetector;
+class ResponseCache;
+class Journal;
+class JournalLane;
+
+// 每轮循环的公平性预算, 0表示不限制; 从[server]读取, IOThread持有一份拷贝, 配置重载后在下一轮刷新
+struct LoopBudget {
+    uint32_t _read_frames;      // 每个连接每轮最多分发的帧数
+    size_t _read_bytes;         // 每个连接每轮最多读取的字节数
+    size_t _tasks;              // 每轮最多处理的队列任务数
+    static const LoopBudget& Inst() { return slot().get(); }
+    // 替换当前配置, 之后不再跟随配置重载, 供基准测试切换策略
+    static void Replace(const LoopBudget& budget) { slot().replace(budget); }
+private:
+    static ConfigDerived<LoopBudget>& slot();
+};
+
+// 定时器, 只在所属IO线程内访问
+struct IOTimer {
+    std::chrono::steady_clock::time_point _deadline;
+    uint64_t _seq;                                  // 相同到期时间按加入顺序触发
+    std::function<void()> _func;
+};
+
 class IOThread : public NoneCopy{
 public:
     IOThread(int index);
@@ -47,29 +104,148 @@ public:
     int set_nonblocking(int fd);
     // catche_new_con：适合批量分发 fd，不触发立即唤醒。
     // enqueue_new_con：适合单个 fd 立即入队并唤醒线程。
-    void enqueue_new_conn(int fd);              // 任务入队并wakeup IOThread线程去处理队列里面的任务
-    void catche_new_conn(int fd);               //线程内部任务入队的接口
+    void enqueue_new_conn(int fd, CodecType codec = CodecType::Binary);   // 任务入队并wakeup IOThread线程去处理队列里面的任务
+    void catche_new_conn(int fd, CodecType codec = CodecType::Binary);    //线程内部任务入队的接口
     void start();
     void wakeup();
     void stop();
     void join();
+    // 缩容时在stop之前调用: 线程退出后再入队的任务转交heir, 不再丢弃
+    void retire(IOThread* heir) { _heir.store(heir, std::memory_order_release); }
     void enqueue_task(std::shared_ptr<IOTask> task);
+    // 按fd发送, 连接已经迁走时按迁移记录转交新的属主; 不能区分fd复用, 优先使用Session::Send
     void enqueue_send_data(int fd, const std::string& msg, int msgtype);
+    void enqueue_send_data(std::shared_ptr<Session> sess, const std::string& msg, int msgtype);
+    void enqueue_send_frame(std::shared_ptr<Session> sess, std::shared_ptr<const SharedFrame> frame);
+    // 在属主线程内完成sess上的异步请求
+    void enqueue_reply(std::shared_ptr<Session> sess, const DeferredReq& req, const std::string& msg, int msgtype);
+    // 供Session::RequestId/Defer调用, 只能在本线程的处理函数内
+    uint32_t current_request_id(const Session* sess) const;
+    DeferredReq defer_request(Session* sess);
+    // 接管一个UDP socket, 在本线程内用recvmmsg/sendmmsg批量收发
+    void add_udp_socket(int fd, int batch, bool gro, bool gso);
+    // 发出攒着的回复后关闭本线程的UDP socket
+    void close_udp_sockets();
+    // 开启中继模式并预建后端连接池, 之后以CodecType::Relay注册的连接都转发给后端
+    void enable_relay(const RelayConfig& cfg);
+    // 本线程成为router中下标为index的分片
+    void enable_shard(ShardRouter* router, size_t index);
+    // 本线程的分片, 没有开启时为nullptr, 只能在本线程内使用
+    Shard* shard() const { return _shard.get(); }
+    // 把本线程上负载最高的Session迁往target, 直到迁出负载达到budget; budget为0时全部迁出
+    void migrate_sessions(const std::vector<IOThread*>& targets, uint64_t budget);
+    // 在IO线程内执行func, 用于跨线程的同步点
+    void run_in_loop(std::function<void()> func);
+    // 定时器接口, 只能在本IO线程内调用; 跨线程使用时配合run_in_loop
+    void run_at(std::chrono::steady_clock::time_point deadline, std::function<void()> func);
+    void run_after(int ms, std::function<void()> func);
+    // 当前线程所属的IOThread, 非IO线程返回nullptr
+    static IOThread* current();
+    // 取出上一个采样周期以来的负载(读写字节数), 同时开始新的衰减周期
+    uint64_t sample_load();
+    size_t session_count() const { return _session_count.load(std::memory_order_relaxed); }
+    // 开启过载保护时, 排队时延持续超过目标或积压超过上限; 可以在任意线程读取
+    bool overloaded() const;
+    int index() const { return _index; }
     void loop();
 private:
     bool deal_enque_tasks();
+    // 事件循环退出后: 关闭UDP socket, 把剩余和之后入队的任务转交继承线程
+    void after_stop();
+    // 发出未发的UDP数据后关闭所有UDP socket, 断开UDP会话与通道和本线程的关系
+    void drop_udp_channels();
+    void forward_task(std::shared_ptr<IOTask> task);
+    void deal_send_task(std::shared_ptr<IOTask> task);
+    // 在属主线程内直接发送, 返回IO_SUCCESS/IO_EAGAIN/IO_ERROR, 出错时已关闭连接
+    int send_now(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> data_buf);
+    // 一帧数据接收完毕后的分发入口
+    void dispatch_frame(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> frame);
+    // 给过载检测喂一个时延样本, 返回是否过载; loop_end表示本轮已经处理完
+    bool sample_overload(bool loop_end);
+    // 交给处理函数, 可缓存的消息先查缓存
+    void handle_frame(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame);
+    // 协程会话交给协程, 其他会话交给handle_frame
+    void deliver_frame(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame);
+    // 丢弃过载时要丢的帧, 按请求顺序回busy
+    void shed_frame(std::shared_ptr<Session>& sess, const std::shared_ptr<DataBuf>& frame);
+    // 需要落盘的帧追加到日志后排队, 连接上已有帧在等待时后面的帧也排队; shed的帧不落盘, 轮到时回busy
+    void journal_frame(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame, bool shed);
+    // 把已经落盘的帧按顺序交给处理函数
+    void drain_journal();
+    // 可缓存的消息: 命中时直接发出缓存的回复帧, 未命中时记下处理函数同步发出的回复
+    void dispatch_cached(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame);
+    // 回复特性协商帧, 之后的帧按协商结果编码
+    void negotiate(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame);
+    // 过载时丢弃消息, 配置了busy_type时回一帧busy
+    void reply_busy(std::shared_ptr<Session>& sess);
+    // 处理函数前后记录当前请求; 按序完成的连接上有未完成的请求时, 为当前请求分配一个槽
+    void begin_request(std::shared_ptr<Session>& sess, const std::shared_ptr<DataBuf>& frame);
+    void end_request(std::shared_ptr<Session>& sess);
+    // 发出回复, 按序完成的连接上排在未完成请求后面的回复先留在当前请求的槽里
+    void send_reply(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> buf);
+    // 直接发出, UDP会话进入发送批次
+    void transmit(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> buf);
+    void finish_deferred(std::shared_ptr<Session>& sess, uint32_t req_id, uint32_t seq, int msgtype,
+                         const std::string& msg);
+    // 序号为seq的请求已完成, 发出排在它后面已经可以发出的回复
+    void complete_slot(std::shared_ptr<Session>& sess, uint32_t seq);
+    // 未完成的请求数达到server.max_inflight
+    bool inflight_full(const std::shared_ptr<Session>& sess) const;
+    static bool ordered_replies(const Session* sess);
+    static uint32_t inflight_count(const Session* sess);
+    int next_timeout_ms();
+    void process_timers();
+    void migrate_out(const std::vector<IOThread*>& targets, uint64_t budget);
+    void migrate_in(std::shared_ptr<Session> sess);
+    void decay_session_load();
+    void account_load(std::shared_ptr<Session>& sess, size_t bytes);
+    // resume为true表示从就绪列表恢复, 先解析_in_buf里剩下的帧
+    int read_session(std::shared_ptr<Session> sess, bool resume = false);
+    bool read_budget_spent() const {
+        return (_budget._read_frames && _pass_frames >= _budget._read_frames) ||
+               (_budget._read_bytes && _pass_bytes >= _budget._read_bytes);
+    }
+    // 用完预算还有数据的连接进入就绪列表, 下一轮处理完其他事件后继续读
+    void defer_read(std::shared_ptr<Session>& sess);
+    void serve_ready(size_t count);
+    // 超出任务预算的任务放回队列头部
+    void requeue_tasks(std::queue<std::shared_ptr<IOTask>>& rest, int64_t since_ns);
     bool add_fd(int fd, int events);
     bool mod_fd(int fd, int events);
     bool del_fd(int fd);
     void clear_fd(int fd);
     int read_head_data(std::shared_ptr<Session> sess);
     int read_body_data(std::shared_ptr<Session> sess);
+    int read_codec_data(std::shared_ptr<Session> sess);
+    // 解析Session的_in_buf中缓存的数据
+    int decode_codec_data(std::shared_ptr<Session>& sess);
+    // 从buf中逐帧解析并分发, used返回消耗的字节数
+    int decode_frames(std::shared_ptr<Session>& sess, const char* buf, size_t len, size_t& used);
+    // 限速暂停/恢复读取; pause_ns为0时不设定时器, 由调用方恢复
+    void pause_read(std::shared_ptr<Session>& sess, int64_t pause_ns);
+    void resume_read(std::shared_ptr<Session> sess);
+    // 连接当前应关注的事件, 读暂停时不关注EPOLLIN
+    uint32_t session_events(const std::shared_ptr<Session>& sess, bool want_write);
+    // 接收并分发一个UDP通道上的数据报; EPOLLERR只清除并记录错误, 通道继续使用
+    void handle_udp(UdpChannel* chan, uint32_t evs);
+    void dispatch_udp(UdpChannel* chan, int idx, const char* data, size_t len);
+    void queue_udp(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> buf);
     void handle_epollout(std::shared_ptr<Session> sess);
+    void add_relay(int client_fd);
+    void adopt_relay(std::shared_ptr<RelayPair> pair);
+    void handle_relay(std::shared_ptr<RelayPair> pair, int fd, uint32_t evs);
+    void update_relay_events(RelayPair& pair);
+    void close_relay(std::shared_ptr<RelayPair>& pair);
+    void update_session_count();
 
     int _event_fd;                                                  // event fd 用于唤醒线程
     int _epoll_fd;                                                  // epoll fd
     std::mutex _task_mtx;                                           // 保护任务队列锁
     std::queue<std::shared_ptr<IOTask>> _tasks;                     // 任务队列
+    bool _exited;                                                   // 事件循环已退出, 由_task_mtx保护
+    std::atomic<IOThread*> _heir;                                   // 退出后接收任务的线程, 为空时丢弃
+    std::atomic<size_t> _dropped_tasks;                             // 退出后丢弃的任务数
+    std::unordered_map<int, IOThread*> _moved_to;                   // 迁出连接的fd --> 目标线程, 供按fd发送转交
     struct epoll_event* _event_addr;                                // epoll等待数组
     int _event_count;                                               // epoll最大事件数
     std::thread _thread;                                            // std::thread对象
@@ -77,6 +253,48 @@ private:
     int _index;                                                     // IOThread索引
     std::unordered_map<int, std::shared_ptr<Session>> _sessions;    // fd --> session 映射
     bool _expanded_once;                                            // 是否扩展过epoll_event数组
+    std::atomic<uint64_t> _load;                                    // 当前采样周期内的读写字节数
+    std::atomic<uint32_t> _load_epoch;                              // 负载采样周期, 由EventLoop推进
+    uint32_t _seen_epoch;                                           // 本线程已经衰减到的周期
+    std::atomic<size_t> _session_count;                             // Session数量, 供其他线程读取
+    std::unordered_map<int, std::unique_ptr<UdpChannel>> _udp_channels;    // UDP socket fd --> channel
+    std::shared_ptr<Session> _udp_sess;                             // 复用的UDP会话, 处理函数持有时重新分配
+    std::vector<char> _read_buf;                                    // 文本协议的读缓冲, 本线程所有Session共用
+    std::unordered_map<int, std::shared_ptr<RelayPair>> _relays;    // 客户端fd和后端fd --> 中继连接对
+    std::unique_ptr<BackendPool> _backend_pool;                     // 开启中继模式后才创建
+    bool _relay_copy;                                               // 中继用read/write拷贝代替splice
+    std::unique_ptr<Shard> _shard;                                  // 开启分片状态后才创建
+    std::unique_ptr<OverloadDetector> _overload;                    // 开启过载保护时在构造时创建, 之后不再变化
+    std::unique_ptr<ResponseCache> _cache;                          // 配置了可缓存的消息类型时在构造时创建
+    Session* _capture_sess;                                         // 正在记录回复的Session, 只在分发期间非空
+    std::string _capture;                                           // 记下的编码后回复帧
+    int _capture_type;                                              // 第一帧回复的消息类型, -1表示还没有回复
+    Session* _cur_sess;                                             // 正在处理函数内的连接, 其他时候为空
+    uint32_t _cur_id;                                               // 当前请求的id
+    uint32_t _cur_seq;                                              // 当前请求在按序完成的槽里的序号
+    bool _cur_tracked;                                              // 当前请求占了一个槽
+    bool _cur_deferred;                                             // 当前请求已转为异步完成
+    std::shared_ptr<Journal> _journal;                              // 配置了落盘的消息类型时在构造时打开
+    std::shared_ptr<JournalLane> _journal_lane;                     // 本线程到日志写线程的通道
+    std::vector<std::shared_ptr<Session>> _journal_waiting;         // 有帧等待落盘的连接
+    int64_t _woke_ns;                                               // 本轮epoll_wait返回的时间
+    int64_t _task_since_ns;                                         // 任务队列由空变为非空的时间, _task_mtx保护
+    int64_t _task_delay_ns;                                         // 本轮取出的任务在队列中等待的时间
+    size_t _task_depth;                                             // 本轮取出的任务数
+    size_t _send_bytes;                                             // 本线程所有发送队列积压的字节数
+    LoopBudget _budget;
+    uint64_t _cfg_version;                                          // _budget对应的配置版本
+    uint32_t _pass_frames;                                          // 当前连接本轮已分发的帧数
+    size_t _pass_bytes;                                             // 当前连接本轮已读取的字节数
+    std::vector<std::shared_ptr<Session>> _ready;                   // 用完读预算还有数据的连接, 按进入顺序恢复
+    std::vector<IOTimer> _timers;                                   // 定时器最小堆
+    uint64_t _timer_seq;                                            // 定时器序号
+#ifdef EVENT_SERVER_COROUTINE
+    friend class SendAwaiter;
+    friend class CoTask;
+    void spawn_coroutine(std::shared_ptr<Session>& sess);
+    void finish_coroutine(std::shared_ptr<Session>& sess);
+#endif
 };
 
 #endif
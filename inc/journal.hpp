@@ -0,0 +1,132 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "shard.hpp"
+
+// [journal] 配置, 首次使用时从ConfigMgr读取
+//   msg_types = 4001,4002      落盘后才交给处理函数的消息类型, 为空时不开启
+//   dir = journal              段文件目录, 文件名journal-000001.log递增, 启动时总是新开一个段
+//   segment_mb = 64            单个段文件的上限, 写满后切换到下一个段
+//   batch_kb = 1024            写线程一次write+fdatasync最多合并的字节数
+// 这些类型的帧先追加到本线程的日志缓冲, 写线程落盘后才分发给处理函数, 处理函数的回复就是确认;
+// 同一连接上排在后面的帧(不论类型)也一起等待, 回复顺序不变
+class JournalConfig {
+public:
+    JournalConfig();
+    JournalConfig(std::unordered_set<uint16_t> types, const std::string& dir);
+
+    bool enabled() const { return !_types.empty(); }
+    bool journaled(uint16_t msg_type) const { return !_types.empty() && _types.count(msg_type) > 0; }
+    const std::string& dir() const { return _dir; }
+    size_t segment_bytes() const { return _segment_bytes; }
+    size_t batch_bytes() const { return _batch_bytes; }
+
+    static const JournalConfig& Inst() { return slot(); }
+    // 替换当前配置, 只影响之后创建的IOThread, 供基准测试切换策略
+    static void Replace(const JournalConfig& cfg) { slot() = cfg; }
+
+private:
+    static JournalConfig& slot();
+    std::unordered_set<uint16_t> _types;
+    std::string _dir;
+    size_t _segment_bytes;
+    size_t _batch_bytes;
+};
+
+// 一个IO线程一轮循环追加的记录, 写线程落盘后置位_durable; 同一批的帧共用一个
+struct JournalChunk {
+    std::string _data;
+    uint32_t _records = 0;
+    std::atomic<bool> _durable{false};
+};
+
+class Journal;
+class IOThread;
+
+// 一个IO线程到写线程的通道, append/flush只能在所属IO线程调用
+class JournalLane {
+public:
+    JournalLane(Journal* journal, IOThread* owner);
+    // 追加一条记录, 返回它所在的批次
+    const std::shared_ptr<JournalChunk>& append(uint16_t type, const char* body, size_t len);
+    // 把本轮的批次交给写线程, 环满时暂存, 下次按顺序重试
+    void flush();
+    // IO线程退出前调用, 剩下的批次转交写线程, 之后写线程不再唤醒owner
+    void close();
+private:
+    friend class Journal;
+    static const size_t kRingCapacity = 256;
+    // 攒够这么多字节提前交出, 不等轮末
+    static const size_t kChunkBytes = 64 * 1024;
+    Journal* _journal;
+    IOThread* _owner;                                   // 关闭后为nullptr, Journal::_mtx保护
+    SpscRing<std::shared_ptr<JournalChunk>> _ring;
+    std::shared_ptr<JournalChunk> _chunk;               // 本轮正在追加的批次
+    std::deque<std::shared_ptr<JournalChunk>> _overflow;
+    std::deque<std::shared_ptr<JournalChunk>> _orphans; // 关闭时没能进环的批次, Journal::_mtx保护
+    bool _closed;                                       // Journal::_mtx保护
+};
+
+// 所有IO线程共用一个写线程: 收集各通道的批次, 一次writev追加到当前段, 一次fdatasync覆盖整批(组提交),
+// 然后置位各批次并唤醒等待的IO线程
+class Journal {
+public:
+    // 按当前配置打开, 已经打开时返回同一个; 最后一个持有者释放时落盘剩余记录并关闭
+    static std::shared_ptr<Journal> Open();
+    explicit Journal(const JournalConfig& cfg);
+    ~Journal();
+    std::shared_ptr<JournalLane> open_lane(IOThread* owner);
+    // 有新批次时叫醒写线程
+    void notify();
+
+    // 记录格式: [u32 长度][u32 CRC32][u16 消息类型][包体], 整数按网络字节序, 长度和CRC覆盖类型+包体
+    static const size_t kRecordHead = 8;
+    static void EncodeRecord(std::string& out, uint16_t type, const char* body, size_t len);
+    // 按段的顺序逐条读出dir下的记录, cb返回false时停止; 段尾不完整或校验失败的记录视为崩溃时的残缺写入,
+    // 跳过该段剩余部分. 返回读出的记录数
+    static size_t Replay(const std::string& dir, const std::function<bool(uint16_t, const std::string&)>& cb);
+    // dir下已有的段文件, 按序号排列
+    static std::vector<std::string> ListSegments(const std::string& dir);
+
+private:
+    friend class JournalLane;
+    void writer_loop();
+    bool collect(std::vector<std::shared_ptr<JournalChunk>>& batch,
+                 std::vector<std::shared_ptr<JournalLane>>& touched);
+    void write_batch(const std::vector<std::shared_ptr<JournalChunk>>& batch);
+    void open_segment();
+
+    JournalConfig _cfg;
+    int _fd;
+    uint32_t _segment_seq;
+    size_t _segment_size;
+    std::mutex _mtx;                                    // 保护_lanes和各通道的关闭状态
+    std::condition_variable _cv;
+    std::atomic<bool> _sleeping;
+    bool _stop;
+    std::vector<std::shared_ptr<JournalLane>> _lanes;
+    std::thread _writer;
+};
+
+struct JournalStats {
+    std::atomic<uint64_t> _records{0};      // 已落盘的记录数
+    std::atomic<uint64_t> _syncs{0};        // fdatasync次数, 记录数/该值即平均每次组提交的记录数
+    std::atomic<uint64_t> _bytes{0};
+    static JournalStats& Inst() {
+        static JournalStats stats;
+        return stats;
+    }
+};
+
+#endif
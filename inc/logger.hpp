@@ -0,0 +1,188 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+// 异步日志: 每个线程一个单生产者单消费者的字节环, 调用方只把格式串指针和参数的二进制值拷进环里,
+// 格式化和write由后台刷新线程完成, IO线程上不会有锁和阻塞的系统调用. 环写满时丢弃并计数.
+// 级别在编译期(EVENT_SERVER_LOG_LEVEL, 低于它的调用展开为空)和运行期(Logger::SetLevel)两级过滤.
+// 格式串必须是字符串字面量, 参数支持整数/浮点/C字符串/std::string, 按printf规则格式化, 长度修饰符可以省略.
+
+enum class LogLevel : uint8_t {
+    Debug = 0,
+    Info,
+    Warn,
+    Error,
+    Off,
+};
+
+#ifndef EVENT_SERVER_LOG_LEVEL
+#define EVENT_SERVER_LOG_LEVEL 0
+#endif
+
+class LogRing;
+
+class Logger {
+public:
+    // 单条记录编码后的最大长度, 超长的字符串参数会被截断
+    static const size_t kMaxRecord = 1024;
+    // 每个调用点在每个线程上每秒最多输出的条数, 超出的只计数, 下一条输出时附带被抑制的条数
+    static const uint32_t kSiteBurst = 20;
+
+    // 输出到文件, 空表示标准输出; 不调用时默认输出到标准输出, 级别为Info
+    static bool Init(const std::string& path, LogLevel level);
+    static void SetLevel(LogLevel level) { s_level.store((int)level, std::memory_order_relaxed); }
+    static LogLevel Level() { return (LogLevel)s_level.load(std::memory_order_relaxed); }
+    static bool Enabled(LogLevel level) { return (int)level >= s_level.load(std::memory_order_relaxed); }
+    // "debug"/"info"/"warn"/"error"/"off", 无法识别时返回def
+    static LogLevel ParseLevel(const std::string& name, LogLevel def);
+    // 刷新线程维护的粗粒度毫秒时钟(单调时钟, 不是墙上时间), 用于调用点限流
+    static uint64_t CoarseMs() { return s_coarse_ms.load(std::memory_order_relaxed); }
+    // 停止刷新线程并写出所有剩余记录, 进程退出时自动调用
+    static void Shutdown();
+    // 因环满丢弃的记录数
+    static uint64_t Dropped();
+
+    template <typename... Args>
+    static void Write(LogLevel level, uint32_t suppressed, const char* fmt, const Args&... args) {
+        char buf[kMaxRecord];
+        size_t off = encode_head(buf, level, suppressed, fmt, sizeof...(Args));
+        (put(buf, off, args), ...);
+        push(buf, off);
+    }
+
+private:
+    // 参数类型标记
+    enum : uint8_t { kInt = 'i', kUint = 'u', kDouble = 'f', kStr = 's' };
+
+    static size_t encode_head(char* buf, LogLevel level, uint32_t suppressed, const char* fmt, size_t nargs);
+    static void push(const char* buf, size_t len);
+
+    static void put_raw(char* buf, size_t& off, uint8_t tag, const void* p, size_t n) {
+        if (off + 1 + n > kMaxRecord) {
+            return;
+        }
+        buf[off++] = (char)tag;
+        memcpy(buf + off, p, n);
+        off += n;
+    }
+    static void put_str(char* buf, size_t& off, const char* s, size_t n) {
+        if (off + 3 > kMaxRecord) {
+            return;
+        }
+        n = std::min(n, kMaxRecord - off - 3);
+        uint16_t len = (uint16_t)n;
+        buf[off++] = (char)kStr;
+        memcpy(buf + off, &len, 2);
+        memcpy(buf + off + 2, s, n);
+        off += 2 + n;
+    }
+    template <typename T>
+    static void put(char* buf, size_t& off, const T& v) {
+        if constexpr (std::is_same_v<T, std::string>) {
+            put_str(buf, off, v.data(), v.size());
+        }
+        else if constexpr (std::is_same_v<std::decay_t<T>, const char*> || std::is_same_v<std::decay_t<T>, char*>) {
+            const char* s = v ? v : "(null)";
+            put_str(buf, off, s, strlen(s));
+        }
+        else if constexpr (std::is_floating_point_v<T>) {
+            double d = v;
+            put_raw(buf, off, kDouble, &d, sizeof(d));
+        }
+        else if constexpr (std::is_enum_v<T>) {
+            int64_t i = (int64_t)v;
+            put_raw(buf, off, kInt, &i, sizeof(i));
+        }
+        else if constexpr (std::is_signed_v<T>) {
+            int64_t i = v;
+            put_raw(buf, off, kInt, &i, sizeof(i));
+        }
+        else if constexpr (std::is_pointer_v<T>) {
+            uint64_t u = (uint64_t)(uintptr_t)v;
+            put_raw(buf, off, kUint, &u, sizeof(u));
+        }
+        else {
+            static_assert(std::is_integral_v<T>, "unsupported log argument type");
+            uint64_t u = v;
+            put_raw(buf, off, kUint, &u, sizeof(u));
+        }
+    }
+
+    friend class LogRing;
+    friend class LogFlusher;
+    static std::atomic<int> s_level;
+    static std::atomic<uint64_t> s_coarse_ms;
+};
+
+// 调用点限流状态, 每个调用点每个线程一份
+struct LogSite {
+    uint64_t _window = 0;       // 当前窗口(秒)
+    uint32_t _count = 0;        // 窗口内已输出条数
+    uint32_t _suppressed = 0;   // 被抑制还没报告的条数
+
+    bool allow() {
+        uint64_t win = Logger::CoarseMs() / 1000;
+        if (win != _window) {
+            _window = win;
+            _count = 0;
+        }
+        if (_count >= Logger::kSiteBurst) {
+            _suppressed++;
+            return false;
+        }
+        _count++;
+        return true;
+    }
+    uint32_t take_suppressed() {
+        uint32_t n = _suppressed;
+        _suppressed = 0;
+        return n;
+    }
+};
+
+#define LOG_AT(level, fmt, ...)                                                                 \
+    do {                                                                                        \
+        if (Logger::Enabled(level)) {                                                           \
+            static thread_local LogSite _log_site;                                              \
+            if (_log_site.allow()) {                                                            \
+                Logger::Write((level), _log_site.take_suppressed(), fmt, ##__VA_ARGS__);        \
+            }                                                                                   \
+        }                                                                                       \
+    } while (0)
+
+// 编译期去掉的级别: 不生成代码, 参数仍然参与类型检查, 调用方不会因此出现未使用变量
+#define LOG_NONE(fmt, ...)                                                                      \
+    do {                                                                                        \
+        if (false) {                                                                            \
+            Logger::Write(LogLevel::Off, 0, fmt, ##__VA_ARGS__);                                \
+        }                                                                                       \
+    } while (0)
+
+#if EVENT_SERVER_LOG_LEVEL <= 0
+#define LOG_DEBUG(fmt, ...) LOG_AT(LogLevel::Debug, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+#if EVENT_SERVER_LOG_LEVEL <= 1
+#define LOG_INFO(fmt, ...) LOG_AT(LogLevel::Info, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+#if EVENT_SERVER_LOG_LEVEL <= 2
+#define LOG_WARN(fmt, ...) LOG_AT(LogLevel::Warn, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+#if EVENT_SERVER_LOG_LEVEL <= 3
+#define LOG_ERROR(fmt, ...) LOG_AT(LogLevel::Error, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+
+#endif
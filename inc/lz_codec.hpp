@@ -0,0 +1,16 @@
+#ifndef __LZ_CODEC_H__
+#define __LZ_CODEC_H__
+
+#include <cstddef>
+#include <sys/types.h>
+
+// LZ4块格式的压缩/解压, 不依赖外部库; 输出与liblz4的LZ4_compress_default/LZ4_decompress_safe互通,
+// 客户端可以直接用liblz4解压. 单线程贪心匹配, 4KB的哈希表放在栈上, 不分配内存
+// 压缩结果超过cap时返回0, cap可以取得比原长小, 用来在压缩不划算时尽早放弃
+size_t lz_compress(const char* src, size_t n, char* dst, size_t cap);
+// 返回解压后的长度; 数据损坏或解压结果超过cap时返回-1
+ssize_t lz_decompress(const char* src, size_t n, char* dst, size_t cap);
+// 最坏情况下压缩结果的长度上限
+inline size_t lz_bound(size_t n) { return n + n / 255 + 16; }
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __MSG_DISPATCHER_H__
+#define __MSG_DISPATCHER_H__
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+class Session;
+
+// 处理函数在Session的属主IO线程内同步调用, 回复通过sess->Send发送
+using MsgHandler = std::function<void(std::shared_ptr<Session> sess, uint16_t msg_type, const std::string& body)>;
+
+// 按消息类型分发, 没有注册处理函数的类型原样回显
+// 处理函数需要在EventLoop启动之前注册, 运行期间只读
+class MsgDispatcher {
+public:
+    void Register(uint16_t msg_type, MsgHandler handler);
+    void Dispatch(std::shared_ptr<Session>& sess, uint16_t msg_type, const std::string& body) const;
+
+    static MsgDispatcher& Inst() {
+        static MsgDispatcher dispatcher;
+        return dispatcher;
+    }
+private:
+    MsgDispatcher() = default;
+    MsgDispatcher(const MsgDispatcher&) = delete;
+    MsgDispatcher& operator=(const MsgDispatcher&) = delete;
+    std::unordered_map<uint16_t, MsgHandler> _handlers;
+};
+
+#endif
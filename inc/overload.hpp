@@ -0,0 +1,82 @@
+#ifndef __OVERLOAD_H__
+#define __OVERLOAD_H__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include "codec.hpp"
+#include "configmgr.hpp"
+
+// [overload] 配置, 首次使用时从ConfigMgr读取, 重载后随之更新; enabled只在启动时生效
+//   enabled = true
+//   target_ms = 5              排队时延目标; 一个观察窗口内的最小时延都超过它才算过载, 短暂的突发不算
+//   interval_ms = 100          观察窗口; 持续过载时按interval/sqrt(n)缩短(CoDel控制律), 退出时恢复
+//   max_tasks = 10000          任务队列深度上限, 超过立即算过载
+//   max_send_mb = 64           本线程发送队列积压上限(MB), 超过立即算过载
+//   accept_defer_ms = 1000     所有线程都过载时暂停accept, 连接留在backlog; 超过该时间仍过载则逐个拒绝, 0表示立即拒绝
+//   busy_type = 0              非0时拒绝连接和丢弃消息都回一帧"busy"(HTTP端口回503), 0表示直接关闭/丢弃
+//   shed_types = 2001,2002     过载时在分发前直接丢弃的低优先级消息类型
+class OverloadConfig {
+public:
+    OverloadConfig();
+    OverloadConfig(bool enabled, int target_ms, int interval_ms, std::unordered_set<uint16_t> shed_types,
+                   uint16_t busy_type = 0);
+
+    bool enabled() const { return _enabled; }
+    int64_t target_ns() const { return _target_ns; }
+    int64_t interval_ns() const { return _interval_ns; }
+    size_t max_tasks() const { return _max_tasks; }
+    size_t max_send_bytes() const { return _max_send_bytes; }
+    int accept_defer_ms() const { return _accept_defer_ms; }
+    uint16_t busy_type() const { return _busy_type; }
+    bool shed(uint16_t msg_type) const { return !_shed_types.empty() && _shed_types.count(msg_type) > 0; }
+
+    static const OverloadConfig& Inst() { return slot().get(); }
+    // 替换当前配置, 只能在创建EventLoop之前调用, 之后不再跟随配置重载, 供基准测试切换策略
+    static void Replace(const OverloadConfig& cfg) { slot().replace(cfg); }
+
+private:
+    static ConfigDerived<OverloadConfig>& slot();
+    bool _enabled;
+    int64_t _target_ns;
+    int64_t _interval_ns;
+    size_t _max_tasks;
+    size_t _max_send_bytes;
+    int _accept_defer_ms;
+    uint16_t _busy_type;
+    std::unordered_set<uint16_t> _shed_types;
+};
+
+// 每个IO线程一个, 由本线程喂入时延样本, 其他线程只读取过载标志
+// 时延取本轮事件等待处理的时间(从epoll_wait返回算起)和任务在队列中的等待时间中的较大者;
+// 轮末的样本是完整的一轮, 计入窗口最小值; 轮中的样本只是下界, 只在整个窗口都没有完整的一轮时使用
+class OverloadDetector {
+public:
+    explicit OverloadDetector(int index) : _index(index) {}
+    void sample(int64_t now_ns, int64_t delay_ns, bool loop_end, size_t tasks, size_t send_bytes);
+    bool overloaded() const { return _overloaded.load(std::memory_order_relaxed); }
+private:
+    int _index;
+    int64_t _window_end = 0;
+    int64_t _window_min = INT64_MAX;    // 本窗口内的最小时延
+    uint32_t _count = 0;                // 连续过载的窗口数
+    bool _delayed = false;              // 上一个窗口的最小时延超过目标
+    std::atomic<bool> _overloaded{false};
+};
+
+// 拒绝时回给客户端的帧, 按监听端口的帧格式编码; 没有配置busy_type或中继端口时为空
+std::string EncodeBusyFrame(CodecType codec);
+
+// 各处理动作的次数
+struct OverloadStats {
+    std::atomic<uint64_t> _deferred{0};     // 暂停accept的次数
+    std::atomic<uint64_t> _rejected{0};     // 拒绝的连接数
+    std::atomic<uint64_t> _shed{0};         // 丢弃的消息数
+    static OverloadStats& Inst() {
+        static OverloadStats stats;
+        return stats;
+    }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __RATE_LIMITER_H__
+#define __RATE_LIMITER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 超限后的处理策略, 数值越大越严格, 多条规则同时超限时取最严格的
+enum class LimitPolicy {
+    None = 0,
+    Pause,          // 放行当前帧, 摘除EPOLLIN直到令牌恢复, 剩余数据留在内核缓冲区形成背压
+    Drop,           // 丢弃当前帧
+    Disconnect,     // 断开连接
+};
+
+struct RateRule {
+    double _rate;           // 每秒帧数, 0表示不限制
+    double _burst;          // 桶容量
+    LimitPolicy _policy;
+};
+
+// 令牌桶, 只在Session的属主线程内访问, 不需要加锁
+class TokenBucket {
+public:
+    TokenBucket() : _tokens(0), _last_ns(0) {}
+    // 取一个令牌, 超限返回false; allow_debt为true时超限也扣除, 令牌变为负数
+    bool consume(const RateRule& rule, int64_t now_ns, bool allow_debt);
+    // 令牌恢复到至少一个还需要的时间
+    int64_t wait_ns(const RateRule& rule) const;
+private:
+    double _tokens;
+    int64_t _last_ns;
+};
+
+// [ratelimit] 配置, 首次使用时从ConfigMgr读取, 之后只读
+//   session = 1000,2000,pause         每个连接: 速率,桶容量,策略
+//   msg_types = 1001,1002             需要单独限速的消息类型
+//   msg_1001 = 100,200,drop
+class RateLimitConfig {
+public:
+    bool enabled() const { return _session._rate > 0 || !_types.empty(); }
+    const RateRule& session_rule() const { return _session; }
+    const RateRule* type_rule(uint16_t msg_type) const;
+    static const RateLimitConfig& Inst();
+private:
+    RateLimitConfig();
+    RateRule _session;
+    std::unordered_map<uint16_t, RateRule> _types;
+};
+
+// 每个连接的限速状态, 配置了限速时才分配
+class SessionLimiter {
+public:
+    // 返回需要执行的策略; 返回Pause时pause_ns为恢复读取前需要等待的时间
+    LimitPolicy check(uint16_t msg_type, int64_t now_ns, int64_t& pause_ns);
+private:
+    void apply(const RateRule& rule, TokenBucket& bucket, int64_t now_ns, LimitPolicy& result, int64_t& pause_ns);
+    TokenBucket _session_bucket;
+    std::vector<std::pair<uint16_t, TokenBucket>> _type_buckets;
+};
+
+// 各策略触发次数
+struct RateLimitStats {
+    std::atomic<uint64_t> _paused{0};
+    std::atomic<uint64_t> _dropped{0};
+    std::atomic<uint64_t> _disconnected{0};
+    static RateLimitStats& Inst() {
+        static RateLimitStats stats;
+        return stats;
+    }
+};
+
+#endif
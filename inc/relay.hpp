@@ -0,0 +1,62 @@
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+
+// 四层中继: relay端口接入的连接与一条后端连接配对, 两个方向各用一个pipe,
+// 数据通过splice在内核中从socket搬到pipe再搬到另一个socket, 不进入用户态.
+// _copy为true时改用read/write经用户态缓冲拷贝, 用于对比.
+struct RelayConfig {
+    std::string _backend_host;
+    int _backend_port = 0;
+    int _pool_size = 0;         // 每个IO线程预先建立的空闲后端连接数, 只用来省掉握手, 不复用
+    bool _copy = false;
+};
+
+// 一个方向: 源socket --> pipe(或用户态缓冲) --> 目的socket
+struct RelayPipe {
+    int _rd = -1;
+    int _wr = -1;
+    size_t _pending = 0;        // 已读入但还没写到目的socket的字节数
+    std::string _buf;           // 拷贝模式下没写完的数据
+    bool _eof = false;          // 源socket已读到EOF
+};
+
+// 一对中继连接, 只在所属IOThread内访问
+struct RelayPair {
+    int _client = -1;
+    int _backend = -1;
+    uint32_t _client_events = 0;    // 当前注册在epoll中的事件, 没变化时不调用epoll_ctl
+    uint32_t _backend_events = 0;
+    bool _backend_shut = false;     // 客户端发完后已经对后端shutdown(SHUT_WR)
+    RelayPipe _c2b;
+    RelayPipe _b2c;
+};
+
+// 把src中可读的数据搬到dst. 返回IO_SUCCESS表示src暂时读空或已EOF, IO_EAGAIN表示dst写满,
+// IO_CONTINUE表示本轮搬运量已达上限, IO_ERROR表示出错
+int RelayPump(int src, int dst, RelayPipe& p, bool copy, std::vector<char>& scratch);
+
+// 每个IO线程一个后端连接池, 只存放预先建好、从未用过的连接; 用过的连接随中继连接对一起关闭,
+// 否则前一个客户端迟到的回包会发给下一个客户端. 空闲连接不在epoll中, 取出时检查是否已被后端关闭
+class BackendPool {
+public:
+    explicit BackendPool(const RelayConfig& cfg);
+    ~BackendPool();
+    bool valid() const { return _valid; }
+    // 取一条连接(可能还在非阻塞connect中), 失败返回-1
+    int acquire();
+    // 补足空闲连接
+    void refill();
+    size_t idle() const { return _idle.size(); }
+private:
+    int connect_backend();
+    struct sockaddr_in _addr;
+    size_t _size;
+    bool _valid;
+    std::vector<int> _idle;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __RESPONSE_CACHE_H__
+#define __RESPONSE_CACHE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "codec.hpp"
+
+// [cache] 配置, 首次使用时从ConfigMgr读取
+//   msg_types = 3001,3002      可缓存的消息类型: 只读查询, 同样的请求包体总是得到同样的回复
+//   max_mb = 16                每个IO线程缓存的内存上限, 按请求包体+编码后的回复+固定开销计
+// 处理函数在分发期间同步发出的回复会被记下; 异步回复(转交其他线程/定时器/协程)不会进入缓存
+class ResponseCacheConfig {
+public:
+    ResponseCacheConfig();
+    ResponseCacheConfig(std::unordered_set<uint16_t> types, size_t max_bytes);
+
+    bool enabled() const { return !_types.empty() && _max_bytes > 0; }
+    bool cacheable(uint16_t msg_type) const { return !_types.empty() && _types.count(msg_type) > 0; }
+    size_t max_bytes() const { return _max_bytes; }
+
+    static const ResponseCacheConfig& Inst() { return slot(); }
+    // 替换当前配置, 只影响之后创建的IOThread, 供基准测试切换策略
+    static void Replace(const ResponseCacheConfig& cfg) { slot() = cfg; }
+
+private:
+    static ResponseCacheConfig& slot();
+    std::unordered_set<uint16_t> _types;
+    size_t _max_bytes;
+};
+
+// 每个IO线程一个, 只在本线程访问; 以消息类型+包体哈希为键, 保存编码好的回复帧, 按CLOCK淘汰.
+// 同样的请求在不同帧格式的端口上回复的字节不同, 帧格式也是键的一部分
+class ResponseCache {
+public:
+    struct Entry {
+        uint16_t _type = 0;
+        uint16_t _resp_type = 0;     // 第一帧回复的消息类型, 决定发送队列的优先级
+        const Codec* _codec = nullptr;
+        bool _ref = false;           // CLOCK访问位
+        bool _live = false;
+        uint64_t _hash = 0;
+        std::string _req;            // 请求包体, 命中时比对, 哈希冲突不会回错数据
+        std::string _resp;           // 编码后的回复帧, 可以直接写socket; 多帧回复首尾相接
+    };
+
+    explicit ResponseCache(size_t max_bytes);
+    const Entry* lookup(const Codec* codec, uint16_t type, const char* body, size_t len);
+    void store(const Codec* codec, uint16_t type, const char* body, size_t len, uint16_t resp_type,
+               std::string&& resp);
+    size_t bytes() const { return _bytes; }
+    size_t size() const { return _index.size(); }
+
+    // 任意线程都可以调用, 各IO线程在下一次查询时生效; 按键失效时所有帧格式的条目一起失效
+    static void Invalidate(uint16_t type);
+    static void Invalidate(uint16_t type, const std::string& body);
+
+private:
+    static uint64_t hash_of(uint16_t type, const char* body, size_t len);
+    // 应用其他线程发布的失效记录
+    void sync_invalidations();
+    Entry* find(const Codec* codec, uint16_t type, const char* body, size_t len, uint64_t hash);
+    void erase_slot(uint32_t idx);
+    void evict_until(size_t need);
+
+    size_t _max_bytes;
+    size_t _bytes;
+    std::vector<Entry> _slots;
+    std::vector<uint32_t> _free;
+    std::unordered_multimap<uint64_t, uint32_t> _index; // 类型+包体的哈希 --> 槽位, 各帧格式的条目哈希相同
+    size_t _hand;                                       // CLOCK指针
+    uint64_t _seen_seq;                                 // 已经应用到的失效序号
+
+    // 全局失效记录, 只保留最近的一段, 落后太多的缓存直接清空
+    struct Invalidation {
+        uint64_t _seq;
+        uint16_t _type;
+        bool _all;                  // 整个类型失效
+        uint64_t _hash;
+    };
+    static const size_t kMaxInvalidations = 1024;
+    static std::mutex _inv_mtx;
+    static std::vector<Invalidation> _invalidations;
+    static std::atomic<uint64_t> _inv_seq;
+};
+
+// 所有线程的命中/未命中/淘汰次数
+struct ResponseCacheStats {
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+    std::atomic<uint64_t> _evictions{0};
+    static ResponseCacheStats& Inst() {
+        static ResponseCacheStats stats;
+        return stats;
+    }
+};
+
+#endif
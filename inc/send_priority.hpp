@@ -0,0 +1,46 @@
+#ifndef __SEND_PRIORITY_H__
+#define __SEND_PRIORITY_H__
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// [priority] 配置, 决定每种消息类型进入发送队列的哪个优先级, 首次使用时从ConfigMgr读取
+//   classes = 3               优先级个数(1-4), 0最高; 1表示所有消息共用一个FIFO
+//   default = 2               没有单独配置的消息类型的优先级, 缺省为最低
+//   msg_types = 1,2           单独配置的消息类型
+//   msg_1 = 0
+//   weights = 8,4,1           非空时按帧数加权轮转, 低优先级也能按比例发送; 为空时严格按优先级
+class SendPriorityConfig {
+public:
+    static const int kMaxClasses = 4;
+
+    SendPriorityConfig();
+    SendPriorityConfig(int classes, uint8_t default_class, std::unordered_map<uint16_t, uint8_t> types,
+                       std::vector<uint32_t> weights);
+
+    int classes() const { return _classes; }
+    bool weighted() const { return !_weights.empty(); }
+    uint32_t weight(int cls) const { return _weights[cls]; }
+    uint8_t class_of(uint16_t msg_type) const {
+        if (_types.empty()) {
+            return _default;
+        }
+        auto iter = _types.find(msg_type);
+        return iter == _types.end() ? _default : iter->second;
+    }
+
+    static const SendPriorityConfig& Inst() { return slot(); }
+    // 替换当前配置, 只能在IO线程开始发送之前调用, 供基准测试切换策略
+    static void Replace(const SendPriorityConfig& cfg) { slot() = cfg; }
+
+private:
+    static SendPriorityConfig& slot();
+    void normalize();
+    int _classes;
+    uint8_t _default;
+    std::unordered_map<uint16_t, uint8_t> _types;
+    std::vector<uint32_t> _weights;
+};
+
+#endif
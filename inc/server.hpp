@@ -11,13 +11,18 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <chrono>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <mutex>
 #include <thread>
 #include <vector>
 #include <atomic>
+#include <unordered_map>
 #include "event_loop.hpp"
+#include "codec.hpp"
+#include "fd_handoff.hpp"
 
 class Server {
 public:
@@ -25,17 +30,61 @@ public:
     ~Server();
     void run();
     void stop();
+    // 异步信号安全, 由run所在线程把飞行记录器导出到server.trace_file
+    void request_trace_dump();
+    // 异步信号安全, 由run所在线程重新加载配置文件
+    void request_reload();
+    // 在run所在线程执行, 用于处理函数里耗时的管理操作(例如导出飞行记录器), 不占用IO线程; 可以在任意线程调用
+    void run_in_accept_thread(std::function<void()> fn);
 private:
-    bool create_and_bind(int port);
+    // 创建监听socket并加入epoll, 失败返回-1
+    int create_and_bind(int port);
+    // 优先使用热升级时旧进程交过来的同端口监听socket, 没有时新建
+    bool add_listener(int port, CodecType codec);
+    bool watch_listener(int listen_fd, int port, CodecType codec);
     int set_nonblocking(int fd);
+    // 新进程连上交接socket, 把监听socket交出去, 确认后停止accept并开始排空
+    void handle_upgrade();
+    void begin_drain();
+    // 排空期间所有Session结束或者超过截止时间返回true
+    bool drain_done();
+    // 接受监听socket上所有等待的连接, 交给EventLoop
+    void accept_all(const ListenerInfo& listener);
+    // 所有IO线程过载时先暂停accept, 超过overload.accept_defer_ms后回busy帧拒绝
+    void defer_or_reject(const ListenerInfo& listener);
+    void reject_all(const ListenerInfo& listener);
+    // 暂停期间每轮检查一次, 不再过载时恢复accept
+    void check_paused_accept();
+    void watch_config();
+    // 读掉inotify事件, 配置文件被写入或替换时返回true
+    bool config_changed();
+    // 重新加载配置, 日志级别和IO线程数立即调整
+    void reload_config();
     int _port;
     int _listen_fd;
+    std::unordered_map<int, ListenerInfo> _listeners;   // 监听fd --> 端口/帧格式
+    std::vector<ListenerInfo> _inherited;               // 旧进程交过来还没有认领的监听socket
+    std::string _upgrade_path;                          // 热升级交接的Unix socket路径, 空表示不开启
+    int _upgrade_fd;
+    bool _draining;
+    std::chrono::steady_clock::time_point _drain_deadline;
+    std::chrono::steady_clock::time_point _start_time;
+    bool _first_accepted;
+    std::atomic<bool> _dump_trace;
     int _epoll_fd;
     int _event_count;
     struct epoll_event* _event_addr;
     std::atomic<bool> _stop;
     int _event_fd;
     std::vector<int> _con_fds;
+    bool _overload_on;                                  // 开启了过载保护
+    bool _accept_paused;                                // 因过载暂停accept, 连接留在backlog
+    std::chrono::steady_clock::time_point _accept_paused_at;
+    std::atomic<bool> _reload;
+    std::mutex _task_mtx;
+    std::vector<std::function<void()>> _tasks;          // run_in_accept_thread提交的任务
+    int _inotify_fd;                                    // 监视配置文件所在目录, -1表示不监视
+    std::string _config_name;                           // 配置文件名, 不含目录
     std::shared_ptr<EventLoop> _loop;
 };
 
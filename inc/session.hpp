@@ -7,38 +7,30 @@
 #include <string>
 #include <iostream>
 #include <memory>
-#include <mutex>
-#include <queue>
+#include <deque>
+#include <vector>
+#include <atomic>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include "global.hpp"
+#include "codec.hpp"
+#include "compress.hpp"
+#include "rate_limiter.hpp"
+#include "send_priority.hpp"
 
 // 接受状态
-enum RecvStage{
+enum RecvStage : uint8_t {
     NO_RECV = 0,  
     HEAD_RECVING,
     BODY_RECVING,
 };
 
 //发送状态
-enum SendStage{
+enum SendStage : uint8_t {
     NO_SEND = 0,
     SENDING = 1
 };
 
-//头部buffer
-class HeadBuf{
-public:
-    HeadBuf(size_t head_len);
-    ~HeadBuf();
-    //缓存接受的头部信息
-    char* _buf;
-    //头部总长度
-    size_t _head_len;
-    //头部已经接受的偏移量
-    size_t _offset;
-};
-
 //数据buffer,用来存储接受或者发送的数据
 class DataBuf{
 public:
@@ -53,30 +45,154 @@ public:
     size_t _data_len;
     //已接受或发送的偏移量
     size_t _offset;
+    // 接收的帧: 扩展头部里的请求id, 没有时为0
+    uint32_t _req_id;
+};
+
+// 发送队列, 只有写到EAGAIN时才分配, 排空后由IOThread释放, 空闲连接只占一个指针
+// 按消息类型分成若干优先级, 每个优先级一个FIFO, 也只在用到时分配; 只在帧边界切换优先级,
+// 写了一部分的帧总是先写完. 优先级个数为1时与单个FIFO相同
+class SendQueue {
+public:
+    bool empty() const { return !_que || _que->_size == 0; }
+    size_t size() const { return _que ? _que->_size : 0; }
+    // 排队帧的总字节数(按整帧计, 写了一部分的帧也算全长)
+    size_t bytes() const { return _que ? _que->_bytes : 0; }
+    // 下一个要写的帧, 队列不能为空
+    std::shared_ptr<DataBuf>& front();
+    void push(std::shared_ptr<DataBuf> data);
+    // 弹出front()返回的帧
+    void pop();
+    // 队列为空时归还deque的内存
+    void release_if_empty() {
+        if (_que && _que->_size == 0) {
+            _que.reset();
+        }
+    }
+private:
+    void select();
+    using FrameQueue = std::deque<std::shared_ptr<DataBuf>>;
+    struct Classes {
+        std::unique_ptr<FrameQueue> _q[SendPriorityConfig::kMaxClasses];
+        uint32_t _credit[SendPriorityConfig::kMaxClasses] = {0};   // 加权轮转时本轮剩余可发的帧数
+        size_t _size = 0;
+        size_t _bytes = 0;
+        uint8_t _cur = 0;                                          // 正在写的帧所在的优先级
+    };
+    std::unique_ptr<Classes> _que;
 };
 
 class IOThread;
-class Session {
+struct UdpPeer;
+struct JournalChunk;
+
+// 等待日志落盘的帧; _chunk为空表示这一帧本身不需要落盘, 只是排在需要落盘的帧后面
+struct JournalWait {
+    std::shared_ptr<DataBuf> _frame;
+    std::shared_ptr<JournalChunk> _chunk;
+    bool _shed = false;     // 过载时决定丢弃, 轮到时只回busy
+};
+// 转为异步完成的请求, 处理函数内sess->Defer()得到, 之后交给sess->Reply
+struct DeferredReq {
+    uint32_t _id = 0;           // 客户端的请求id, 没有扩展头部时为0
+    uint32_t _seq = 0;          // 按序完成的连接上的请求序号
+    bool _ok = false;           // 不在处理函数内调用Defer时为false, Reply退化为Send
+};
+
+// 有异步请求未完成时才分配, 全部完成后释放
+// 带请求id的连接回复立即发出, 只计数; 没有请求id的连接按请求顺序回复: 从最早未完成的请求起每个请求一个槽,
+// 后面请求的回复先留在各自的槽里, 前面的请求都完成后再发出
+struct InflightState {
+    struct Slot {
+        bool _done = false;
+        std::vector<std::shared_ptr<DataBuf>> _held;
+    };
+    uint32_t _deferred = 0;     // 未完成的异步请求数
+    uint32_t _head_seq = 0;     // _slots.front()的序号
+    std::deque<Slot> _slots;
+};
+
+#ifdef EVENT_SERVER_COROUTINE
+#include <coroutine>
+struct CoState;
+class ReadFrameAwaiter;
+class SendAwaiter;
+#endif
+
+class Session : public std::enable_shared_from_this<Session> {
 public:
     friend class IOThread;
-    Session(int fd, IOThread* pthread);
+    Session(int fd, IOThread* pthread, Codec* codec = nullptr);
     ~Session();
     void Send(int msg_type, const std::string& data);
+    // 发送广播帧, 同样格式的连接共用一份编码结果, 见SharedFrame
+    void Send(const std::shared_ptr<const SharedFrame>& frame);
+    // 下面三个用于异步完成请求, 协程会话不支持
+    // 当前请求的id, 只能在处理函数内调用; 客户端没有使用扩展头部时为0
+    uint32_t RequestId() const;
+    // 在处理函数内调用, 当前请求改为稍后由Reply完成, 处理函数返回后连接继续读后面的请求;
+    // 未完成的请求数达到server.max_inflight时暂停读取
+    DeferredReq Defer();
+    // 完成Defer返回的请求, 可以在任意线程调用, 每个请求恰好调用一次
+    void Reply(const DeferredReq& req, int msg_type, const std::string& data);
+#ifdef EVENT_SERVER_COROUTINE
+    // 协程接口, 只能在会话协程内使用: co_await sess->read_frame() / co_await sess->send(...)
+    ReadFrameAwaiter read_frame();
+    SendAwaiter send(int msg_type, const std::string& data);
+#endif
 
 private:
     void enqueue_data(std::shared_ptr<DataBuf> data);
+    // 发送队列为空时直接写socket, 写不完的部分才进入发送队列
     int send_data(std::shared_ptr<DataBuf> data);
+    // 按连接的帧格式编码待发送的数据, 使用扩展头部的连接带上req_id; 包体超出帧格式的长度时返回空
+    std::shared_ptr<DataBuf> make_send_buf(int msg_type, const std::string& data, uint32_t req_id = 0);
+    std::shared_ptr<DataBuf> make_send_buf(const SharedFrame& frame);
     friend class IOThread;
 
 private:
+    // 空闲连接只保留下面这些字段, 大块的缓冲(包体/发送队列/文本协议的残留数据)都按需分配
+    // 小字段集中放在前面, 避免对齐空洞
     int _fd;
-    std::shared_ptr<DataBuf> _data_buf;
-    std::shared_ptr<HeadBuf> _head_buf;
+    // 二进制头部直接内嵌, _head_off为已经收到的字节数; 扩展头部的请求id紧跟在后面
+    char _head[HEAD_LEN + HEAD_REQ_ID_LEN];
+    uint8_t _head_off;
+    // 客户端用过扩展头部, 之后收发的每一帧都带请求id
+    bool _req_ext;
+    // 协商了压缩, 之后长度字段只取低14位
+    bool _compress;
     enum RecvStage _recv_stage;
     enum SendStage _send_stage;
-    std::mutex _send_mtx;
-    std::queue<std::shared_ptr<DataBuf>> _send_que;
-    IOThread* _p_ownerthread;
+    // 限速暂停读取期间不关注EPOLLIN
+    bool _read_paused;
+    // 在IO线程的就绪列表中, 由就绪列表继续读取, 期间忽略EPOLLIN
+    bool _read_deferred;
+    std::shared_ptr<DataBuf> _data_buf;
+    // 非空时按codec解析; _in_buf只缓存一次read后没有凑成整帧的残留数据, 排空后释放
+    Codec* _codec;
+    std::unique_ptr<std::string> _in_buf;
+    // 配置了限速时才分配
+    std::unique_ptr<SessionLimiter> _limiter;
+    // UDP会话的对端地址, TCP会话为空; UDP会话的_fd是所属UdpChannel的socket, 不能关闭
+    std::unique_ptr<UdpPeer> _udp;
+    friend class UdpChannel;
+    // 有帧等待落盘时才分配, 排空后释放
+    std::unique_ptr<std::deque<JournalWait>> _journal_wait;
+    // 有异步请求未完成时才分配
+    std::unique_ptr<InflightState> _inflight;
+    SendQueue _send_que;
+    // 迁移时由原线程修改, 其他线程转发发送任务时读取
+    std::atomic<IOThread*> _p_ownerthread;
+    // 读写字节数, 按采样周期指数衰减, 用于挑选迁移的热点连接
+    uint64_t _load;
+#ifdef EVENT_SERVER_COROUTINE
+    // 安装了协程处理函数时才分配
+    std::unique_ptr<CoState> _coro;
+    friend class ReadFrameAwaiter;
+    friend class SendAwaiter;
+    friend class CoTask;
+    friend void ResumeSession(std::shared_ptr<Session> sess, std::coroutine_handle<> h);
+#endif
 };
 
 #endif
\ No newline at end of file
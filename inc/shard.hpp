@@ -0,0 +1,138 @@
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 分片状态: 每个IO线程拥有键空间的一个分区, 只有属主线程读写, 不需要加锁.
+// 访问其他分片时把请求放进两个线程之间的单生产者单消费者环, 属主线程执行后把回复放进反方向的环,
+// 回调在发起请求的线程上执行. 访问本线程分片也走同样的路径, 回调不会在发起调用时重入.
+// 只能在IO线程内调用ShardStore的接口; 开启分片后IO线程数固定, ScaleTo会拒绝调整.
+
+// 单生产者单消费者环, 容量必须是2的幂
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : _mask(capacity - 1), _slots(capacity) {}
+    bool push(T&& item) {
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail_cache > _mask) {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+            if (head - _tail_cache > _mask) {
+                return false;
+            }
+        }
+        _slots[head & _mask] = std::move(item);
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    bool pop(T& item) {
+        uint64_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head_cache) {
+            _head_cache = _head.load(std::memory_order_acquire);
+            if (tail == _head_cache) {
+                return false;
+            }
+        }
+        item = std::move(_slots[tail & _mask]);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    bool empty() const {
+        return _tail.load(std::memory_order_relaxed) == _head.load(std::memory_order_acquire);
+    }
+private:
+    // 生产者和消费者各自的字段放在不同的缓存行, 避免伪共享
+    alignas(64) std::atomic<uint64_t> _head{0};
+    uint64_t _tail_cache = 0;                       // 生产者看到的_tail
+    alignas(64) std::atomic<uint64_t> _tail{0};
+    uint64_t _head_cache = 0;                       // 消费者看到的_head
+    alignas(64) size_t _mask;
+    std::vector<T> _slots;
+};
+
+enum class ShardOp : uint8_t {
+    Get,
+    Put,        // 设置字符串值
+    Incr,       // 计数器加上_num, 回复新值
+    Erase,
+    Reply,
+};
+
+struct ShardMsg {
+    ShardOp _op = ShardOp::Get;
+    bool _found = false;
+    uint32_t _from = 0;         // 发起请求的线程下标
+    uint64_t _id = 0;           // 请求号, 回复时原样带回
+    int64_t _num = 0;
+    std::string _key;
+    std::string _str;
+};
+
+struct ShardReply {
+    bool _found;
+    int64_t _num;               // 计数器的值
+    const std::string& _str;    // 字符串值, 只在回调内有效
+};
+
+using ShardCallback = std::function<void(const ShardReply&)>;
+
+class IOThread;
+
+// 所有线程两两之间的环, 由EventLoop创建, 开启后线程数不再变化
+class ShardRouter {
+public:
+    static const size_t kRingCapacity = 1024;
+    explicit ShardRouter(const std::vector<IOThread*>& threads);
+    size_t size() const { return _threads.size(); }
+    SpscRing<ShardMsg>& ring(size_t from, size_t to) { return *_rings[from * _threads.size() + to]; }
+    IOThread* thread(size_t idx) const { return _threads[idx]; }
+    size_t shard_of(const std::string& key) const { return std::hash<std::string>()(key) % _threads.size(); }
+private:
+    std::vector<IOThread*> _threads;
+    std::vector<std::unique_ptr<SpscRing<ShardMsg>>> _rings;       // from * n + to
+};
+
+// 一个IO线程的分片和它发出的未完成请求
+class Shard {
+public:
+    Shard(ShardRouter* router, size_t index);
+    void submit(ShardMsg&& msg, ShardCallback cb);
+    // 处理入站的请求和回复, 重试写满时暂存的消息, 唤醒收到消息的线程
+    void poll();
+    // 还有没处理完的本地消息或暂存消息时, IO线程不能阻塞在epoll_wait
+    bool busy() const;
+    size_t keys() const { return _store.size(); }
+private:
+    struct Entry {
+        int64_t _num = 0;
+        std::string _str;
+    };
+    void send(size_t to, ShardMsg&& msg);
+    void apply(ShardMsg& msg);
+    ShardRouter* _router;
+    size_t _index;
+    std::unordered_map<std::string, Entry> _store;
+    std::unordered_map<uint64_t, ShardCallback> _pending;
+    uint64_t _next_id;
+    std::vector<std::deque<ShardMsg>> _overflow;    // 对方的环写满时暂存, 按顺序重试
+    std::vector<uint8_t> _doorbell;                 // 本轮向哪些线程发过消息
+};
+
+// 处理函数使用的接口, 回调在当前IO线程上执行
+class ShardStore {
+public:
+    static bool Enabled();
+    static void Get(const std::string& key, ShardCallback cb);
+    static void Put(const std::string& key, const std::string& value, ShardCallback cb = nullptr);
+    static void Incr(const std::string& key, int64_t delta, ShardCallback cb = nullptr);
+    static void Erase(const std::string& key, ShardCallback cb = nullptr);
+};
+
+#endif
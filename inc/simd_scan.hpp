@@ -0,0 +1,14 @@
+#ifndef __SIMD_SCAN_H__
+#define __SIMD_SCAN_H__
+
+#include <cstddef>
+
+// 分隔符查找, x86_64上运行时选择AVX2/SSE2实现, 其他平台退化为逐字节扫描
+// 返回匹配位置的下标, 找不到返回n
+size_t simd_find_byte(const char* p, size_t n, char c);
+// 查找HTTP头部结束标记"\r\n\r\n"的起始位置
+size_t simd_find_crlfcrlf(const char* p, size_t n);
+// 当前使用的实现: "avx2" / "sse2" / "scalar"
+const char* simd_level();
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef __STAGE_STATS_H__
+#define __STAGE_STATS_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// 分阶段耗时统计: 每个线程一组累加器, 只有本线程写入, 读取时把所有线程的加起来
+// 打开EVENT_SERVER_STAGE_STATS编译选项后STAGE_SCOPE才会计时, 关闭时宏展开为空
+// 阶段可以嵌套, 统计的是去掉内层阶段之后的自身耗时, 例如处理函数里调用Send的时间算在enqueue而不是dispatch
+
+enum class Stage : uint8_t {
+    Decode = 0,     // 读socket并解析出帧, 不含分发
+    Dispatch,       // 处理函数
+    Enqueue,        // Session::Send把回复编码进任务并入队唤醒
+    Tasks,          // 处理跨线程任务队列, 不含其中的写socket
+    Flush,          // 写socket, 包括直接发送和EPOLLOUT时排空发送队列
+    Count,
+};
+
+struct StageTotals {
+    uint64_t _calls[(int)Stage::Count] = {0};
+    uint64_t _ns[(int)Stage::Count] = {0};
+};
+
+class StageStats {
+public:
+    static StageStats* local() {
+        StageStats* stats = t_local;
+        return stats ? stats : create_local();
+    }
+    void add(Stage stage, uint64_t ns) {
+        int idx = (int)stage;
+        _calls[idx].store(_calls[idx].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        _ns[idx].store(_ns[idx].load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    }
+    static const char* Name(Stage stage);
+    // 所有线程的累计值, 包括已经退出的线程
+    static StageTotals Collect();
+    static void Reset();
+
+private:
+    StageStats() = default;
+    static StageStats* create_local();
+    std::atomic<uint64_t> _calls[(int)Stage::Count] = {};
+    std::atomic<uint64_t> _ns[(int)Stage::Count] = {};
+
+    static inline thread_local StageStats* t_local = nullptr;
+    static std::mutex _registry_mtx;
+    static std::vector<std::unique_ptr<StageStats>> _registry;
+};
+
+// 作用域计时, 析构时把自身耗时(减去内层阶段)记到本线程的累加器
+class StageScope {
+public:
+    explicit StageScope(Stage stage) : _stage(stage), _child_ns(0), _parent(t_current) {
+        t_current = this;
+        _begin = now_ns();
+    }
+    ~StageScope() {
+        uint64_t elapsed = now_ns() - _begin;
+        StageStats::local()->add(_stage, elapsed - std::min(elapsed, _child_ns));
+        if (_parent) {
+            _parent->_child_ns += elapsed;
+        }
+        t_current = _parent;
+    }
+private:
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    Stage _stage;
+    uint64_t _begin;
+    uint64_t _child_ns;
+    StageScope* _parent;
+    static inline thread_local StageScope* t_current = nullptr;
+};
+
+#define STAGE_CONCAT_(a, b) a##b
+#define STAGE_CONCAT(a, b) STAGE_CONCAT_(a, b)
+#ifdef EVENT_SERVER_STAGE_STATS
+#define STAGE_SCOPE(stage) StageScope STAGE_CONCAT(_stage_scope_, __LINE__)(stage)
+#else
+#define STAGE_SCOPE(stage) ((void)0)
+#endif
+
+#endif
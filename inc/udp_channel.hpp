@@ -0,0 +1,70 @@
+#ifndef __UDP_CHANNEL_H__
+#define __UDP_CHANNEL_H__
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <memory>
+#include <vector>
+
+class DataBuf;
+class Session;
+
+// 每个IOThread一个UDP socket(SO_REUSEPORT绑定同一端口, 由内核按四元组分流)
+// 接收用recvmmsg批量读取, 回复先攒在发送批次中, 每轮循环结束时用sendmmsg一次发出
+class UdpChannel {
+public:
+    UdpChannel(int fd, int batch, bool gro, bool gso);
+    ~UdpChannel();
+    int fd() const { return _fd; }
+    // 收一批数据报, 返回数量, 没有数据返回0, 出错返回-1
+    int recv_batch();
+    const char* data(int i) const { return (const char*)_riov[i].iov_base; }
+    size_t len(int i) const { return _rmsgs[i].msg_len; }
+    const struct sockaddr_storage& peer(int i) const { return _raddrs[i]; }
+    socklen_t peer_len(int i) const { return _rmsgs[i].msg_hdr.msg_namelen; }
+    // GRO合并后的分段大小, 0表示没有合并
+    size_t segment(int i) const;
+
+    void queue(const struct sockaddr_storage& addr, socklen_t addr_len, std::shared_ptr<DataBuf> buf);
+    bool has_pending() const { return !_out.empty(); }
+    // 发出所有待发送的数据报, 返回发出的数量; socket缓冲区满时丢弃剩余部分
+    int flush();
+
+    // 处理函数持有了UDP会话, 线程退出时需要把它们标记为已关闭
+    void retain(std::shared_ptr<Session> sess);
+    void release_all();
+
+    // 创建非阻塞、SO_REUSEPORT的UDP socket, 失败返回-1
+    static int open_socket(int port, bool gro);
+private:
+    struct Pending {
+        struct sockaddr_storage _addr;
+        socklen_t _addr_len;
+        std::shared_ptr<DataBuf> _buf;
+    };
+    int _fd;
+    int _batch;
+    bool _gro;
+    bool _gso;
+    size_t _slot_size;
+    std::vector<char> _rbuf;
+    std::vector<struct mmsghdr> _rmsgs;
+    std::vector<struct iovec> _riov;
+    std::vector<struct sockaddr_storage> _raddrs;
+    std::vector<char> _rctrl;
+    std::vector<Pending> _out;
+    std::vector<struct mmsghdr> _wmsgs;
+    std::vector<struct iovec> _wiov;
+    std::vector<char> _wctrl;
+    std::vector<std::weak_ptr<Session>> _retained;
+};
+
+// UDP会话的对端地址, 只有UDP会话才分配
+struct UdpPeer {
+    UdpChannel* _channel;       // 通道关闭后为空, 之后的回复丢弃
+    struct sockaddr_storage _addr;
+    socklen_t _addr_len;
+};
+
+#endif
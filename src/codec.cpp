@@ -0,0 +1,127 @@
+#include "codec.hpp"
+#include "session.hpp"
+#include "simd_scan.hpp"
+#include <strings.h>
+
+static LineCodec s_line_codec;
+static HttpCodec s_http_codec;
+
+Codec* GetCodec(CodecType type) {
+    switch (type) {
+    case CodecType::Line:
+        return &s_line_codec;
+    case CodecType::Http:
+        return &s_http_codec;
+    default:
+        return nullptr;
+    }
+}
+
+static std::shared_ptr<DataBuf> make_frame(uint16_t type, const char* data, size_t len) {
+    auto frame = std::make_shared<DataBuf>(type, len);
+    memcpy(frame->_buf, data, len);
+    frame->_offset = len;
+    return frame;
+}
+
+/**********************************
+ * LineCodec
+ **********************************/
+ssize_t LineCodec::decode(const char* buf, size_t len, std::shared_ptr<DataBuf>& frame) {
+    size_t pos = simd_find_byte(buf, len, '\n');
+    if (pos == len) {
+        return len > CODEC_MAX_FRAME ? -1 : 0;
+    }
+    size_t line_len = pos;
+    if (line_len > 0 && buf[line_len - 1] == '\r') {
+        line_len--;
+    }
+    frame = make_frame(LINE_MSG_TYPE, buf, line_len);
+    return pos + 1;
+}
+
+void LineCodec::encode(uint16_t /*msg_type*/, const std::string& body, std::string& out) {
+    out.reserve(body.size() + 1);
+    out.append(body);
+    out.push_back('\n');
+}
+
+/**********************************
+ * HttpCodec
+ **********************************/
+ssize_t HttpCodec::decode(const char* buf, size_t len, std::shared_ptr<DataBuf>& frame) {
+    size_t end = simd_find_crlfcrlf(buf, len);
+    if (end == len) {
+        return len > CODEC_MAX_FRAME ? -1 : 0;
+    }
+    size_t head_len = end + 4;
+
+    // 请求行: METHOD SP TARGET SP HTTP/1.x
+    size_t line_end = simd_find_byte(buf, end + 2, '\r');
+    size_t sp1 = simd_find_byte(buf, line_end, ' ');
+    if (sp1 == line_end || sp1 == 0) {
+        return -1;
+    }
+    size_t sp2 = sp1 + 1 + simd_find_byte(buf + sp1 + 1, line_end - sp1 - 1, ' ');
+    if (sp2 >= line_end || sp2 == sp1 + 1) {
+        return -1;
+    }
+    if (line_end - sp2 - 1 < 8 || memcmp(buf + sp2 + 1, "HTTP/1.", 7) != 0) {
+        return -1;
+    }
+
+    // 头部只关心Content-Length和Transfer-Encoding
+    size_t content_len = 0;
+    size_t pos = line_end + 2;
+    while (pos < end + 2) {
+        size_t eol = pos + simd_find_byte(buf + pos, end + 2 - pos, '\r');
+        const char* line = buf + pos;
+        size_t n = eol - pos;
+        static const char kContentLength[] = "content-length:";
+        static const char kTransferEncoding[] = "transfer-encoding:";
+        if (n > sizeof(kContentLength) - 1 && strncasecmp(line, kContentLength, sizeof(kContentLength) - 1) == 0) {
+            std::string value(line + sizeof(kContentLength) - 1, n - (sizeof(kContentLength) - 1));
+            content_len = strtoul(value.c_str(), nullptr, 10);
+        }
+        else if (n > sizeof(kTransferEncoding) - 1 && strncasecmp(line, kTransferEncoding, sizeof(kTransferEncoding) - 1) == 0) {
+            return -1;
+        }
+        pos = eol + 2;
+    }
+    if (content_len > CODEC_MAX_FRAME) {
+        return -1;
+    }
+    if (len < head_len + content_len) {
+        return 0;
+    }
+
+    std::string body;
+    body.reserve(line_end + content_len);
+    body.append(buf, sp2);
+    body.push_back('\n');
+    body.append(buf + head_len, content_len);
+    frame = make_frame(HTTP_MSG_TYPE, body.data(), body.size());
+    return head_len + content_len;
+}
+
+static const char* http_reason(uint16_t status) {
+    switch (status) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+void HttpCodec::encode(uint16_t msg_type, const std::string& body, std::string& out) {
+    char head[128];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %u %s\r\nContent-Length: %zu\r\nConnection: keep-alive\r\n\r\n",
+                     (unsigned)msg_type, http_reason(msg_type), body.size());
+    out.reserve(n + body.size());
+    out.append(head, n);
+    out.append(body);
+}
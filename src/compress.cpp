@@ -0,0 +1,116 @@
+#include "compress.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include "configmgr.hpp"
+#include "global.hpp"
+#include "lz_codec.hpp"
+#include "session.hpp"
+
+static const size_t kRawLenSize = 4;
+
+static const ConfigKey<bool>& compress_enabled() {
+    static ConfigKey<bool> key("compress.enabled", false);
+    return key;
+}
+
+static const ConfigKey<int>& compress_min_bytes() {
+    static ConfigKey<int> key("compress.min_bytes", 2048);
+    return key;
+}
+
+bool CompressAccepted() {
+    return compress_enabled().get();
+}
+
+size_t BinaryFrameBound(size_t len, bool with_id, bool compress) {
+    size_t head = HEAD_LEN + (with_id ? HEAD_REQ_ID_LEN : 0);
+    return head + (compress ? std::max(len, kRawLenSize + lz_bound(len)) : len);
+}
+
+size_t EncodeBinaryFrame(char* out, uint16_t type, const char* body, size_t len, bool with_id, uint32_t req_id,
+                         bool compress) {
+    size_t head = HEAD_LEN + (with_id ? HEAD_REQ_ID_LEN : 0);
+    uint16_t flags = with_id ? HEAD_REQ_ID_FLAG : 0;
+    size_t body_len = 0;
+    // 超过14位的包体只要能压进14位就压缩, 否则至少省下1/8才值得对端解压
+    size_t min_bytes = (size_t)std::max(compress_min_bytes().get(), 64);
+    if (compress && (len >= min_bytes || len > HEAD_EXT_MAX_BODY)) {
+        auto& stats = CompressStats::Inst();
+        size_t limit = len > HEAD_EXT_MAX_BODY ? HEAD_EXT_MAX_BODY : len - len / 8;
+        size_t n = lz_compress(body, len, out + head + kRawLenSize, limit - kRawLenSize);
+        if (n > 0) {
+            uint32_t raw = htonl((uint32_t)len);
+            memcpy(out + head, &raw, kRawLenSize);
+            body_len = n + kRawLenSize;
+            flags |= HEAD_COMPRESS_FLAG;
+            stats._frames.fetch_add(1, std::memory_order_relaxed);
+            stats._raw_bytes.fetch_add(len, std::memory_order_relaxed);
+            stats._wire_bytes.fetch_add(body_len, std::memory_order_relaxed);
+        }
+        else {
+            stats._skipped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (!(flags & HEAD_COMPRESS_FLAG)) {
+        if (len > HEAD_EXT_MAX_BODY) {
+            return 0;
+        }
+        memcpy(out + head, body, len);
+        body_len = len;
+    }
+    uint16_t net_type = htons(type);
+    uint16_t net_len = htons((uint16_t)body_len | flags);
+    memcpy(out, &net_type, 2);
+    memcpy(out + 2, &net_len, 2);
+    if (with_id) {
+        uint32_t net_id = htonl(req_id);
+        memcpy(out + HEAD_LEN, &net_id, HEAD_REQ_ID_LEN);
+    }
+    return head + body_len;
+}
+
+std::shared_ptr<DataBuf> InflateFrame(const DataBuf& frame, size_t max_len) {
+    if (frame._data_len < kRawLenSize) {
+        return nullptr;
+    }
+    uint32_t raw;
+    memcpy(&raw, frame._buf, kRawLenSize);
+    raw = ntohl(raw);
+    if (raw > max_len) {
+        return nullptr;
+    }
+    auto out = std::make_shared<DataBuf>(frame._type, raw);
+    ssize_t n = lz_decompress(frame._buf + kRawLenSize, frame._data_len - kRawLenSize, out->_buf, raw);
+    if (n != (ssize_t)raw) {
+        return nullptr;
+    }
+    out->_offset = raw;
+    out->_req_id = frame._req_id;
+    CompressStats::Inst()._inflated.fetch_add(1, std::memory_order_relaxed);
+    return out;
+}
+
+const std::string& SharedFrame::encoded(bool with_id, bool compress) const {
+    int idx = (with_id ? 2 : 0) | (compress ? 1 : 0);
+    std::call_once(_once[idx], [&] {
+        std::string& out = _enc[idx];
+        if (!with_id && !compress) {
+            // 旧格式: 长度字段16位
+            if (_body.size() > 0xFFFF) {
+                return;
+            }
+            out.resize(HEAD_LEN + _body.size());
+            uint16_t net_type = htons(_type);
+            uint16_t net_len = htons((uint16_t)_body.size());
+            memcpy(&out[0], &net_type, 2);
+            memcpy(&out[2], &net_len, 2);
+            memcpy(&out[HEAD_LEN], _body.data(), _body.size());
+            return;
+        }
+        out.resize(BinaryFrameBound(_body.size(), with_id, compress));
+        out.resize(EncodeBinaryFrame(&out[0], _type, _body.data(), _body.size(), with_id, 0, compress));
+        out.shrink_to_fit();
+    });
+    return _enc[idx];
+}
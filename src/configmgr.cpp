@@ -1,4 +1,5 @@
 #include "configmgr.hpp"
+#include "logger.hpp"
 #include <fstream>
 #include <sstream>
 #include <algorithm>
@@ -17,13 +18,18 @@ static void trim(std::string& s) {
     }
 }
 
+ConfigMgr::ConfigMgr() : _snap(nullptr), _next_listener(1) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    publish({}, 1);
+}
+
 bool ConfigMgr::loadFromFile(const std::string &filepath)
 {
     std::ifstream in(filepath);
     if (!in.is_open())   return false;
-    section_.clear();
-    // 重置状态
-    kv_.clear();
+    // 解析到新的表里, 读者在此期间继续使用旧快照
+    std::unordered_map<std::string, std::string> kv;
+    std::string section;
 
     std::string line;
     while (std::getline(in, line)) {
@@ -36,8 +42,8 @@ bool ConfigMgr::loadFromFile(const std::string &filepath)
 
         // 处理section
         if (line.front() == '[' && line.back() == ']') {
-            section_ = line.substr(1, line.size() - 2);
-            trim(section_);
+            section = line.substr(1, line.size() - 2);
+            trim(section);
             continue;
         }
 
@@ -48,14 +54,108 @@ bool ConfigMgr::loadFromFile(const std::string &filepath)
         std::string value = line.substr(eq + 1);
         trim(key);
         trim(value);
-        if (!section_.empty()) {
-            key = section_ + "." + key;
+        if (!section.empty()) {
+            key = section + "." + key;
         }
-        kv_[key] = value;
+        kv[key] = value;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(_mtx);
+        _path = filepath;
+        publish(std::move(kv), version() + 1);
+    }
+    // 持锁回调, 注销返回后回调不会再运行
+    std::lock_guard<std::mutex> lk(_listener_mtx);
+    for (auto& l : _listeners) {
+        l.second();
     }
     return true;
 }
 
+bool ConfigMgr::Reload() {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lk(_mtx);
+        path = _path;
+    }
+    if (path.empty() || !loadFromFile(path)) {
+        LOG_WARN("config reload %s failed, keep version %lu", path, (unsigned long)version());
+        return false;
+    }
+    LOG_INFO("config reloaded from %s, version %lu", path, (unsigned long)version());
+    return true;
+}
+
+// 值格式错误时使用默认值, 重载时写错一个值不会让进程退出
+static void parse_value(const std::string& key, const std::string* raw, ConfigMgr::Kind kind,
+                        const ConfigValue& def, ConfigValue& out) {
+    out = def;
+    if (raw == nullptr) {
+        return;
+    }
+    try {
+        switch (kind) {
+        case ConfigMgr::Kind::Num:
+            out._num = std::stol(*raw);
+            break;
+        case ConfigMgr::Kind::Real:
+            out._real = std::stod(*raw);
+            break;
+        case ConfigMgr::Kind::Flag: {
+            std::string t = *raw;
+            std::transform(t.begin(), t.end(), t.begin(), [](unsigned char c) {return std::tolower(c);});
+            out._flag = (t == "1" || t == "true" || t == "yes");
+            break;
+        }
+        case ConfigMgr::Kind::Str:
+            out._str = *raw;
+            break;
+        }
+    }
+    catch (const std::exception&) {
+        LOG_WARN("config %s = %s is invalid, use default", key, *raw);
+        out = def;
+    }
+}
+
+void ConfigMgr::publish(std::unordered_map<std::string, std::string>&& kv, uint64_t version) {
+    auto snap = std::make_unique<ConfigSnapshot>();
+    snap->_version = version;
+    snap->_kv = std::move(kv);
+    snap->_values.resize(_keys.size());
+    for (size_t i = 0; i < _keys.size(); i++) {
+        auto it = snap->_kv.find(_keys[i]._key);
+        parse_value(_keys[i]._key, it == snap->_kv.end() ? nullptr : &it->second, _keys[i]._kind, _keys[i]._def,
+                    snap->_values[i]);
+    }
+    _snap.store(snap.get(), std::memory_order_release);
+    _retired.push_back(std::move(snap));
+}
+
+size_t ConfigMgr::Register(const std::string& key, Kind kind, const ConfigValue& def) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _keys.push_back(KeyDef{key, kind, def});
+    // 同样的键值重新发布一份带上新句柄的快照, 版本号不变; 注册只在各模块首次使用时发生
+    const ConfigSnapshot* cur = _snap.load(std::memory_order_relaxed);
+    publish(std::unordered_map<std::string, std::string>(cur->_kv), cur->_version);
+    return _keys.size() - 1;
+}
+
+int ConfigMgr::AddListener(std::function<void()> func) {
+    std::lock_guard<std::mutex> lk(_listener_mtx);
+    int id = _next_listener++;
+    _listeners.emplace_back(id, std::move(func));
+    return id;
+}
+
+void ConfigMgr::RemoveListener(int id) {
+    std::lock_guard<std::mutex> lk(_listener_mtx);
+    _listeners.erase(std::remove_if(_listeners.begin(), _listeners.end(),
+                                    [id](const std::pair<int, std::function<void()>>& l) { return l.first == id; }),
+                     _listeners.end());
+}
+
 /**********************************
  * Full specialization of fromSring
  **********************************/
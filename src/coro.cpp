@@ -0,0 +1,222 @@
+#include "coro.hpp"
+
+#ifdef EVENT_SERVER_COROUTINE
+
+#include <exception>
+#include "logger.hpp"
+
+static const size_t kFrameClassSize = 64;
+static const size_t kFrameClassNum = 16;
+
+struct FrameNode {
+    FrameNode* _next;
+};
+
+// 线程本地空闲链表, 协程帧在哪个线程释放就回到哪个线程的链表, 线程退出时归还
+struct FrameFreeList {
+    FrameNode* _heads[kFrameClassNum] = {};
+    ~FrameFreeList() {
+        for (size_t i = 0; i < kFrameClassNum; i++) {
+            while (_heads[i]) {
+                FrameNode* next = _heads[i]->_next;
+                ::operator delete(_heads[i]);
+                _heads[i] = next;
+            }
+        }
+    }
+};
+static thread_local FrameFreeList t_free_frames;
+static std::atomic<size_t> g_live_frames(0);
+static std::atomic<size_t> g_live_bytes(0);
+
+// 正在执行的会话协程所属的Session, sleep_for据此在属主线程上恢复
+static thread_local Session* t_co_sess = nullptr;
+
+static CoHandler g_co_handler;
+
+void* CoFramePool::alloc(size_t size) {
+    g_live_frames.fetch_add(1, std::memory_order_relaxed);
+    g_live_bytes.fetch_add(size, std::memory_order_relaxed);
+    size_t idx = (size + kFrameClassSize - 1) / kFrameClassSize - 1;
+    if (idx >= kFrameClassNum) {
+        return ::operator new(size);
+    }
+    FrameNode* node = t_free_frames._heads[idx];
+    if (node) {
+        t_free_frames._heads[idx] = node->_next;
+        return node;
+    }
+    return ::operator new((idx + 1) * kFrameClassSize);
+}
+
+void CoFramePool::free(void* p, size_t size) {
+    g_live_frames.fetch_sub(1, std::memory_order_relaxed);
+    g_live_bytes.fetch_sub(size, std::memory_order_relaxed);
+    size_t idx = (size + kFrameClassSize - 1) / kFrameClassSize - 1;
+    if (idx >= kFrameClassNum) {
+        ::operator delete(p);
+        return;
+    }
+    FrameNode* node = static_cast<FrameNode*>(p);
+    node->_next = t_free_frames._heads[idx];
+    t_free_frames._heads[idx] = node;
+}
+
+size_t CoFramePool::live_frames() {
+    return g_live_frames.load(std::memory_order_relaxed);
+}
+
+size_t CoFramePool::live_bytes() {
+    return g_live_bytes.load(std::memory_order_relaxed);
+}
+
+void CoTask::promise_type::return_void() {
+    if (!_sess) {
+        return;
+    }
+    IOThread* owner = _sess->_p_ownerthread.load(std::memory_order_acquire);
+    if (owner) {
+        owner->finish_coroutine(_sess);
+    }
+}
+
+void CoTask::promise_type::unhandled_exception() {
+    try {
+        throw;
+    }
+    catch (const std::exception& e) {
+        LOG_ERROR("session coroutine throws an exception: %s", e.what());
+    }
+    catch (...) {
+        LOG_ERROR("session coroutine throws an unknown exception");
+    }
+    // 异步日志, 终止前先写出
+    Logger::Shutdown();
+    std::terminate();
+}
+
+bool ReadFrameAwaiter::await_ready() const {
+    auto& st = *_sess->_coro;
+    return st._closed || !st._inbox.empty();
+}
+
+void ReadFrameAwaiter::await_suspend(std::coroutine_handle<> h) {
+    _sess->_coro->_read_waiter = h;
+}
+
+CoFrame ReadFrameAwaiter::await_resume() {
+    auto& st = *_sess->_coro;
+    // 关闭前已经收到的帧仍然交给协程
+    if (st._inbox.empty()) {
+        return CoFrame{0, std::string(), true};
+    }
+    auto frame = st._inbox.front();
+    st._inbox.erase(st._inbox.begin());
+    return CoFrame{frame->_type, std::string(frame->_buf, frame->_data_len), false};
+}
+
+SendAwaiter::SendAwaiter(Session* sess, int msg_type, const std::string& data) :
+    _sess(sess), _buf(sess->make_send_buf(msg_type, data)), _res(IO_ERROR) {}
+
+bool SendAwaiter::await_ready() {
+    // 回复超出扩展头部能表示的长度时编码失败
+    if (_sess->_coro->_closed || !_buf) {
+        _res = IO_ERROR;
+        return true;
+    }
+    IOThread* owner = _sess->_p_ownerthread.load(std::memory_order_acquire);
+    auto sess = _sess->shared_from_this();
+    _res = owner->send_now(sess, _buf);
+    return _res != IO_EAGAIN;
+}
+
+void SendAwaiter::await_suspend(std::coroutine_handle<> h) {
+    _sess->_coro->_send_waiter = h;
+}
+
+bool SendAwaiter::await_resume() {
+    if (_res == IO_EAGAIN) {
+        return _sess->_coro->_send_ok;
+    }
+    return _res == IO_SUCCESS;
+}
+
+bool SleepAwaiter::await_suspend(std::coroutine_handle<> h) {
+    IOThread* thr = IOThread::current();
+    if (thr == nullptr) {
+        return false;
+    }
+    std::shared_ptr<Session> sess = t_co_sess ? t_co_sess->shared_from_this() : nullptr;
+    thr->run_after(_ms, [sess, h]() {
+        if (sess) {
+            ResumeSession(sess, h);
+        }
+        else {
+            h.resume();
+        }
+    });
+    return true;
+}
+
+ReadFrameAwaiter Session::read_frame() {
+    if (!_coro) {
+        _coro = std::make_unique<CoState>();
+    }
+    return ReadFrameAwaiter(this);
+}
+
+SendAwaiter Session::send(int msg_type, const std::string& data) {
+    if (!_coro) {
+        _coro = std::make_unique<CoState>();
+    }
+    return SendAwaiter(this, msg_type, data);
+}
+
+void SetCoroutineHandler(CoHandler handler) {
+    g_co_handler = std::move(handler);
+}
+
+const CoHandler& GetCoroutineHandler() {
+    return g_co_handler;
+}
+
+void ResumeSession(std::shared_ptr<Session> sess, std::coroutine_handle<> h) {
+    IOThread* owner = sess->_p_ownerthread.load(std::memory_order_acquire);
+    // Session已迁到其他线程, 转过去恢复; 已关闭的Session在当前线程恢复即可
+    if (owner != nullptr && owner != IOThread::current()) {
+        owner->run_in_loop([sess, h]() {
+            ResumeSession(sess, h);
+        });
+        return;
+    }
+    Session* prev = t_co_sess;
+    t_co_sess = sess.get();
+    h.resume();
+    t_co_sess = prev;
+}
+
+/************************************
+ *   @section IOThread coroutine hooks
+ *   @brief   会话协程的创建与结束
+ ************************************/
+void IOThread::spawn_coroutine(std::shared_ptr<Session>& sess) {
+    if (!g_co_handler) {
+        return;
+    }
+    sess->_coro = std::make_unique<CoState>();
+    Session* prev = t_co_sess;
+    t_co_sess = sess.get();
+    g_co_handler(sess);
+    t_co_sess = prev;
+}
+
+// 协程返回后不再接收新帧, 发送队列排空后关闭连接
+void IOThread::finish_coroutine(std::shared_ptr<Session>& sess) {
+    sess->_coro->_done = true;
+    sess->_coro->_inbox.clear();
+    if (sess->_send_que.empty() && sess->_send_stage != SENDING) {
+        clear_fd(sess->_fd);
+    }
+}
+
+#endif
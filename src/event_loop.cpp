@@ -2,31 +2,71 @@
 #include <unordered_map>
 #include <vector>
 #include <set>
+#include <future>
 #include "event_loop.hpp"
+#include "configmgr.hpp"
+#include "udp_channel.hpp"
+#include "logger.hpp"
 
-EventLoop::EventLoop(int thread_num): _next_idx(0), _thread_num(thread_num) {
-    std::cout << "construt event_loop num is " << thread_num << std::endl;
+// 重平衡参数随配置重载生效
+static const ConfigKey<double>& rebalance_ratio() {
+    static ConfigKey<double> key("server.rebalance_ratio", 2.0);
+    return key;
+}
+
+static const ConfigKey<long>& rebalance_min_load() {
+    static ConfigKey<long> key("server.rebalance_min_load", 1 << 20);
+    return key;
+}
+
+static const ConfigKey<int>& rebalance_interval_ms() {
+    static ConfigKey<int> key("server.rebalance_interval_ms", 0);
+    return key;
+}
+
+EventLoop::EventLoop(int thread_num): _next_idx(0), _thread_num(thread_num), _udp_port(0), _rebalance_stop(false),
+    _rebalance_running(false) {
+    LOG_INFO("construt event_loop num is %d", thread_num);
     _work_threads.reserve(thread_num);
     for (int i = 0; i < thread_num; i++) {
         auto thr = std::make_unique<IOThread>(i);
         thr->start();
         _work_threads.emplace_back(std::move(thr));
     }
+
+    auto &cfg = ConfigMgr::Inst();
+    _udp_batch = std::max(1, cfg.get<int>("server.udp_batch", 32));
+    _udp_gro = cfg.get<bool>("server.udp_gro", false);
+    _udp_gso = cfg.get<bool>("server.udp_gso", false);
+    start_rebalance();
+    // 重载后打开的重平衡在这里启动, 关闭的由重平衡线程自己退出
+    _cfg_listener = cfg.AddListener([this] { start_rebalance(); });
 }
 
 EventLoop::~EventLoop() {
-    for (int i = 0; i < _thread_num; i++) {
+    ConfigMgr::Inst().RemoveListener(_cfg_listener);
+    stop_rebalance();
+    for (size_t i = 0; i < _work_threads.size(); i++) {
         _work_threads[i]->join();
     }
-    std::cout <<  "EventLoop exit" << std::endl;
+    LOG_INFO("EventLoop exit");
 }
 
-void EventLoop::NotifyNewCons(std::vector<int> &conns) {
+void EventLoop::NotifyNewCons(std::vector<int> &conns, CodecType codec) {
+    std::lock_guard<std::mutex> lk(_thr_mtx);
     std::set<int> notify_threads;
-    for (int i = 0; i < conns.size(); i++) {
+    size_t n = _work_threads.size();
+    for (size_t i = 0; i < conns.size(); i++) {
         auto fd = conns[i];
-        auto index = fd % _work_threads.size();
-        _work_threads[index]->catche_new_conn(fd);
+        auto index = fd % n;
+        // 不往已经过载的线程上堆连接, 都过载时仍按fd取模
+        for (size_t k = 0; k < n && _work_threads[index]->overloaded(); k++) {
+            index = (fd + k + 1) % n;
+        }
+        if (_work_threads[index]->overloaded()) {
+            index = fd % n;
+        }
+        _work_threads[index]->catche_new_conn(fd, codec);
         notify_threads.insert(index);
     }
     for (auto index : notify_threads) {
@@ -35,7 +75,218 @@ void EventLoop::NotifyNewCons(std::vector<int> &conns) {
 }
 
 void EventLoop::StopIOThread() {
-    for (int i = 0; i < _thread_num; i++) {
+    stop_rebalance();
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    for (size_t i = 0; i < _work_threads.size(); i++) {
         _work_threads[i]->stop();
     }
 }
+
+bool EventLoop::ScaleTo(int thread_num) {
+    if (thread_num <= 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    int cur = _work_threads.size();
+    // 键按线程数取模分布在各分片上, 线程数变化需要搬迁数据, 目前不支持
+    if (_shard_router && thread_num != cur) {
+        LOG_WARN("event_loop can not scale from %d to %d, sharded state is enabled", cur, thread_num);
+        return false;
+    }
+    if (thread_num == cur) {
+        return true;
+    }
+    if (thread_num > cur) {
+        for (int i = cur; i < thread_num; i++) {
+            auto thr = std::make_unique<IOThread>(i);
+            thr->start();
+            if (_udp_port > 0) {
+                add_udp_socket(thr.get());
+            }
+            if (_relay_cfg._backend_port > 0) {
+                thr->enable_relay(_relay_cfg);
+            }
+            _work_threads.emplace_back(std::move(thr));
+        }
+    }
+    else if (thread_num < cur) {
+        // 先从分发列表中摘除, 之后新连接和重平衡都不会再选中这些线程
+        std::vector<std::unique_ptr<IOThread>> removed;
+        for (int i = thread_num; i < cur; i++) {
+            removed.emplace_back(std::move(_work_threads[i]));
+        }
+        _work_threads.resize(thread_num);
+
+        std::vector<IOThread*> survivors;
+        for (auto& thr : _work_threads) {
+            survivors.push_back(thr.get());
+        }
+        // 屏障: 存活线程处理完之前入队的任务, 保证发往被移除线程的迁移/转发任务都已入队
+        for (auto thr : survivors) {
+            auto done = std::make_shared<std::promise<void>>();
+            auto fut = done->get_future();
+            thr->run_in_loop([done]{ done->set_value(); });
+            fut.wait();
+        }
+        // 迁出任务先于退出任务入队, 线程退出前会把所有Session交给存活线程
+        for (size_t i = 0; i < removed.size(); i++) {
+            removed[i]->retire(survivors[i % survivors.size()]);
+            removed[i]->migrate_sessions(survivors, 0);
+            removed[i]->stop();
+        }
+        // 其他线程可能已经取到了被移除线程的指针(跨线程Send, 持有的UDP会话), 对象保留到EventLoop析构,
+        // 之后发给它的任务转交存活线程
+        for (auto& thr : removed) {
+            thr->join();
+            _retired.emplace_back(std::move(thr));
+        }
+    }
+    _thread_num = thread_num;
+    LOG_INFO("event_loop scale from %d to %d", cur, thread_num);
+    return true;
+}
+
+void EventLoop::Rebalance() {
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    if (_work_threads.size() < 2) {
+        return;
+    }
+    std::vector<uint64_t> loads;
+    loads.reserve(_work_threads.size());
+    for (auto& thr : _work_threads) {
+        loads.push_back(thr->sample_load());
+    }
+    size_t hot = std::max_element(loads.begin(), loads.end()) - loads.begin();
+    size_t cold = std::min_element(loads.begin(), loads.end()) - loads.begin();
+    if (loads[hot] < (uint64_t)rebalance_min_load().get() || loads[hot] < loads[cold] * rebalance_ratio().get()) {
+        return;
+    }
+    // 迁移两者差值的一半, 迁移后两线程负载趋于相等
+    uint64_t budget = (loads[hot] - loads[cold]) / 2;
+    _work_threads[hot]->migrate_sessions({_work_threads[cold].get()}, budget);
+}
+
+bool EventLoop::AddUdpListener(int port) {
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    _udp_port = port;
+    for (auto& thr : _work_threads) {
+        if (!add_udp_socket(thr.get())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void EventLoop::CloseUdpListeners() {
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    _udp_port = 0;
+    for (auto& thr : _work_threads) {
+        thr->close_udp_sockets();
+    }
+}
+
+void EventLoop::EnableRelay(const RelayConfig& cfg) {
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    _relay_cfg = cfg;
+    for (auto& thr : _work_threads) {
+        thr->enable_relay(cfg);
+    }
+}
+
+void EventLoop::EnableShards() {
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    if (_shard_router) {
+        return;
+    }
+    std::vector<IOThread*> threads;
+    for (auto& thr : _work_threads) {
+        threads.push_back(thr.get());
+    }
+    _shard_router = std::make_unique<ShardRouter>(threads);
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->enable_shard(_shard_router.get(), i);
+    }
+}
+
+void EventLoop::RunInEachThread(std::function<void()> func) {
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    for (auto& thr : _work_threads) {
+        thr->run_in_loop(func);
+    }
+}
+
+bool EventLoop::Overloaded() {
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    for (auto& thr : _work_threads) {
+        if (!thr->overloaded()) {
+            return false;
+        }
+    }
+    return !_work_threads.empty();
+}
+
+size_t EventLoop::SessionCount() {
+    std::lock_guard<std::mutex> lk(_thr_mtx);
+    size_t count = 0;
+    for (auto& thr : _work_threads) {
+        count += thr->session_count();
+    }
+    return count;
+}
+
+bool EventLoop::add_udp_socket(IOThread* thr) {
+    int fd = UdpChannel::open_socket(_udp_port, _udp_gro);
+    if (fd < 0) {
+        return false;
+    }
+    thr->add_udp_socket(fd, _udp_batch, _udp_gro, _udp_gso);
+    return true;
+}
+
+void EventLoop::start_rebalance() {
+    std::lock_guard<std::mutex> ctl(_rebalance_ctl);
+    if (rebalance_interval_ms().get() <= 0 || _rebalance_running.load()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(_rebalance_mtx);
+        if (_rebalance_stop) {
+            return;
+        }
+    }
+    // 之前因间隔改为0退出的线程
+    if (_rebalance_thread.joinable()) {
+        _rebalance_thread.join();
+    }
+    _rebalance_running = true;
+    _rebalance_thread = std::thread([this] { this->rebalance_loop(); });
+}
+
+// 每次等待前重新读取间隔, 重载后下一个周期生效; 改为0时线程退出
+void EventLoop::rebalance_loop() {
+    std::unique_lock<std::mutex> lk(_rebalance_mtx);
+    while (!_rebalance_stop) {
+        int interval_ms = rebalance_interval_ms().get();
+        if (interval_ms <= 0) {
+            break;
+        }
+        _rebalance_cv.wait_for(lk, std::chrono::milliseconds(interval_ms));
+        if (_rebalance_stop) {
+            break;
+        }
+        Rebalance();
+    }
+    _rebalance_running = false;
+}
+
+void EventLoop::stop_rebalance() {
+    std::lock_guard<std::mutex> ctl(_rebalance_ctl);
+    {
+        std::lock_guard<std::mutex> lk(_rebalance_mtx);
+        _rebalance_stop = true;
+    }
+    _rebalance_cv.notify_all();
+    if (_rebalance_thread.joinable()) {
+        _rebalance_thread.join();
+    }
+}
@@ -0,0 +1,192 @@
+#include "fd_handoff.hpp"
+#include "logger.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+// 一次交接最多携带的监听socket数量
+static const size_t kMaxHandoffFds = 16;
+static const int kRecvTimeoutSec = 5;
+
+// 线上格式: uint32数量 + 每个监听socket一组(int32端口, int32帧格式), fd本身放在SCM_RIGHTS控制消息里
+struct HandoffEntry {
+    int32_t _port;
+    int32_t _codec;
+};
+
+struct HandoffMsg {
+    uint32_t _count;
+    HandoffEntry _entries[kMaxHandoffFds];
+};
+
+static bool fill_unix_addr(const std::string& path, struct sockaddr_un& addr) {
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR("handoff path too long: %s", path);
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+int HandoffListen(const std::string& path) {
+    struct sockaddr_un addr;
+    if (!fill_unix_addr(path, addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERROR("handoff socket: %s", strerror(errno));
+        return -1;
+    }
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        LOG_ERROR("handoff bind: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool HandoffSend(int conn, const std::vector<ListenerInfo>& listeners, int timeout_ms) {
+    if (listeners.empty() || listeners.size() > kMaxHandoffFds) {
+        return false;
+    }
+    // accept出来的连接继承了监听fd的非阻塞属性, 交接过程很短, 改成阻塞+poll超时
+    int flags = fcntl(conn, F_GETFL, 0);
+    fcntl(conn, F_SETFL, flags & ~O_NONBLOCK);
+
+    HandoffMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg._count = listeners.size();
+    for (size_t i = 0; i < listeners.size(); i++) {
+        msg._entries[i]._port = listeners[i]._port;
+        msg._entries[i]._codec = (int32_t)listeners[i]._codec;
+    }
+    struct iovec iov;
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg._count) + sizeof(HandoffEntry) * listeners.size();
+
+    char ctrl[CMSG_SPACE(sizeof(int) * kMaxHandoffFds)];
+    memset(ctrl, 0, sizeof(ctrl));
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = CMSG_SPACE(sizeof(int) * listeners.size());
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * listeners.size());
+    int* fds = (int*)CMSG_DATA(cm);
+    for (size_t i = 0; i < listeners.size(); i++) {
+        fds[i] = listeners[i]._fd;
+    }
+
+    ssize_t n;
+    do {
+        n = sendmsg(conn, &hdr, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)iov.iov_len) {
+        LOG_ERROR("handoff sendmsg: %s", strerror(errno));
+        return false;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = conn;
+    pfd.events = POLLIN;
+    int res;
+    do {
+        res = poll(&pfd, 1, timeout_ms);
+    } while (res < 0 && errno == EINTR);
+    if (res <= 0) {
+        LOG_ERROR("handoff: no ack from new process");
+        return false;
+    }
+    char ack = 0;
+    return read(conn, &ack, 1) == 1 && ack == 'A';
+}
+
+bool HandoffRecv(const std::string& path, std::vector<ListenerInfo>& listeners, int& out_conn) {
+    struct sockaddr_un addr;
+    if (!fill_unix_addr(path, addr)) {
+        return false;
+    }
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0) {
+        LOG_ERROR("handoff socket: %s", strerror(errno));
+        return false;
+    }
+    // 没有旧进程在等待, 正常冷启动
+    if (connect(conn, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(conn);
+        return false;
+    }
+    // 旧进程卡住时不要让新进程一直等下去
+    struct timeval tv;
+    tv.tv_sec = kRecvTimeoutSec;
+    tv.tv_usec = 0;
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    HandoffMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    struct iovec iov;
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    char ctrl[CMSG_SPACE(sizeof(int) * kMaxHandoffFds)];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = sizeof(ctrl);
+
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &hdr, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    std::vector<int> fds;
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr); cm != nullptr; cm = CMSG_NXTHDR(&hdr, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            size_t cnt = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int* data = (int*)CMSG_DATA(cm);
+            fds.insert(fds.end(), data, data + cnt);
+        }
+    }
+    size_t expect = n >= (ssize_t)sizeof(msg._count) ? msg._count : 0;
+    if (expect == 0 || expect > kMaxHandoffFds || fds.size() != expect
+        || n < (ssize_t)(sizeof(msg._count) + sizeof(HandoffEntry) * expect)) {
+        LOG_ERROR("handoff: bad message from old process");
+        for (int fd : fds) {
+            close(fd);
+        }
+        close(conn);
+        return false;
+    }
+    for (size_t i = 0; i < expect; i++) {
+        listeners.push_back(ListenerInfo{fds[i], msg._entries[i]._port, (CodecType)msg._entries[i]._codec});
+    }
+    out_conn = conn;
+    return true;
+}
+
+bool HandoffAck(int conn) {
+    // 确认之后旧进程才会关闭自己的监听fd
+    char ack = 'A';
+    bool ok = write(conn, &ack, 1) == 1;
+    if (!ok) {
+        LOG_ERROR("handoff ack: %s", strerror(errno));
+    }
+    close(conn);
+    return ok;
+}
@@ -0,0 +1,137 @@
+#include "flight_recorder.hpp"
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cstdio>
+#include <thread>
+#include <algorithm>
+
+std::mutex FlightRecorder::_registry_mtx;
+std::vector<std::unique_ptr<FlightRecorder>> FlightRecorder::_registry;
+
+// 时间戳换算基准: 第一个记录器创建时的(ticks, 纳秒), 导出时再取一对算出每tick的纳秒数
+static uint64_t g_base_ticks = 0;
+static int64_t g_base_ns = 0;
+
+static int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct TraceEventDesc {
+    const char* _name;
+    char _phase;            // B开始, E结束, i瞬时事件
+    const char* _arg_name;
+};
+
+static const TraceEventDesc kEventDesc[(int)TraceEvent::Count] = {
+    {"epoll_wait", 'B', nullptr},
+    {"epoll_wait", 'E', "ready"},
+    {"loop", 'B', nullptr},
+    {"loop", 'E', nullptr},
+    {"tasks", 'B', nullptr},
+    {"tasks", 'E', "count"},
+    {"frame_decoded", 'i', "type"},
+    {"handler", 'B', "type"},
+    {"handler", 'E', nullptr},
+    {"write_flushed", 'i', "bytes"},
+    {"write_eagain", 'i', "bytes"},
+};
+
+FlightRecorder* FlightRecorder::create_local() {
+    std::lock_guard<std::mutex> lk(_registry_mtx);
+    if (_registry.empty()) {
+        g_base_ticks = now_ticks();
+        g_base_ns = steady_ns();
+    }
+    int tid = (int)syscall(SYS_gettid);
+    _registry.emplace_back(new FlightRecorder(tid));
+    t_local = _registry.back().get();
+    return t_local;
+}
+
+// 先读head再拷贝, 拷贝完再读一次head, 拷贝期间可能被覆盖的最旧部分丢弃
+void FlightRecorder::dump(std::string& out, double ns_per_tick, uint64_t base_ticks, int pid, bool& first) const {
+    uint64_t head = _head.load(std::memory_order_acquire);
+    uint64_t begin = head > kCapacity ? head - kCapacity : 0;
+    std::vector<std::pair<uint64_t, uint64_t>> recs;
+    recs.reserve(head - begin);
+    for (uint64_t i = begin; i < head; i++) {
+        const Slot& slot = _slots[i & (kCapacity - 1)];
+        recs.emplace_back(slot._ticks.load(std::memory_order_relaxed), slot._info.load(std::memory_order_relaxed));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t head_after = _head.load(std::memory_order_relaxed);
+    size_t skip = 0;
+    if (head_after >= kCapacity && head_after - kCapacity + 1 > begin) {
+        skip = std::min<uint64_t>(head_after - kCapacity + 1 - begin, recs.size());
+    }
+
+    char line[256];
+    // 环形缓冲的开头可能是没有对应开始事件的结束事件, 丢弃以免查看器里的嵌套错乱
+    int depth = 0;
+    for (size_t i = skip; i < recs.size(); i++) {
+        uint64_t info = recs[i].second;
+        int ev = (int)(info >> 56);
+        if (ev >= (int)TraceEvent::Count) {
+            continue;
+        }
+        const TraceEventDesc& desc = kEventDesc[ev];
+        if (desc._phase == 'E') {
+            if (depth == 0) {
+                continue;
+            }
+            depth--;
+        }
+        else if (desc._phase == 'B') {
+            depth++;
+        }
+        int fd = (int)((info >> 32) & 0xFFFFFF);
+        uint32_t arg = (uint32_t)info;
+        double ts_us = recs[i].first >= base_ticks ? (recs[i].first - base_ticks) * ns_per_tick / 1000.0 : 0;
+        int n = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+                         first ? "" : ",\n", desc._name, desc._phase, pid, _tid, ts_us);
+        out.append(line, n);
+        if (desc._phase == 'i') {
+            out += ",\"s\":\"t\"";
+        }
+        if (desc._arg_name) {
+            n = snprintf(line, sizeof(line), ",\"args\":{\"fd\":%d,\"%s\":%u}", fd, desc._arg_name, arg);
+            out.append(line, n);
+        }
+        out += "}";
+        first = false;
+    }
+}
+
+std::string FlightRecorder::DumpChromeTrace() {
+    std::lock_guard<std::mutex> lk(_registry_mtx);
+    std::string out = "{\"traceEvents\":[\n";
+    if (!_registry.empty()) {
+        // 距离基准太近时换算误差大, 稍等一下
+        if (steady_ns() - g_base_ns < 10 * 1000 * 1000) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        uint64_t ticks = now_ticks();
+        int64_t ns = steady_ns();
+        double ns_per_tick = ticks > g_base_ticks ? (double)(ns - g_base_ns) / (ticks - g_base_ticks) : 1.0;
+        int pid = getpid();
+        bool first = true;
+        for (auto& rec : _registry) {
+            rec->dump(out, ns_per_tick, g_base_ticks, pid, first);
+        }
+    }
+    out += "\n],\"displayTimeUnit\":\"ns\"}\n";
+    return out;
+}
+
+bool FlightRecorder::DumpChromeTraceToFile(const std::string& path) {
+    std::string json = DumpChromeTrace();
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        perror("open trace file");
+        return false;
+    }
+    bool ok = fwrite(json.data(), 1, json.size(), fp) == json.size();
+    fclose(fp);
+    return ok;
+}
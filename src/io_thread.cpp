@@ -1,31 +1,115 @@
 #include "io_thread.hpp"
 #include "session.hpp"
+#include "coro.hpp"
+#include "logger.hpp"
+#include "msg_dispatcher.hpp"
+#include "udp_channel.hpp"
+#include "flight_recorder.hpp"
+#include "relay.hpp"
+#include "shard.hpp"
+#include "overload.hpp"
+#include "response_cache.hpp"
+#include "compress.hpp"
+#include "journal.hpp"
+#include "configmgr.hpp"
+#include "stage_stats.hpp"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
-IOThread::IOThread(int index) : _event_count(1024), _stop(true), _index(index), _expanded_once(false) {
+static thread_local IOThread* t_current_thread = nullptr;
+
+static int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 最小堆比较函数, 到期时间相同时先加入的先触发
+static bool timer_later(const IOTimer& a, const IOTimer& b) {
+    if (a._deadline != b._deadline) {
+        return a._deadline > b._deadline;
+    }
+    return a._seq > b._seq;
+}
+
+ConfigDerived<LoopBudget>& LoopBudget::slot() {
+    static ConfigDerived<LoopBudget> budget([] {
+        static ConfigKey<int> read_frames("server.read_budget_frames", 64);
+        static ConfigKey<int> read_bytes("server.read_budget_bytes", 256 * 1024);
+        static ConfigKey<int> tasks("server.task_budget", 1024);
+        LoopBudget b;
+        b._read_frames = (uint32_t)std::max(0, read_frames.get());
+        b._read_bytes = (size_t)std::max(0, read_bytes.get());
+        b._tasks = (size_t)std::max(0, tasks.get());
+        return b;
+    });
+    return budget;
+}
+
+IOThread::IOThread(int index) : _exited(false), _heir(nullptr), _dropped_tasks(0), _event_count(1024), _stop(true),
+    _index(index), _expanded_once(false),
+    _load(0), _load_epoch(0), _seen_epoch(0), _session_count(0), _relay_copy(false),
+    _capture_sess(nullptr), _capture_type(-1), _cur_sess(nullptr), _cur_id(0), _cur_seq(0), _cur_tracked(false),
+    _cur_deferred(false),
+    _woke_ns(0), _task_since_ns(0), _task_delay_ns(0), _task_depth(0), _send_bytes(0),
+    _budget(LoopBudget::Inst()), _cfg_version(ConfigMgr::Inst().version()), _pass_frames(0), _pass_bytes(0), _timer_seq(0) {
     _event_fd = eventfd(0, EFD_NONBLOCK);
     if (_event_fd == -1) {
-        perror("eventfd");
+        LOG_ERROR("eventfd: %s", strerror(errno));
         exit(1);
     }
     _epoll_fd = epoll_create1(0);
     if (_epoll_fd == -1) {
-        perror("epoll_create1");
+        LOG_ERROR("epoll_create1: %s", strerror(errno));
         exit(1);
     }
     auto add_res = add_fd(_event_fd, EPOLLIN);
     if (!add_res) {
-        perror("epoll add eventfd failed!\n");
+        LOG_ERROR("epoll add eventfd failed: %s", strerror(errno));
         exit(1);
     }
     _event_addr = (struct epoll_event*)malloc(sizeof(epoll_event) * _event_count);
     if (_event_addr == nullptr) {
-        perror("malloc events failed: ");
+        LOG_ERROR("malloc events failed: %s", strerror(errno));
         exit(1);
     }
+    if (OverloadConfig::Inst().enabled()) {
+        _overload = std::make_unique<OverloadDetector>(index);
+    }
+    if (ResponseCacheConfig::Inst().enabled()) {
+        _cache = std::make_unique<ResponseCache>(ResponseCacheConfig::Inst().max_bytes());
+    }
+    if (JournalConfig::Inst().enabled()) {
+        _journal = Journal::Open();
+        _journal_lane = _journal->open_lane(this);
+    }
 }
 
 IOThread::~IOThread() {
-    std::cout << "IOThread 【" << _index << "】exit" << std::endl;
+    if (_dropped_tasks.load() > 0) {
+        LOG_WARN("IOThread 【%d】dropped %zu tasks enqueued after stop", _index, _dropped_tasks.load());
+    }
+    // 本线程还没交出的记录转交写线程; 最后一个IO线程释放时日志落盘剩余记录后关闭
+    if (_journal_lane) {
+        _journal_lane->close();
+        _journal_lane.reset();
+        _journal.reset();
+    }
+    _udp_channels.clear();
+    while (!_relays.empty()) {
+        auto pair = _relays.begin()->second;
+        close_relay(pair);
+    }
+    _backend_pool.reset();
+    if (_udp_sess) {
+        _udp_sess->_p_ownerthread.store(nullptr, std::memory_order_release);
+    }
+    if (_event_addr) {
+        free(_event_addr);
+        _event_addr = nullptr;
+    }
+    close(_epoll_fd);
+    close(_event_fd);
+    LOG_INFO("IOThread 【%d】exit", _index);
 }
 
 int IOThread::set_nonblocking(int fd)
@@ -37,22 +121,30 @@ int IOThread::set_nonblocking(int fd)
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-void IOThread::enqueue_new_conn(int fd) {
+void IOThread::enqueue_new_conn(int fd, CodecType codec) {
     auto task = std::make_shared<IOTask>(fd, TaskType::RegisterConn);
+    task->_codec = codec;
     enqueue_task(task);
 }
 
-void IOThread::catche_new_conn(int fd) {
+void IOThread::catche_new_conn(int fd, CodecType codec) {
     auto task = std::make_shared<IOTask>(fd, TaskType::RegisterConn);
+    task->_codec = codec;
     {
         std::lock_guard<std::mutex> lk(_task_mtx);
-        _tasks.push(task); 
+        if (_overload && _tasks.empty()) {
+            _task_since_ns = steady_ns();
+        }
+        _tasks.push(task);
     }
 }
 
 void IOThread::start() {
     _stop = false;
-    _thread = std::thread([this]{this->loop();});
+    _thread = std::thread([this] {
+        this->loop();
+        this->after_stop();
+    });
 }
 
 void IOThread::wakeup() {
@@ -60,8 +152,8 @@ void IOThread::wakeup() {
     auto n = write(_event_fd, &one, sizeof(one));
 }
 
+// 通过任务队列通知退出, 保证stop之前入队的任务(例如迁移)都会被处理
 void IOThread::stop() {
-    _stop = true;
     auto task = std::make_shared<IOTask>(_event_fd, TaskType::Shutdown);
     enqueue_task(task);
 }
@@ -70,57 +162,274 @@ void IOThread::join() {
     if (_thread.joinable()) {
         _thread.join();
     }
-    std::cout << "IOThread join exit" << std::endl;
+    LOG_INFO("IOThread join exit");
 }
 
 void IOThread::enqueue_task(std::shared_ptr<IOTask> task) {
     {
         std::lock_guard<std::mutex> lk(_task_mtx);
-        _tasks.push(task);
+        if (!_exited) {
+            if (_overload && _tasks.empty()) {
+                _task_since_ns = steady_ns();
+            }
+            _tasks.push(task);
+            task = nullptr;
+        }
+    }
+    // 其他线程可能在缩容前取到了本线程的指针, 退出后的任务转交继承线程
+    if (task) {
+        forward_task(std::move(task));
+        return;
     }
     wakeup();
 }
 
+void IOThread::after_stop() {
+    // 先断开UDP会话与本线程的关系, 之后发给它们的任务直接丢弃, 不会在线程之间来回转交
+    drop_udp_channels();
+    std::queue<std::shared_ptr<IOTask>> rest;
+    {
+        std::lock_guard<std::mutex> lk(_task_mtx);
+        _exited = true;
+        std::swap(rest, _tasks);
+    }
+    while (!rest.empty()) {
+        forward_task(std::move(rest.front()));
+        rest.pop();
+    }
+}
+
+void IOThread::forward_task(std::shared_ptr<IOTask> task) {
+    IOThread* heir = _heir.load(std::memory_order_acquire);
+    // 退出和迁出任务只对本线程有意义
+    if (heir == nullptr || task->_type == TaskType::Shutdown || task->_type == TaskType::MigrateOut) {
+        if (task->_type != TaskType::Shutdown) {
+            _dropped_tasks.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    heir->enqueue_task(std::move(task));
+}
+
 void IOThread::enqueue_send_data(int fd, const std::string &msg, int msgtype) {
     auto task = std::make_shared<IOTask>(fd, TaskType::SendData, msg, msgtype);
     enqueue_task(task);
 }
 
+void IOThread::enqueue_send_data(std::shared_ptr<Session> sess, const std::string &msg, int msgtype) {
+    // 本线程内的回复不再绕任务队列: TCP直接写或进入发送队列, UDP进入发送批次, 本轮循环结束时统一sendmmsg;
+    // 和缓存命中时直接发出的回复保持同样的顺序
+    if (current() == this) {
+        auto buf = sess->make_send_buf(msgtype, msg, current_request_id(sess.get()));
+        if (!buf) {
+            return;
+        }
+        if (_capture_sess == sess.get()) {
+            if (_capture_type < 0) {
+                _capture_type = msgtype;
+            }
+            _capture.append(buf->_buf, buf->_data_len);
+        }
+        send_reply(sess, buf);
+        return;
+    }
+    auto task = std::make_shared<IOTask>(sess->_fd, TaskType::SendData, msg, msgtype);
+    task->_sess = sess;
+    enqueue_task(task);
+}
+
+void IOThread::enqueue_send_frame(std::shared_ptr<Session> sess, std::shared_ptr<const SharedFrame> frame) {
+    if (current() == this) {
+        auto buf = sess->make_send_buf(*frame);
+        if (!buf) {
+            return;
+        }
+        if (_capture_sess == sess.get()) {
+            if (_capture_type < 0) {
+                _capture_type = frame->type();
+            }
+            _capture.append(buf->_buf, buf->_data_len);
+        }
+        send_reply(sess, buf);
+        return;
+    }
+    auto task = std::make_shared<IOTask>(sess->_fd, TaskType::SendData);
+    task->_sess = sess;
+    task->_frame = std::move(frame);
+    enqueue_task(task);
+}
+
+void IOThread::enqueue_reply(std::shared_ptr<Session> sess, const DeferredReq& req, const std::string& msg, int msgtype) {
+    if (!req._ok) {
+        enqueue_send_data(sess, msg, msgtype);
+        return;
+    }
+    if (current() == this) {
+        finish_deferred(sess, req._id, req._seq, msgtype, msg);
+        return;
+    }
+    auto task = std::make_shared<IOTask>(sess->_fd, TaskType::Reply, msg, msgtype);
+    task->_sess = sess;
+    task->_req_id = req._id;
+    task->_req_seq = req._seq;
+    enqueue_task(task);
+}
+
+void IOThread::migrate_sessions(const std::vector<IOThread*>& targets, uint64_t budget) {
+    auto task = std::make_shared<IOTask>(-1, TaskType::MigrateOut);
+    task->_targets = targets;
+    task->_budget = budget;
+    enqueue_task(task);
+}
+
+void IOThread::add_udp_socket(int fd, int batch, bool gro, bool gso) {
+    run_in_loop([this, fd, batch, gro, gso]() {
+        _udp_channels[fd] = std::make_unique<UdpChannel>(fd, batch, gro, gso);
+        add_fd(fd, EPOLLIN);
+    });
+}
+
+void IOThread::close_udp_sockets() {
+    run_in_loop([this]() {
+        drop_udp_channels();
+    });
+}
+
+void IOThread::drop_udp_channels() {
+    for (auto& kv : _udp_channels) {
+        kv.second->flush();
+        del_fd(kv.first);
+    }
+    // 通道析构时放开保留的会话; 复用的会话对象也指向这些通道, 一起断开
+    _udp_channels.clear();
+    if (_udp_sess) {
+        _udp_sess->_p_ownerthread.store(nullptr, std::memory_order_release);
+        _udp_sess->_udp->_channel = nullptr;
+        _udp_sess.reset();
+    }
+}
+
+void IOThread::enable_relay(const RelayConfig& cfg) {
+    RelayConfig conf = cfg;
+    run_in_loop([this, conf]() {
+        _backend_pool = std::make_unique<BackendPool>(conf);
+        _backend_pool->refill();
+        _relay_copy = conf._copy;
+        if (_relay_copy && _read_buf.size() < 65536) {
+            _read_buf.resize(65536);
+        }
+    });
+}
+
+void IOThread::enable_shard(ShardRouter* router, size_t index) {
+    run_in_loop([this, router, index]() {
+        _shard = std::make_unique<Shard>(router, index);
+    });
+}
+
+void IOThread::update_session_count() {
+    // 中继连接对在_relays中有客户端和后端两项
+    _session_count = _sessions.size() + _relays.size() / 2;
+}
+
+void IOThread::run_in_loop(std::function<void()> func) {
+    auto task = std::make_shared<IOTask>(-1, TaskType::Functor);
+    task->_func = std::move(func);
+    enqueue_task(task);
+}
+
+void IOThread::run_at(std::chrono::steady_clock::time_point deadline, std::function<void()> func) {
+    _timers.push_back(IOTimer{deadline, _timer_seq++, std::move(func)});
+    std::push_heap(_timers.begin(), _timers.end(), timer_later);
+}
+
+void IOThread::run_after(int ms, std::function<void()> func) {
+    run_at(std::chrono::steady_clock::now() + std::chrono::milliseconds(ms), std::move(func));
+}
+
+bool IOThread::overloaded() const {
+    return _overload && _overload->overloaded();
+}
+
+IOThread* IOThread::current() {
+    return t_current_thread;
+}
+
+uint64_t IOThread::sample_load() {
+    _load_epoch.fetch_add(1, std::memory_order_relaxed);
+    return _load.exchange(0, std::memory_order_relaxed);
+}
+
 void IOThread::loop() {
+    t_current_thread = this;
     while (!_stop) {
-        // 无线阻塞 直到有事件
-        int nfds = epoll_wait(_epoll_fd, _event_addr, _event_count, -1);
+        // 没有定时器时无限阻塞 直到有事件
+        TRACE_EVENT(TraceEvent::PollBegin, -1, 0);
+        int nfds = epoll_wait(_epoll_fd, _event_addr, _event_count, next_timeout_ms());
+        TRACE_EVENT(TraceEvent::PollEnd, -1, nfds);
         if (nfds < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            perror("epoll_wait");
+            LOG_ERROR("epoll_wait: %s", strerror(errno));
             break;
         }
 
-        if ((size_t)nfds == _event_count && !_expanded_once) {
-            size_t new_count = _event_count * 2;
+        if (nfds == _event_count && !_expanded_once) {
+            int new_count = _event_count * 2;
             struct epoll_event *new_addr = (struct epoll_event*)malloc(sizeof(epoll_event) * new_count);
             if (!new_addr) {
-                perror("realloc event_addr");
+                LOG_ERROR("realloc event_addr: %s", strerror(errno));
             }
             else {
+                // 本轮的就绪事件还在旧数组里, 先拷贝过去再释放
+                memcpy(new_addr, _event_addr, sizeof(epoll_event) * nfds);
                 free(_event_addr);
                 _event_addr = new_addr;
                 _event_count = new_count;
-                std::cout << "expanded event_addr to " << _event_count << " size";
+                LOG_INFO("expanded event_addr to %d size", _event_count);
             }
             _expanded_once = true;
         }
+        decay_session_load();
+        // 配置重载后在轮首换上新的预算, 不需要暂停线程
+        if (ConfigMgr::Inst().version() != _cfg_version) {
+            _cfg_version = ConfigMgr::Inst().version();
+            _budget = LoopBudget::Inst();
+        }
+        // 上一轮进入就绪列表的连接在本轮最后处理, 本轮新进入的留到下一轮
+        size_t ready_count = _ready.size();
+        if (_overload) {
+            _woke_ns = steady_ns();
+        }
 
+        TRACE_EVENT(TraceEvent::LoopBegin, -1, 0);
         for (int i = 0; i < nfds; i++) {
             int fd = _event_addr[i].data.fd;
             uint32_t evs = _event_addr[i].events;
+            // 中继连接自己处理错误和挂断, 需要先把pipe中剩余的数据搬完
+            if (!_relays.empty()) {
+                auto relay = _relays.find(fd);
+                if (relay != _relays.end()) {
+                    handle_relay(relay->second, fd, evs);
+                    continue;
+                }
+            }
+
+            // UDP socket上的错误只是某个对端的ICMP错误, 由handle_udp处理, 不能关闭
+            if (!_udp_channels.empty()) {
+                auto chan = _udp_channels.find(fd);
+                if (chan != _udp_channels.end()) {
+                    handle_udp(chan->second.get(), evs);
+                    continue;
+                }
+            }
+
             // 表示socket出错或者对端关闭
             if (evs & (EPOLLERR | EPOLLHUP)) {
                 int err = 0, errlen = sizeof(err);
                 getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, (socklen_t*)&errlen);
-                fprintf(stderr, "fd=%d error: %s\n", fd, strerror(err));
+                LOG_WARN("fd=%d error: %s", fd, strerror(err));
                 clear_fd(fd);
                 continue;
             }
@@ -130,62 +439,60 @@ void IOThread::loop() {
                 read(_event_fd, &cnt, sizeof(cnt));
                 auto deal_res = deal_enque_tasks();
                 if (!deal_res) {
-                    std::cout << "io_thread receive exit eventfd" << std::endl;
+                    TRACE_EVENT(TraceEvent::LoopEnd, -1, 0);
+                    LOG_INFO("io_thread receive exit eventfd");
                     return;
                 }
                 continue;
             }
 
             if (evs & (EPOLLIN | EPOLLOUT)) {
-                while(1) {
-                    auto iter = _sessions.find(fd);
-                    if (iter == _sessions.end()) {
+                auto iter = _sessions.find(fd);
+                if (iter == _sessions.end()) {
+                    continue;
+                }
+                auto sess = iter->second;
+                if ((evs & EPOLLIN) && !sess->_read_deferred) {
+                    if (read_session(sess) == IO_ERROR) {
+                        clear_fd(fd);
                         continue;
                     }
-                    auto sess = iter->second;
-                    if (evs & EPOLLIN) {
-                        while(1) {
-                            if (sess->_recv_stage == NO_RECV || sess->_recv_stage == HEAD_RECVING) {
-                                int head_res = read_head_data(sess);
-                                if (head_res == IO_CONTINUE) {
-                                    continue;
-                                }
-                                if (head_res == IO_ERROR) {
-                                    clear_fd(fd);
-                                    break;
-                                }
-                                if (head_res == IO_EAGAIN) {
-                                    break;
-                                }
-                                // 成功则继续轮询
-                                continue;
-                            }
-                            if (sess->_recv_stage == BODY_RECVING) {
-                                int body_res = read_body_data(sess);
-                                if (body_res == IO_CONTINUE) {
-                                    continue;
-                                }
-                                if (body_res == IO_ERROR) {
-                                    clear_fd(fd);
-                                    break;
-                                }
-                                if (body_res == IO_EAGAIN) {
-                                    break;
-                                }
-                                continue;
-                            }
-                        }
-                    }
-                    if (evs & EPOLLOUT) {
-                        if (sess->_send_stage == SENDING) {
-                            continue;
-                        }
-                        handle_epollout(sess);
+                    // 处理过程中连接被关闭或迁走
+                    if (sess->_p_ownerthread.load(std::memory_order_relaxed) != this) {
+                        continue;
                     }
-                    continue;
                 }
+                if ((evs & EPOLLOUT) && sess->_send_stage != SENDING) {
+                    handle_epollout(sess);
+                }
+            }
+        }
+        if (ready_count > 0) {
+            serve_ready(ready_count);
+        }
+        process_timers();
+        // 写线程落盘后会唤醒本线程; 本轮追加的记录在这里统一交给写线程
+        if (_journal_lane) {
+            if (!_journal_waiting.empty()) {
+                drain_journal();
             }
+            _journal_lane->flush();
+        }
+        // 本轮处理函数发出的分片请求在这里统一唤醒目标线程
+        if (_shard) {
+            _shard->poll();
+        }
+        for (auto& kv : _udp_channels) {
+            if (kv.second->has_pending()) {
+                kv.second->flush();
+            }
+        }
+        if (_overload) {
+            sample_overload(true);
+            _task_delay_ns = 0;
+            _task_depth = 0;
         }
+        TRACE_EVENT(TraceEvent::LoopEnd, -1, 0);
     }
 }
 
@@ -195,54 +502,103 @@ void IOThread::loop() {
  *   @brief   private member function
  ************************************/
 bool IOThread::deal_enque_tasks() {
+    STAGE_SCOPE(Stage::Tasks);
     std::queue<std::shared_ptr<IOTask>> q;
+    TRACE_EVENT(TraceEvent::TaskBegin, -1, 0);
     // 拷贝并清空队列
+    int64_t since_ns;
     {
         std::lock_guard<std::mutex> lk(_task_mtx);
         std::swap(q, _tasks);
+        since_ns = _task_since_ns;
+        _task_since_ns = 0;
     }
+    size_t task_count = q.size();
+    if (_overload && since_ns > 0) {
+        _task_delay_ns = std::max(_task_delay_ns, steady_ns() - since_ns);
+        _task_depth = std::max(_task_depth, task_count);
+    }
+    size_t done = 0;
     while (!q.empty()) {
+        // 一次积压了大量任务时分几轮处理, 中间照常处理socket事件
+        if (_budget._tasks && done++ >= _budget._tasks) {
+            requeue_tasks(q, since_ns);
+            break;
+        }
         auto task = q.front();
         q.pop();
         if (task->_type == TaskType::RegisterConn) {
-            // Session和IOThread建立关系
-            auto sess = std::make_shared<Session>(task->_fd, this);
+            if (task->_codec == CodecType::Relay) {
+                add_relay(task->_fd);
+                continue;
+            }
+            // Session和IOThread建立关系; fd被复用, 以前的迁移记录作废
+            _moved_to.erase(task->_fd);
+            auto sess = std::make_shared<Session>(task->_fd, this, GetCodec(task->_codec));
             _sessions[task->_fd] = sess;
+            update_session_count();
             set_nonblocking(task->_fd);
-            add_fd(task->_fd, EPOLLIN | EPOLLOUT);
+            // 回包都是小帧, 关闭Nagle避免与对端延迟确认叠加出40ms的等待
+            int one = 1;
+            setsockopt(task->_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            add_fd(task->_fd, EPOLLIN);
+            if (RateLimitConfig::Inst().enabled()) {
+                sess->_limiter = std::make_unique<SessionLimiter>();
+            }
+#ifdef EVENT_SERVER_COROUTINE
+            spawn_coroutine(sess);
+#endif
             continue;
         }
-        if (task->_type == TaskType::SendData) {
-            auto iter = _sessions.find(task->_fd);
-            if (iter == _sessions.end()) {
-                continue;
-            }
-            auto data_buf = std::make_shared<DataBuf>(task->_msgtype, task->_data, task->_data.size());
-            if (iter->second->_send_stage == SendStage::SENDING) {
-                iter->second->enqueue_data(data_buf);
-                continue;
-            }
-            // 没有数据发送，则直接发送
-            auto send_res = iter->second->send_data(data_buf);
-            if (send_res == IO_ERROR) {
-                _sessions.erase(task->_fd);
-                del_fd(task->_fd);
-                close(task->_fd);
-                continue;
-            }
-            if (send_res == IO_EAGAIN) {
-                mod_fd(task->_fd, EPOLLET | EPOLLIN | EPOLLOUT);
-                continue;
-            }
+        if (task->_type == TaskType::SendData || task->_type == TaskType::Reply) {
+            deal_send_task(task);
+            continue;
+        }
+        if (task->_type == TaskType::MigrateIn) {
+            migrate_in(task->_sess);
+            continue;
+        }
+        if (task->_type == TaskType::MigrateOut) {
+            migrate_out(task->_targets, task->_budget);
+            continue;
+        }
+        if (task->_type == TaskType::Functor) {
+            task->_func();
+            continue;
         }
-
         if (task->_type == TaskType::Shutdown) {
+            _stop = true;
+            // 排在退出任务后面的任务放回队列, 线程退出后转交继承线程
+            if (!q.empty()) {
+                std::lock_guard<std::mutex> lk(_task_mtx);
+                while (!_tasks.empty()) {
+                    q.push(std::move(_tasks.front()));
+                    _tasks.pop();
+                }
+                std::swap(q, _tasks);
+            }
+            TRACE_EVENT(TraceEvent::TaskEnd, -1, task_count);
             return false;
         }
     }
+    TRACE_EVENT(TraceEvent::TaskEnd, -1, task_count);
     return true;
 }
 
+void IOThread::requeue_tasks(std::queue<std::shared_ptr<IOTask>>& rest, int64_t since_ns) {
+    {
+        std::lock_guard<std::mutex> lk(_task_mtx);
+        while (!_tasks.empty()) {
+            rest.push(std::move(_tasks.front()));
+            _tasks.pop();
+        }
+        std::swap(rest, _tasks);
+        // 剩下的任务从最初入队时就在等待
+        _task_since_ns = since_ns > 0 ? since_ns : _task_since_ns;
+    }
+    wakeup();
+}
+
 bool IOThread::add_fd(int fd, int events)
 {
     struct epoll_event ev2{};
@@ -250,9 +606,9 @@ bool IOThread::add_fd(int fd, int events)
     ev2.data.fd = fd;
 
     if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev2) == 0) return true;
-    perror("fd add to epoll failed, try to modify\n");
+    LOG_WARN("fd add to epoll failed, try to modify: %s", strerror(errno));
     if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev2) == -1) {
-        perror("fd modity failed: ");
+        LOG_ERROR("fd modity failed: %s", strerror(errno));
         return false;
     }
     return true;
@@ -264,7 +620,7 @@ bool IOThread::mod_fd(int fd, int events) {
     ev2.data.fd = fd;
 
     if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev2) == -1) {
-        perror("fd modity failed: ");
+        LOG_ERROR("fd modity failed: %s", strerror(errno));
         return false;
     }
     return true;
@@ -272,24 +628,714 @@ bool IOThread::mod_fd(int fd, int events) {
 
 bool IOThread::del_fd(int fd) {
     if (epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1) {
-        perror("fd delete failed: ");
+        LOG_ERROR("fd delete failed: %s", strerror(errno));
         return false;
     }
     return true;
 }
 
+// 按fd发送时最多转交的次数, 超过时认为连接已经关闭
+static const uint8_t kMaxSendHops = 8;
+
+void IOThread::deal_send_task(std::shared_ptr<IOTask> task) {
+    std::shared_ptr<Session> sess = task->_sess;
+    if (sess) {
+        IOThread* owner = sess->_p_ownerthread.load(std::memory_order_acquire);
+        // Session已关闭
+        if (owner == nullptr) {
+            return;
+        }
+        // Session已经迁移到其他线程, 转发给新的属主线程
+        if (owner != this) {
+            owner->enqueue_task(task);
+            return;
+        }
+    }
+    else {
+        auto iter = _sessions.find(task->_fd);
+        if (iter == _sessions.end()) {
+            // 连接迁走了, 按迁移记录转交; 多次迁移时沿着记录走, 次数有上限
+            auto moved = _moved_to.find(task->_fd);
+            if (moved != _moved_to.end() && task->_hops < kMaxSendHops) {
+                task->_hops++;
+                moved->second->enqueue_task(task);
+            }
+            return;
+        }
+        sess = iter->second;
+    }
+    if (task->_type == TaskType::Reply) {
+        finish_deferred(sess, task->_req_id, task->_req_seq, task->_msgtype, task->_data);
+        return;
+    }
+    if (task->_frame) {
+        transmit(sess, sess->make_send_buf(*task->_frame));
+        return;
+    }
+    transmit(sess, sess->make_send_buf(task->_msgtype, task->_data));
+}
+
+void IOThread::transmit(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> buf) {
+    // 连续发出留下的回复时前一帧可能已经因为出错关闭了连接
+    if (!buf || sess->_p_ownerthread.load(std::memory_order_relaxed) != this) {
+        return;
+    }
+    if (sess->_udp) {
+        queue_udp(sess, std::move(buf));
+        return;
+    }
+    send_now(sess, std::move(buf));
+}
+
+int IOThread::send_now(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> data_buf) {
+    STAGE_SCOPE(Stage::Flush);
+    account_load(sess, data_buf->_data_len);
+    if (sess->_send_stage == SendStage::SENDING || !sess->_send_que.empty()) {
+        _send_bytes += data_buf->_data_len;
+        sess->enqueue_data(data_buf);
+        return IO_EAGAIN;
+    }
+    // 没有数据发送，则直接发送
+    auto send_res = sess->send_data(data_buf);
+    if (send_res == IO_ERROR) {
+        clear_fd(sess->_fd);
+        return IO_ERROR;
+    }
+    if (send_res == IO_EAGAIN) {
+        _send_bytes += data_buf->_data_len;
+        TRACE_EVENT(TraceEvent::WriteEagain, sess->_fd, data_buf->_data_len - data_buf->_offset);
+        mod_fd(sess->_fd, session_events(sess, true));
+    }
+    else {
+        TRACE_EVENT(TraceEvent::WriteFlushed, sess->_fd, data_buf->_data_len);
+    }
+    return send_res;
+}
+
+void IOThread::dispatch_frame(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> frame) {
+    STAGE_SCOPE(Stage::Dispatch);
+    _pass_frames++;
+    TRACE_EVENT(TraceEvent::FrameDecoded, sess->_fd, frame->_type);
+    if (frame->_type == FEATURE_MSG_TYPE && sess->_codec == nullptr && !sess->_udp) {
+        negotiate(sess, frame);
+        return;
+    }
+    if (sess->_limiter) {
+        int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t pause_ns = 0;
+        auto policy = sess->_limiter->check(frame->_type, now_ns, pause_ns);
+        if (policy == LimitPolicy::Disconnect) {
+            RateLimitStats::Inst()._disconnected.fetch_add(1, std::memory_order_relaxed);
+            clear_fd(sess->_fd);
+            return;
+        }
+        if (policy == LimitPolicy::Drop) {
+            RateLimitStats::Inst()._dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (policy == LimitPolicy::Pause) {
+            RateLimitStats::Inst()._paused.fetch_add(1, std::memory_order_relaxed);
+            pause_read(sess, std::max<int64_t>(pause_ns, 1));
+        }
+    }
+    // 过载时低优先级消息在进入处理函数之前丢弃, 省下的处理时间留给其他消息;
+    // 一轮处理很久时只在轮末采样来不及, 每帧都采样
+    bool shed = _overload && sample_overload(false) && OverloadConfig::Inst().shed(frame->_type);
+    if (shed) {
+        OverloadStats::Inst()._shed.fetch_add(1, std::memory_order_relaxed);
+    }
+    // 需要落盘的帧以及连接上排在它后面的帧(包括要丢弃的帧和协程会话的帧), 落盘后才交给处理函数
+    if (_journal_lane && (sess->_journal_wait || (!shed && JournalConfig::Inst().journaled(frame->_type)))) {
+        journal_frame(sess, frame, shed);
+        return;
+    }
+    if (shed) {
+        shed_frame(sess, frame);
+        return;
+    }
+    deliver_frame(sess, frame);
+}
+
+void IOThread::shed_frame(std::shared_ptr<Session>& sess, const std::shared_ptr<DataBuf>& frame) {
+    // busy帧也是这个请求的回复, 带上请求id并保持顺序
+    begin_request(sess, frame);
+    reply_busy(sess);
+    end_request(sess);
+}
+
+void IOThread::deliver_frame(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame) {
+#ifdef EVENT_SERVER_COROUTINE
+    // 协程会话: 交给挂起在read_frame上的协程, 没有挂起时先缓存
+    if (sess->_coro) {
+        if (sess->_coro->_done) {
+            return;
+        }
+        sess->_coro->_inbox.push_back(frame);
+        auto waiter = sess->_coro->_read_waiter;
+        if (waiter) {
+            sess->_coro->_read_waiter = nullptr;
+            TRACE_EVENT(TraceEvent::HandlerBegin, sess->_fd, frame->_type);
+            ResumeSession(sess, waiter);
+            TRACE_EVENT(TraceEvent::HandlerEnd, -1, 0);
+        }
+        return;
+    }
+#endif
+    handle_frame(sess, frame);
+}
+
+void IOThread::handle_frame(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame) {
+    begin_request(sess, frame);
+    // 缓存的回复帧是编码好的, 带请求id或协商了压缩的连接不走缓存
+    if (_cache && !sess->_udp && !sess->_req_ext && !sess->_compress &&
+        ResponseCacheConfig::Inst().cacheable(frame->_type)) {
+        dispatch_cached(sess, frame);
+    }
+    else {
+        std::string str(frame->_buf, frame->_data_len);
+        TRACE_EVENT(TraceEvent::HandlerBegin, sess->_fd, frame->_type);
+        MsgDispatcher::Inst().Dispatch(sess, frame->_type, str);
+        TRACE_EVENT(TraceEvent::HandlerEnd, -1, 0);
+    }
+    end_request(sess);
+}
+
+static const ConfigKey<int>& max_inflight() {
+    static ConfigKey<int> key("server.max_inflight", 256);
+    return key;
+}
+
+// 带请求id的连接回复立即发出, 只计异步请求; 按序完成的连接上已完成但还没发出回复的请求也占着槽
+bool IOThread::ordered_replies(const Session* sess) {
+    return !sess->_req_ext && !sess->_udp;
+}
+
+uint32_t IOThread::inflight_count(const Session* sess) {
+    if (!sess->_inflight) {
+        return 0;
+    }
+    return ordered_replies(sess) ? (uint32_t)sess->_inflight->_slots.size() : sess->_inflight->_deferred;
+}
+
+bool IOThread::inflight_full(const std::shared_ptr<Session>& sess) const {
+    int limit = max_inflight().get();
+    // UDP会话的fd是共用的socket, 不能暂停
+    return limit > 0 && !sess->_udp && inflight_count(sess.get()) >= (uint32_t)limit;
+}
+
+uint32_t IOThread::current_request_id(const Session* sess) const {
+    return _cur_sess == sess ? _cur_id : 0;
+}
+
+void IOThread::begin_request(std::shared_ptr<Session>& sess, const std::shared_ptr<DataBuf>& frame) {
+    _cur_sess = sess.get();
+    _cur_id = frame->_req_id;
+    _cur_tracked = false;
+    _cur_deferred = false;
+    if (sess->_inflight && ordered_replies(sess.get())) {
+        sess->_inflight->_slots.emplace_back();
+        _cur_seq = sess->_inflight->_head_seq + (uint32_t)sess->_inflight->_slots.size() - 1;
+        _cur_tracked = true;
+    }
+}
+
+void IOThread::end_request(std::shared_ptr<Session>& sess) {
+    _cur_sess = nullptr;
+    if (_cur_tracked && !_cur_deferred) {
+        complete_slot(sess, _cur_seq);
+    }
+    if (inflight_full(sess) && sess->_p_ownerthread.load(std::memory_order_relaxed) == this) {
+        pause_read(sess, 0);
+    }
+}
+
+DeferredReq IOThread::defer_request(Session* sess) {
+    DeferredReq req;
+    if (_cur_sess != sess || _cur_deferred) {
+        LOG_ERROR("Defer must be called once in handler, fd is %d", sess->_fd);
+        return req;
+    }
+    _cur_deferred = true;
+    if (!sess->_inflight) {
+        sess->_inflight = std::make_unique<InflightState>();
+    }
+    auto& st = *sess->_inflight;
+    // 之前没有未完成的请求, 当前请求就是最早的一个
+    if (!_cur_tracked && ordered_replies(sess)) {
+        st._slots.emplace_back();
+        _cur_seq = st._head_seq + (uint32_t)st._slots.size() - 1;
+        _cur_tracked = true;
+    }
+    st._deferred++;
+    req._id = _cur_id;
+    req._seq = _cur_tracked ? _cur_seq : 0;
+    req._ok = true;
+    return req;
+}
+
+void IOThread::send_reply(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> buf) {
+    if (buf && _cur_sess == sess.get() && _cur_tracked) {
+        auto& st = *sess->_inflight;
+        if (_cur_seq != st._head_seq) {
+            st._slots[_cur_seq - st._head_seq]._held.push_back(std::move(buf));
+            return;
+        }
+    }
+    transmit(sess, std::move(buf));
+}
+
+void IOThread::finish_deferred(std::shared_ptr<Session>& sess, uint32_t req_id, uint32_t seq, int msgtype,
+                               const std::string& msg) {
+    auto buf = sess->make_send_buf(msgtype, msg, req_id);
+    auto& st = sess->_inflight;
+    if (!st || st->_deferred == 0) {
+        LOG_WARN("reply to a request that is not deferred, fd is %d", sess->_fd);
+        transmit(sess, buf);
+        return;
+    }
+    bool was_full = inflight_full(sess);
+    st->_deferred--;
+    if (ordered_replies(sess.get())) {
+        if (seq == st->_head_seq) {
+            transmit(sess, buf);
+        }
+        else if (buf) {
+            st->_slots[seq - st->_head_seq]._held.push_back(std::move(buf));
+        }
+        complete_slot(sess, seq);
+    }
+    else {
+        transmit(sess, buf);
+        if (st->_deferred == 0) {
+            st.reset();
+        }
+    }
+    if (was_full && !inflight_full(sess)) {
+        resume_read(sess);
+    }
+}
+
+void IOThread::complete_slot(std::shared_ptr<Session>& sess, uint32_t seq) {
+    auto& st = *sess->_inflight;
+    st._slots[seq - st._head_seq]._done = true;
+    while (!st._slots.empty() && st._slots.front()._done) {
+        st._slots.pop_front();
+        st._head_seq++;
+        if (st._slots.empty()) {
+            break;
+        }
+        // 新的最早请求之前留下的回复现在可以发出
+        auto held = std::move(st._slots.front()._held);
+        st._slots.front()._held.clear();
+        for (auto& buf : held) {
+            transmit(sess, buf);
+        }
+    }
+    if (st._slots.empty() && st._deferred == 0) {
+        sess->_inflight.reset();
+    }
+}
+
+// 单个连接最多排队的帧数, 超过后暂停读取, 落盘跟不上时积压留在内核缓冲里
+static const size_t kMaxJournalWait = 4096;
+
+void IOThread::journal_frame(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame, bool shed) {
+    std::shared_ptr<JournalChunk> chunk;
+    if (!shed && JournalConfig::Inst().journaled(frame->_type)) {
+        chunk = _journal_lane->append(frame->_type, frame->_buf, frame->_data_len);
+    }
+    if (!sess->_journal_wait) {
+        sess->_journal_wait = std::make_unique<std::deque<JournalWait>>();
+        _journal_waiting.push_back(sess);
+    }
+    sess->_journal_wait->push_back(JournalWait{frame, std::move(chunk), shed});
+    // UDP会话共用监听fd, 不能暂停读取; 每个数据报通常是单独的会话对象, 排队不会太长
+    if (sess->_journal_wait->size() >= kMaxJournalWait && !sess->_udp) {
+        pause_read(sess, 1000000);
+    }
+}
+
+void IOThread::drain_journal() {
+    // 处理函数里可能有会话新加入等待列表, 先换出来, 遍历完再把仍在等待的放回去
+    std::vector<std::shared_ptr<Session>> waiting;
+    waiting.swap(_journal_waiting);
+    size_t keep = 0;
+    for (size_t i = 0; i < waiting.size(); i++) {
+        auto sess = waiting[i];
+        // 关闭的连接丢弃等待的帧(已经落盘, 可以重放); 迁走的连接由新的属主继续处理
+        // 迁走又迁回的连接可能在列表里出现两次
+        if (sess->_p_ownerthread.load(std::memory_order_relaxed) != this || !sess->_journal_wait) {
+            continue;
+        }
+        auto& wait = *sess->_journal_wait;
+        while (!wait.empty() &&
+               (!wait.front()._chunk || wait.front()._chunk->_durable.load(std::memory_order_acquire))) {
+            auto frame = std::move(wait.front()._frame);
+            bool shed = wait.front()._shed;
+            wait.pop_front();
+            if (shed) {
+                shed_frame(sess, frame);
+            }
+            else {
+                deliver_frame(sess, frame);
+            }
+            if (sess->_p_ownerthread.load(std::memory_order_relaxed) != this) {
+                break;
+            }
+        }
+        if (sess->_p_ownerthread.load(std::memory_order_relaxed) != this) {
+            continue;
+        }
+        if (wait.empty()) {
+            sess->_journal_wait.reset();
+            continue;
+        }
+        waiting[keep++] = sess;
+    }
+    waiting.resize(keep);
+    waiting.insert(waiting.end(), std::make_move_iterator(_journal_waiting.begin()),
+                   std::make_move_iterator(_journal_waiting.end()));
+    _journal_waiting.swap(waiting);
+}
+
+void IOThread::dispatch_cached(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame) {
+    auto& stats = ResponseCacheStats::Inst();
+    auto entry = _cache->lookup(sess->_codec, frame->_type, frame->_buf, frame->_data_len);
+    if (entry) {
+        stats._hits.fetch_add(1, std::memory_order_relaxed);
+        auto buf = std::make_shared<DataBuf>(entry->_resp_type, entry->_resp.size());
+        memcpy(buf->_buf, entry->_resp.data(), entry->_resp.size());
+        send_reply(sess, buf);
+        return;
+    }
+    stats._misses.fetch_add(1, std::memory_order_relaxed);
+    std::string str(frame->_buf, frame->_data_len);
+    _capture_sess = sess.get();
+    _capture_type = -1;
+    _capture.clear();
+    TRACE_EVENT(TraceEvent::HandlerBegin, sess->_fd, frame->_type);
+    MsgDispatcher::Inst().Dispatch(sess, frame->_type, str);
+    TRACE_EVENT(TraceEvent::HandlerEnd, -1, 0);
+    _capture_sess = nullptr;
+    // 处理函数没有同步回复(异步回复或不回复)时不缓存, 下次仍然走处理函数
+    if (_capture_type >= 0) {
+        _cache->store(sess->_codec, frame->_type, frame->_buf, frame->_data_len, (uint16_t)_capture_type,
+                      std::move(_capture));
+        _capture = std::string();
+    }
+}
+
+// 本轮就绪的事件已经等了从epoll_wait返回到现在的时间, 队列里的任务等待的时间另外记录
+bool IOThread::sample_overload(bool loop_end) {
+    int64_t now = steady_ns();
+    _overload->sample(now, std::max(now - _woke_ns, _task_delay_ns), loop_end, _task_depth, _send_bytes);
+    return _overload->overloaded();
+}
+
+// 协商应在连接建立后、发出其他请求之前完成; 回复本身已经按新格式编码.
+// 还有未完成的请求、排队的帧或未发完的数据时切换格式会让对端解错, 直接关闭连接
+void IOThread::negotiate(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf>& frame) {
+    bool busy = sess->_inflight || sess->_journal_wait || !sess->_send_que.empty();
+#ifdef EVENT_SERVER_COROUTINE
+    busy = busy || (sess->_coro && !sess->_coro->_inbox.empty());
+#endif
+    if (busy) {
+        LOG_WARN("feature negotiation after other requests, close fd %d", sess->_fd);
+        clear_fd(sess->_fd);
+        return;
+    }
+    uint8_t want = frame->_data_len > 0 ? (uint8_t)frame->_buf[0] : 0;
+    uint8_t accepted = 0;
+    if ((want & FEATURE_COMPRESS) && CompressAccepted()) {
+        accepted |= FEATURE_COMPRESS;
+    }
+    sess->_compress = (accepted & FEATURE_COMPRESS) != 0;
+    begin_request(sess, frame);
+    send_reply(sess, sess->make_send_buf(FEATURE_MSG_TYPE, std::string(1, (char)accepted), frame->_req_id));
+    end_request(sess);
+}
+
+void IOThread::reply_busy(std::shared_ptr<Session>& sess) {
+    uint16_t busy_type = OverloadConfig::Inst().busy_type();
+    if (busy_type == 0) {
+        return;
+    }
+    // HTTP端口的消息类型就是状态码
+    auto buf = sess->make_send_buf(sess->_codec == GetCodec(CodecType::Http) ? 503 : busy_type, "busy",
+                                   current_request_id(sess.get()));
+    send_reply(sess, buf);
+}
+
+int IOThread::next_timeout_ms() {
+    if ((_shard && _shard->busy()) || !_ready.empty()) {
+        return 0;
+    }
+    // 过载期间空闲下来也要定期醒来采样, 否则过载标志一直不会清除, accept也一直暂停
+    int idle_ms = -1;
+    if (_overload && _overload->overloaded()) {
+        idle_ms = (int)(OverloadConfig::Inst().interval_ns() / 1000000);
+    }
+    // 写线程只唤醒追加记录的线程, 迁入的连接等的是原线程的批次, 定期检查
+    if (!_journal_waiting.empty()) {
+        idle_ms = idle_ms >= 0 ? std::min(idle_ms, 10) : 10;
+    }
+    if (_timers.empty()) {
+        return idle_ms;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = _timers.front()._deadline;
+    if (deadline <= now) {
+        return 0;
+    }
+    // 向上取整, 避免提前醒来空转
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count();
+    int timer_ms = (int)((us + 999) / 1000);
+    return idle_ms >= 0 ? std::min(idle_ms, timer_ms) : timer_ms;
+}
+
+void IOThread::process_timers() {
+    auto now = std::chrono::steady_clock::now();
+    while (!_timers.empty() && _timers.front()._deadline <= now) {
+        std::pop_heap(_timers.begin(), _timers.end(), timer_later);
+        IOTimer timer = std::move(_timers.back());
+        _timers.pop_back();
+        timer._func();
+    }
+}
+
+// 迁出: 先从epoll中摘除, 再把Session(包括未收完的头部/包体以及发送队列)整体交给目标线程
+void IOThread::migrate_out(const std::vector<IOThread*>& targets, uint64_t budget) {
+    if (targets.empty()) {
+        return;
+    }
+    std::vector<std::shared_ptr<Session>> sessions;
+    sessions.reserve(_sessions.size());
+    for (auto& kv : _sessions) {
+        sessions.push_back(kv.second);
+    }
+    if (budget > 0) {
+        std::sort(sessions.begin(), sessions.end(), [](const std::shared_ptr<Session>& a, const std::shared_ptr<Session>& b) {
+            return a->_load > b->_load;
+        });
+    }
+
+    uint64_t moved = 0;
+    size_t next = 0;
+    for (auto& sess : sessions) {
+        if (budget > 0) {
+            // 至少保留一个连接, 且不迁移冷连接
+            if (moved >= budget || _sessions.size() <= 1 || sess->_load == 0) {
+                break;
+            }
+            // 单个连接的负载远超剩余额度时, 迁过去只会把热点换个线程
+            if (sess->_load > 2 * (budget - moved)) {
+                continue;
+            }
+        }
+        IOThread* dst = targets[next++ % targets.size()];
+        if (dst == this) {
+            continue;
+        }
+        del_fd(sess->_fd);
+        _sessions.erase(sess->_fd);
+        _send_bytes -= sess->_send_que.bytes();
+        // 就绪列表里的引用留在本线程, 恢复时发现属主已变会跳过; 目标线程靠水平触发的EPOLLIN继续读
+        sess->_read_deferred = false;
+        moved += sess->_load;
+        sess->_p_ownerthread.store(dst, std::memory_order_release);
+        _moved_to[sess->_fd] = dst;
+        auto task = std::make_shared<IOTask>(sess->_fd, TaskType::MigrateIn);
+        task->_sess = sess;
+        dst->enqueue_task(task);
+    }
+    // 全部迁出时中继连接对也一起迁走, 连接池留在本线程随线程销毁
+    if (budget == 0 && !_relays.empty()) {
+        std::vector<std::shared_ptr<RelayPair>> pairs;
+        for (auto& kv : _relays) {
+            if (kv.first == kv.second->_client) {
+                pairs.push_back(kv.second);
+            }
+        }
+        for (auto& pair : pairs) {
+            IOThread* dst = targets[next++ % targets.size()];
+            if (dst == this) {
+                continue;
+            }
+            del_fd(pair->_client);
+            del_fd(pair->_backend);
+            _relays.erase(pair->_client);
+            _relays.erase(pair->_backend);
+            dst->run_in_loop([pair]() {
+                IOThread::current()->adopt_relay(pair);
+            });
+        }
+    }
+    update_session_count();
+    // 全部迁出时定时器也交给存活线程, 绑定Session的定时器到期后会转到Session的新属主执行
+    if (budget == 0 && !_timers.empty()) {
+        IOThread* dst = targets[0] != this ? targets[0] : targets.back();
+        if (dst != this) {
+            auto timers = std::move(_timers);
+            _timers.clear();
+            dst->run_in_loop([timers]() mutable {
+                for (auto& timer : timers) {
+                    IOThread::current()->run_at(timer._deadline, std::move(timer._func));
+                }
+            });
+        }
+    }
+    if (moved > 0 || budget == 0) {
+        LOG_INFO("IOThread 【%d】migrate out load %lu, remain sessions %zu", _index, moved, _sessions.size());
+    }
+}
+
+void IOThread::migrate_in(std::shared_ptr<Session> sess) {
+    _sessions[sess->_fd] = sess;
+    _moved_to.erase(sess->_fd);
+    update_session_count();
+    _send_bytes += sess->_send_que.bytes();
+    if (sess->_journal_wait) {
+        _journal_waiting.push_back(sess);
+    }
+    // 发送队列还有数据时需要关注可写事件, 内核缓冲区中未读的数据会由水平触发的EPOLLIN继续驱动
+    add_fd(sess->_fd, session_events(sess, !sess->_send_que.empty()));
+    // 迁出前_in_buf里剩下的整帧不会再有EPOLLIN来驱动, 放进就绪队列解析
+    if (sess->_codec && sess->_in_buf) {
+        defer_read(sess);
+    }
+}
+
+// 每个采样周期把Session的负载减半, 使得挑选热点时近期的流量占主导
+void IOThread::decay_session_load() {
+    uint32_t epoch = _load_epoch.load(std::memory_order_relaxed);
+    if (epoch == _seen_epoch) {
+        return;
+    }
+    uint32_t shift = std::min<uint32_t>(epoch - _seen_epoch, 63);
+    _seen_epoch = epoch;
+    for (auto& kv : _sessions) {
+        kv.second->_load >>= shift;
+    }
+}
+
+void IOThread::account_load(std::shared_ptr<Session>& sess, size_t bytes) {
+    sess->_load += bytes;
+    _load.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+int IOThread::read_session(std::shared_ptr<Session> sess, bool resume) {
+    STAGE_SCOPE(Stage::Decode);
+    _pass_frames = 0;
+    _pass_bytes = 0;
+    // socket里可能已经没有数据, 不会再有EPOLLIN, 上次剩在_in_buf里的帧要先解析
+    if (resume && sess->_codec && sess->_in_buf && !sess->_read_paused) {
+        int res = decode_codec_data(sess);
+        if (res == IO_ERROR) {
+            return res;
+        }
+        if (res == IO_EAGAIN) {
+            if (read_budget_spent()) {
+                defer_read(sess);
+            }
+            return res;
+        }
+    }
+    while (1) {
+        // 限速暂停后剩余数据留在内核缓冲区
+        if (sess->_read_paused) {
+            return IO_EAGAIN;
+        }
+        // 用完本轮预算, 剩下的数据等其他连接都处理过之后再读
+        if (read_budget_spent()) {
+            defer_read(sess);
+            return IO_EAGAIN;
+        }
+        int res;
+        if (sess->_codec) {
+            res = read_codec_data(sess);
+        }
+        else if (sess->_recv_stage == BODY_RECVING) {
+            res = read_body_data(sess);
+        }
+        else {
+            res = read_head_data(sess);
+        }
+        if (res == IO_CONTINUE || res == IO_SUCCESS) {
+            continue;
+        }
+        // 解析_in_buf时用完预算, 剩余的帧还在_in_buf里
+        if (res == IO_EAGAIN && read_budget_spent()) {
+            defer_read(sess);
+        }
+        // IO_EAGAIN 或 IO_ERROR
+        return res;
+    }
+}
+
+void IOThread::defer_read(std::shared_ptr<Session>& sess) {
+    if (sess->_p_ownerthread.load(std::memory_order_acquire) != this || sess->_read_deferred || sess->_read_paused) {
+        return;
+    }
+    sess->_read_deferred = true;
+    _ready.push_back(sess);
+}
+
+void IOThread::serve_ready(size_t count) {
+    std::vector<std::shared_ptr<Session>> ready(std::make_move_iterator(_ready.begin()),
+                                                std::make_move_iterator(_ready.begin() + count));
+    _ready.erase(_ready.begin(), _ready.begin() + count);
+    for (auto& sess : ready) {
+        // 期间被关闭或迁走; 迁走后_read_deferred归新的属主线程读写, 先确认属主再看
+        if (sess->_p_ownerthread.load(std::memory_order_acquire) != this || !sess->_read_deferred) {
+            continue;
+        }
+        sess->_read_deferred = false;
+        if (read_session(sess, true) == IO_ERROR) {
+            clear_fd(sess->_fd);
+        }
+    }
+}
+
 void IOThread::clear_fd(int fd) {
-    _sessions.erase(fd);
+    std::shared_ptr<Session> sess;
+    auto iter = _sessions.find(fd);
+    if (iter != _sessions.end()) {
+        sess = iter->second;
+        sess->_p_ownerthread.store(nullptr, std::memory_order_release);
+        _sessions.erase(iter);
+        _send_bytes -= sess->_send_que.bytes();
+    }
+    update_session_count();
     del_fd(fd);
     close(fd);
+#ifdef EVENT_SERVER_COROUTINE
+    // 唤醒挂起的协程, read_frame返回关闭, send返回false
+    if (sess && sess->_coro) {
+        sess->_coro->_closed = true;
+        sess->_coro->_send_ok = false;
+        auto reader = sess->_coro->_read_waiter;
+        auto sender = sess->_coro->_send_waiter;
+        sess->_coro->_read_waiter = nullptr;
+        sess->_coro->_send_waiter = nullptr;
+        if (reader) {
+            ResumeSession(sess, reader);
+        }
+        if (sender) {
+            ResumeSession(sess, sender);
+        }
+    }
+#endif
 }
 
 int IOThread::read_head_data(std::shared_ptr<Session> sess) {
     if (sess == nullptr) {
         return -1;
     }
-    int remain = HEAD_LEN - sess->_head_buf->_offset;
-    ssize_t read_len = read(sess->_fd, sess->_head_buf->_buf + sess->_head_buf->_offset, remain);
+    // 用过扩展头部的连接一次读完头部和请求id; 第一次出现标志位时已经读了HEAD_LEN, 接着读请求id
+    size_t head_len = (sess->_req_ext || sess->_head_off >= HEAD_LEN) ? HEAD_LEN + HEAD_REQ_ID_LEN : HEAD_LEN;
+    int remain = head_len - sess->_head_off;
+    ssize_t read_len = read(sess->_fd, sess->_head + sess->_head_off, remain);
     if (read_len < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             return IO_EAGAIN;
@@ -297,93 +1343,345 @@ int IOThread::read_head_data(std::shared_ptr<Session> sess) {
         if (errno == EINTR) {
             return IO_CONTINUE;
         }
-        perror("read header failed: ");
+        LOG_WARN("read header failed: %s", strerror(errno));
         return IO_ERROR;
     }
 
     if (read_len == 0) {
-        std::cout << "read peer closed , fd is " << sess->_fd << std::endl;
+        LOG_DEBUG("read peer closed , fd is %d", sess->_fd);
         return -1;
     }
+    account_load(sess, read_len);
+    _pass_bytes += read_len;
 
+    sess->_head_off += read_len;
     if (read_len < remain) {
         sess->_recv_stage = HEAD_RECVING;
-        sess->_head_buf->_offset += read_len;
         return IO_CONTINUE;
     }
 
-    uint8_t* hdr = (uint8_t*)(sess->_head_buf->_buf);
+    uint8_t* hdr = (uint8_t*)(sess->_head);
     uint16_t t, l;
     memcpy(&t, hdr, sizeof(t));
     memcpy(&l, hdr + 2, sizeof(l));
     uint16_t msg_type = ntohs(t);
-    uint16_t body_len = ntohs(l);
+    uint16_t raw_len = ntohs(l);
+    uint16_t flags = raw_len & HEAD_FLAG_MASK;
+    uint32_t req_id = 0;
+    if (!sess->_compress && !(flags & HEAD_REQ_ID_FLAG)) {
+        // 没有协商也没有扩展头部时长度字段是完整的16位, 超过BUFF_SIZE在下面拒绝
+        flags = 0;
+    }
+    else if ((flags & HEAD_COMPRESS_FLAG) && !sess->_compress) {
+        LOG_WARN("compressed frame before negotiation, fd is %d", sess->_fd);
+        return IO_ERROR;
+    }
+    if (flags & HEAD_REQ_ID_FLAG) {
+        if (sess->_head_off < HEAD_LEN + HEAD_REQ_ID_LEN) {
+            sess->_recv_stage = HEAD_RECVING;
+            return IO_CONTINUE;
+        }
+        uint32_t id;
+        memcpy(&id, hdr + HEAD_LEN, sizeof(id));
+        req_id = ntohl(id);
+        sess->_req_ext = true;
+    }
+    else if (sess->_req_ext) {
+        LOG_WARN("frame without request id after request id header, fd is %d", sess->_fd);
+        return IO_ERROR;
+    }
+    uint16_t body_len = (sess->_req_ext || sess->_compress) ? (raw_len & ~HEAD_FLAG_MASK) : raw_len;
 
     if (body_len > BUFF_SIZE) {
-        std::cout << "msg body too big" << std::endl;
+        LOG_WARN("msg body too big");
         return IO_ERROR;
     }
 
     sess->_recv_stage = BODY_RECVING;
-    sess->_head_buf->_offset += read_len;
     sess->_data_buf = std::make_shared<DataBuf>(msg_type, body_len);
+    sess->_data_buf->_req_id = req_id;
     return IO_CONTINUE;
 }
 
 int IOThread::read_body_data(std::shared_ptr<Session> sess) {
     int remain = sess->_data_buf->_data_len - sess->_data_buf->_offset;
-    ssize_t read_len = read(sess->_fd, sess->_data_buf->_buf + sess->_data_buf->_offset, remain);
+    // 包体长度为0时不需要再读
+    if (remain > 0) {
+        ssize_t read_len = read(sess->_fd, sess->_data_buf->_buf + sess->_data_buf->_offset, remain);
+
+        if (read_len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return IO_EAGAIN;
+            }
+
+            if (errno == EINTR) {
+                return IO_CONTINUE;
+            }
+
+            LOG_WARN("read body: %s", strerror(errno));
+            return IO_ERROR;
+        }
 
+        if (read_len == 0) {
+            return IO_ERROR;
+        }
+
+        account_load(sess, read_len);
+        _pass_bytes += read_len;
+        sess->_data_buf->_offset += read_len;
+        if (read_len < remain) {
+            return IO_CONTINUE;
+        }
+    }
+
+    // 回收消息; 头部在下面清空, 先取出压缩标志
+    auto frame = sess->_data_buf;
+    uint16_t l;
+    memcpy(&l, sess->_head + 2, sizeof(l));
+    bool packed = sess->_compress && (ntohs(l) & HEAD_COMPRESS_FLAG);
+    sess->_data_buf = NULL;
+    sess->_recv_stage = NO_RECV;
+    memset(sess->_head, 0, sizeof(sess->_head));
+    sess->_head_off = 0;
+    if (packed) {
+        frame = InflateFrame(*frame, BUFF_SIZE);
+        if (!frame) {
+            LOG_WARN("inflate frame failed, fd is %d", sess->_fd);
+            return IO_ERROR;
+        }
+    }
+
+    dispatch_frame(sess, frame);
+    // 处理函数关闭或迁走了连接, 停止读取
+    if (sess->_p_ownerthread.load(std::memory_order_relaxed) != this) {
+        return IO_EAGAIN;
+    }
+    return IO_CONTINUE;
+}
+
+// 文本协议: 读入线程共用的_read_buf直接解析, 只有凑不成整帧的残留数据才拷进Session的_in_buf
+int IOThread::read_codec_data(std::shared_ptr<Session> sess) {
+    if (_read_buf.empty()) {
+        _read_buf.resize(CODEC_READ_SIZE);
+    }
+    ssize_t read_len = read(sess->_fd, _read_buf.data(), CODEC_READ_SIZE);
     if (read_len < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             return IO_EAGAIN;
         }
-
         if (errno == EINTR) {
             return IO_CONTINUE;
         }
-
-        perror("read body");
+        LOG_WARN("read codec data: %s", strerror(errno));
         return IO_ERROR;
     }
-
     if (read_len == 0) {
+        LOG_DEBUG("read peer closed , fd is %d", sess->_fd);
         return IO_ERROR;
     }
-
-    sess->_data_buf->_offset += read_len;
-    if (read_len < remain) {
-        return IO_CONTINUE;
+    account_load(sess, read_len);
+    _pass_bytes += read_len;
+    if (sess->_in_buf) {
+        sess->_in_buf->append(_read_buf.data(), read_len);
+        return decode_codec_data(sess);
+    }
+    size_t used = 0;
+    int res = decode_frames(sess, _read_buf.data(), read_len, used);
+    if (res != IO_ERROR && used < (size_t)read_len) {
+        sess->_in_buf = std::make_unique<std::string>(_read_buf.data() + used, read_len - used);
     }
+    return res;
+}
 
-    std::string str(sess->_data_buf->_buf, sess->_data_buf->_data_len);
-    sess->Send(sess->_data_buf->_type, str);
+int IOThread::decode_codec_data(std::shared_ptr<Session>& sess) {
+    std::string& in = *sess->_in_buf;
+    size_t used = 0;
+    int res = decode_frames(sess, in.data(), in.size(), used);
+    if (res == IO_ERROR) {
+        return res;
+    }
+    if (used == in.size()) {
+        // 排空后归还内存, 空闲连接不保留读缓冲
+        sess->_in_buf.reset();
+    }
+    else {
+        in.erase(0, used);
+    }
+    return res;
+}
 
-    // 回收消息
-    sess->_data_buf = NULL;
-    sess->_recv_stage = NO_RECV;
-    memset(sess->_head_buf->_buf, 0, HEAD_LEN);
-    sess->_head_buf->_offset = 0;
+int IOThread::decode_frames(std::shared_ptr<Session>& sess, const char* buf, size_t len, size_t& used) {
+    used = 0;
+    while (used < len) {
+        std::shared_ptr<DataBuf> frame;
+        ssize_t n = sess->_codec->decode(buf + used, len - used, frame);
+        if (n < 0) {
+            LOG_WARN("codec decode failed, fd is %d", sess->_fd);
+            return IO_ERROR;
+        }
+        if (n == 0) {
+            break;
+        }
+        used += n;
+        dispatch_frame(sess, frame);
+        // 处理函数关闭了连接, 被限速暂停, 或者用完了本轮预算, 剩余的帧留在_in_buf中
+        if (sess->_p_ownerthread.load(std::memory_order_relaxed) != this || sess->_read_paused || read_budget_spent()) {
+            return IO_EAGAIN;
+        }
+    }
     return IO_CONTINUE;
 }
 
+void IOThread::pause_read(std::shared_ptr<Session>& sess, int64_t pause_ns) {
+    if (sess->_read_paused) {
+        return;
+    }
+    sess->_read_paused = true;
+    mod_fd(sess->_fd, session_events(sess, !sess->_send_que.empty()));
+    if (pause_ns == 0) {
+        return;
+    }
+    int ms = (int)((pause_ns + 999999) / 1000000);
+    // 定时器可能随线程缩容转交给其他线程, 因此不捕获this
+    run_after(ms, [sess]() {
+        IOThread::current()->resume_read(sess);
+    });
+}
+
+void IOThread::resume_read(std::shared_ptr<Session> sess) {
+    IOThread* owner = sess->_p_ownerthread.load(std::memory_order_acquire);
+    if (owner == nullptr) {
+        return;
+    }
+    // 暂停期间Session被迁走, 到新的属主线程上恢复
+    if (owner != this) {
+        owner->run_in_loop([sess]() {
+            IOThread::current()->resume_read(sess);
+        });
+        return;
+    }
+    // 限速到期时未完成的请求仍然太多, 等请求完成时再恢复
+    if (inflight_full(sess)) {
+        return;
+    }
+    sess->_read_paused = false;
+    mod_fd(sess->_fd, session_events(sess, !sess->_send_que.empty()));
+    // 暂停时已缓存的帧放进就绪队列, 由循环处理; 这里可能在其他会话的处理函数里(同线程完成异步请求), 不能直接分发
+    if (sess->_codec && sess->_in_buf) {
+        defer_read(sess);
+    }
+}
+
+// 每次事件最多收8批, 剩余数据由水平触发的EPOLLIN在下一轮继续处理, 避免UDP洪水饿死其他连接
+void IOThread::handle_udp(UdpChannel* chan, uint32_t evs) {
+    if (evs & EPOLLERR) {
+        // 读出SO_ERROR即清除, 否则水平触发会一直报告
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        getsockopt(chan->fd(), SOL_SOCKET, SO_ERROR, &err, &errlen);
+        if (err != 0) {
+            LOG_WARN("udp fd=%d error: %s", chan->fd(), strerror(err));
+        }
+    }
+    if (!(evs & EPOLLIN)) {
+        return;
+    }
+    for (int round = 0; round < 8; round++) {
+        int n = chan->recv_batch();
+        if (n <= 0) {
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            const char* data = chan->data(i);
+            size_t len = chan->len(i);
+            size_t seg = chan->segment(i);
+            if (seg == 0) {
+                seg = len;
+            }
+            // GRO合并的数据报按分段大小拆开, 每段都是一个独立的数据报
+            for (size_t off = 0; off < len; off += seg) {
+                dispatch_udp(chan, i, data + off, std::min(seg, len - off));
+            }
+        }
+        _load.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+// 一个数据报内可以有多个帧, 格式与TCP相同, 不完整的尾部直接丢弃
+void IOThread::dispatch_udp(UdpChannel* chan, int idx, const char* data, size_t len) {
+    size_t off = 0;
+    while (off + HEAD_LEN <= len) {
+        uint16_t t, l;
+        memcpy(&t, data + off, sizeof(t));
+        memcpy(&l, data + off + 2, sizeof(l));
+        uint16_t msg_type = ntohs(t);
+        uint16_t body_len = ntohs(l);
+        if (off + HEAD_LEN + body_len > len || body_len > BUFF_SIZE) {
+            return;
+        }
+        if (!_udp_sess) {
+            _udp_sess = std::make_shared<Session>(chan->fd(), this);
+            _udp_sess->_udp = std::make_unique<UdpPeer>();
+        }
+        UdpPeer* peer = _udp_sess->_udp.get();
+        peer->_channel = chan;
+        peer->_addr = chan->peer(idx);
+        peer->_addr_len = chan->peer_len(idx);
+        _udp_sess->_fd = chan->fd();
+
+        auto frame = std::make_shared<DataBuf>(msg_type, body_len);
+        memcpy(frame->_buf, data + off + HEAD_LEN, body_len);
+        frame->_offset = body_len;
+        dispatch_frame(_udp_sess, frame);
+        // 处理函数持有了会话(例如稍后异步回复), 下一个数据报换一个新的会话对象
+        if (_udp_sess.use_count() > 1) {
+            chan->retain(_udp_sess);
+            _udp_sess = nullptr;
+        }
+        off += HEAD_LEN + body_len;
+    }
+}
+
+void IOThread::queue_udp(std::shared_ptr<Session>& sess, std::shared_ptr<DataBuf> buf) {
+    UdpPeer* peer = sess->_udp.get();
+    if (peer->_channel == nullptr) {
+        return;
+    }
+    peer->_channel->queue(peer->_addr, peer->_addr_len, std::move(buf));
+}
+
+uint32_t IOThread::session_events(const std::shared_ptr<Session>& sess, bool want_write) {
+    uint32_t events = sess->_read_paused ? 0u : (uint32_t)EPOLLIN;
+    if (want_write) {
+        events |= EPOLLOUT | EPOLLET;
+    }
+    return events;
+}
+
+// 一次EPOLLOUT最多写出的字节数, 大约是一个内核发送缓冲
+static const size_t kFlushBudget = 256 * 1024;
+
 void IOThread::handle_epollout(std::shared_ptr<Session> sess) {
+    STAGE_SCOPE(Stage::Flush);
     sess->_send_stage = SENDING;
     // RAII defer析构执行函数
     Defer defer([sess](){
         sess->_send_stage = NO_SEND;
     });
 
+    size_t flushed = 0;
     while (!sess->_send_que.empty()) {
         auto send_data = sess->_send_que.front();
         while (send_data->_offset < send_data->_data_len) {
             auto write_len = write(sess->_fd, send_data->_buf + send_data->_offset, send_data->_data_len - send_data->_offset);
             if (write_len > 0) {
                 send_data->_offset += write_len;
+                flushed += write_len;
                 continue;
             }
             if (write_len < 0) {
                 if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    TRACE_EVENT(TraceEvent::WriteEagain, sess->_fd, send_data->_data_len - send_data->_offset);
                     return;
                 }
                 if (errno == EINTR) {
@@ -395,11 +1693,174 @@ void IOThread::handle_epollout(std::shared_ptr<Session> sess) {
             clear_fd(sess->_fd);
             return;
         }
+        _send_bytes -= send_data->_data_len;
         sess->_send_que.pop();
+        // 对端读得快时这个循环可以一直写下去, 期间不会读取新请求, 高优先级的回复也就进不了队列;
+        // 每写满一个预算在帧边界让出, 重新MOD会让epoll在下一轮再次报告可写
+        if (flushed >= kFlushBudget && !sess->_send_que.empty()) {
+            mod_fd(sess->_fd, session_events(sess, true));
+            return;
+        }
     }
+    sess->_send_que.release_if_empty();
     // 现在队列里面的数据发完，只有有数据时才需要监听EPOLLOUT（可写）事件
-    struct epoll_event ev;
-    ev.events = EPOLLIN || EPOLLET;
-    ev.data.fd = sess->_fd;
-    epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, sess->_fd, &ev);
+    TRACE_EVENT(TraceEvent::WriteFlushed, sess->_fd, flushed);
+    (void)flushed;
+    mod_fd(sess->_fd, session_events(sess, false));
+#ifdef EVENT_SERVER_COROUTINE
+    if (sess->_coro) {
+        // 先恢复发送状态, 协程恢复后可能立即再次发送
+        sess->_send_stage = NO_SEND;
+        if (sess->_coro->_done) {
+            clear_fd(sess->_fd);
+            return;
+        }
+        auto sender = sess->_coro->_send_waiter;
+        if (sender) {
+            sess->_coro->_send_waiter = nullptr;
+            sess->_coro->_send_ok = true;
+            ResumeSession(sess, sender);
+        }
+    }
+#endif
+}
+
+/************************************
+ *   @section Relay
+ *   @brief   四层中继, 客户端与后端之间用splice搬运数据
+ ************************************/
+void IOThread::add_relay(int client_fd) {
+    int backend = _backend_pool ? _backend_pool->acquire() : -1;
+    if (backend < 0) {
+        LOG_WARN("relay backend unavailable, close fd %d", client_fd);
+        close(client_fd);
+        return;
+    }
+    set_nonblocking(client_fd);
+    int one = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    auto pair = std::make_shared<RelayPair>();
+    pair->_client = client_fd;
+    pair->_backend = backend;
+    if (!_relay_copy) {
+        int c2b[2], b2c[2];
+        if (pipe2(c2b, O_NONBLOCK | O_CLOEXEC) < 0) {
+            LOG_ERROR("relay pipe: %s", strerror(errno));
+            close(client_fd);
+            close(backend);
+            return;
+        }
+        if (pipe2(b2c, O_NONBLOCK | O_CLOEXEC) < 0) {
+            LOG_ERROR("relay pipe: %s", strerror(errno));
+            close(c2b[0]);
+            close(c2b[1]);
+            close(client_fd);
+            close(backend);
+            return;
+        }
+        pair->_c2b._rd = c2b[0];
+        pair->_c2b._wr = c2b[1];
+        pair->_b2c._rd = b2c[0];
+        pair->_b2c._wr = b2c[1];
+    }
+    adopt_relay(pair);
+    // 用掉一条就补一条, 下一个连接仍然不需要等待握手
+    _backend_pool->refill();
+}
+
+void IOThread::adopt_relay(std::shared_ptr<RelayPair> pair) {
+    _relays[pair->_client] = pair;
+    _relays[pair->_backend] = pair;
+    update_session_count();
+    pair->_client_events = 0;
+    pair->_backend_events = 0;
+    update_relay_events(*pair);
+}
+
+void IOThread::handle_relay(std::shared_ptr<RelayPair> pair, int fd, uint32_t evs) {
+    if (evs & EPOLLERR) {
+        close_relay(pair);
+        return;
+    }
+    bool is_client = fd == pair->_client;
+    RelayPipe& in = is_client ? pair->_c2b : pair->_b2c;
+    RelayPipe& out = is_client ? pair->_b2c : pair->_c2b;
+    int peer = is_client ? pair->_backend : pair->_client;
+    // 挂断时读完剩余数据会得到EOF
+    if (evs & (EPOLLIN | EPOLLHUP)) {
+        if (in._eof && (evs & EPOLLHUP)) {
+            close_relay(pair);
+            return;
+        }
+        if (RelayPump(fd, peer, in, _relay_copy, _read_buf) == IO_ERROR) {
+            close_relay(pair);
+            return;
+        }
+    }
+    // fd可写: 把对方方向积压的数据写给fd, 写空后继续从对方读
+    if (evs & EPOLLOUT) {
+        if (RelayPump(peer, fd, out, _relay_copy, _read_buf) == IO_ERROR) {
+            close_relay(pair);
+            return;
+        }
+    }
+    // 后端关闭: 剩余数据交给客户端后整对关闭
+    if (pair->_b2c._eof && pair->_b2c._pending == 0) {
+        close_relay(pair);
+        return;
+    }
+    // 客户端发完: 把半关闭传给后端, 继续转发回包直到后端关闭; 客户端可能还在等回包, 后端连接不能提前交给别人
+    if (pair->_c2b._eof && pair->_c2b._pending == 0 && !pair->_backend_shut) {
+        shutdown(pair->_backend, SHUT_WR);
+        pair->_backend_shut = true;
+    }
+    update_relay_events(*pair);
+}
+
+// 某个方向有积压时停止读源端并关注目的端可写, 形成背压
+void IOThread::update_relay_events(RelayPair& pair) {
+    // EPOLLERR总会上报, 带上它使注册值非0, 0表示还没有加入epoll
+    uint32_t client_ev = EPOLLERR, backend_ev = EPOLLERR;
+    if (pair._c2b._pending == 0 && !pair._c2b._eof) {
+        client_ev |= EPOLLIN;
+    }
+    if (pair._b2c._pending > 0) {
+        client_ev |= EPOLLOUT;
+    }
+    if (pair._b2c._pending == 0 && !pair._b2c._eof) {
+        backend_ev |= EPOLLIN;
+    }
+    if (pair._c2b._pending > 0) {
+        backend_ev |= EPOLLOUT;
+    }
+    if (pair._client_events == 0) {
+        add_fd(pair._client, client_ev);
+    }
+    else if (client_ev != pair._client_events) {
+        mod_fd(pair._client, client_ev);
+    }
+    if (pair._backend_events == 0) {
+        add_fd(pair._backend, backend_ev);
+    }
+    else if (backend_ev != pair._backend_events) {
+        mod_fd(pair._backend, backend_ev);
+    }
+    pair._client_events = client_ev;
+    pair._backend_events = backend_ev;
+}
+
+void IOThread::close_relay(std::shared_ptr<RelayPair>& pair) {
+    auto keep = pair;
+    _relays.erase(keep->_client);
+    _relays.erase(keep->_backend);
+    update_session_count();
+    del_fd(keep->_client);
+    del_fd(keep->_backend);
+    close(keep->_client);
+    close(keep->_backend);
+    for (int fd : {keep->_c2b._rd, keep->_c2b._wr, keep->_b2c._rd, keep->_b2c._wr}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
 }
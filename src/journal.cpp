@@ -0,0 +1,378 @@
+#include "journal.hpp"
+#include "configmgr.hpp"
+#include "io_thread.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <climits>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+JournalConfig::JournalConfig() {
+    auto& cfg = ConfigMgr::Inst();
+    std::stringstream types(cfg.get<std::string>("journal.msg_types", ""));
+    std::string type;
+    while (std::getline(types, type, ',')) {
+        int msg_type = atoi(type.c_str());
+        if (msg_type > 0) {
+            _types.insert((uint16_t)msg_type);
+        }
+    }
+    _dir = cfg.get<std::string>("journal.dir", "journal");
+    _segment_bytes = (size_t)std::max(1, cfg.get<int>("journal.segment_mb", 64)) << 20;
+    _batch_bytes = (size_t)std::max(64, cfg.get<int>("journal.batch_kb", 1024)) << 10;
+}
+
+JournalConfig::JournalConfig(std::unordered_set<uint16_t> types, const std::string& dir)
+    : _types(std::move(types)), _dir(dir), _segment_bytes(64 << 20), _batch_bytes(1024 << 10) {}
+
+JournalConfig& JournalConfig::slot() {
+    static JournalConfig config;
+    return config;
+}
+
+static uint32_t crc32(const char* data, size_t len) {
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        c = table[(c ^ (uint8_t)data[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+void Journal::EncodeRecord(std::string& out, uint16_t type, const char* body, size_t len) {
+    size_t pos = out.size();
+    out.resize(pos + kRecordHead + 2 + len);
+    char* p = &out[pos];
+    uint16_t net_type = htons(type);
+    memcpy(p + kRecordHead, &net_type, 2);
+    memcpy(p + kRecordHead + 2, body, len);
+    uint32_t net_len = htonl((uint32_t)(2 + len));
+    uint32_t net_crc = htonl(crc32(p + kRecordHead, 2 + len));
+    memcpy(p, &net_len, 4);
+    memcpy(p + 4, &net_crc, 4);
+}
+
+JournalLane::JournalLane(Journal* journal, IOThread* owner) : _journal(journal), _owner(owner),
+    _ring(kRingCapacity), _closed(false) {}
+
+const std::shared_ptr<JournalChunk>& JournalLane::append(uint16_t type, const char* body, size_t len) {
+    // 攒满的批次先交出去, 新记录进入新批次
+    if (_chunk && _chunk->_data.size() >= kChunkBytes) {
+        flush();
+    }
+    if (!_chunk) {
+        _chunk = std::make_shared<JournalChunk>();
+    }
+    Journal::EncodeRecord(_chunk->_data, type, body, len);
+    _chunk->_records++;
+    return _chunk;
+}
+
+void JournalLane::flush() {
+    if (_chunk) {
+        _overflow.push_back(std::move(_chunk));
+        _chunk.reset();
+    }
+    bool pushed = false;
+    while (!_overflow.empty() && _ring.push(std::move(_overflow.front()))) {
+        _overflow.pop_front();
+        pushed = true;
+    }
+    if (pushed) {
+        _journal->notify();
+    }
+}
+
+void JournalLane::close() {
+    if (_chunk) {
+        _overflow.push_back(std::move(_chunk));
+        _chunk.reset();
+    }
+    {
+        std::lock_guard<std::mutex> lk(_journal->_mtx);
+        _owner = nullptr;
+        _orphans = std::move(_overflow);
+        _closed = true;
+    }
+    _journal->notify();
+}
+
+static std::weak_ptr<Journal> s_journal;
+static std::mutex s_journal_mtx;
+
+std::shared_ptr<Journal> Journal::Open() {
+    std::lock_guard<std::mutex> lk(s_journal_mtx);
+    auto journal = s_journal.lock();
+    if (!journal) {
+        journal = std::make_shared<Journal>(JournalConfig::Inst());
+        s_journal = journal;
+    }
+    return journal;
+}
+
+std::vector<std::string> Journal::ListSegments(const std::string& dir) {
+    std::vector<std::string> names;
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return names;
+    }
+    while (struct dirent* ent = readdir(d)) {
+        unsigned seq;
+        char tail;
+        if (sscanf(ent->d_name, "journal-%u.lo%c", &seq, &tail) == 2 && tail == 'g') {
+            names.push_back(ent->d_name);
+        }
+    }
+    closedir(d);
+    // 序号定长补零, 按名字排序即按序号排序
+    std::sort(names.begin(), names.end());
+    for (auto& name : names) {
+        name = dir + "/" + name;
+    }
+    return names;
+}
+
+Journal::Journal(const JournalConfig& cfg) : _cfg(cfg), _fd(-1), _segment_seq(0), _segment_size(0),
+    _sleeping(false), _stop(false) {
+    if (mkdir(_cfg.dir().c_str(), 0755) < 0 && errno != EEXIST) {
+        LOG_ERROR("journal mkdir %s failed: %s", _cfg.dir().c_str(), strerror(errno));
+        exit(1);
+    }
+    auto segments = ListSegments(_cfg.dir());
+    if (!segments.empty()) {
+        sscanf(segments.back().c_str() + _cfg.dir().size() + 1, "journal-%u", &_segment_seq);
+    }
+    open_segment();
+    _writer = std::thread(&Journal::writer_loop, this);
+}
+
+Journal::~Journal() {
+    {
+        std::lock_guard<std::mutex> lk(_mtx);
+        _stop = true;
+    }
+    _cv.notify_one();
+    _writer.join();
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+std::shared_ptr<JournalLane> Journal::open_lane(IOThread* owner) {
+    auto lane = std::make_shared<JournalLane>(this, owner);
+    std::lock_guard<std::mutex> lk(_mtx);
+    _lanes.push_back(lane);
+    return lane;
+}
+
+// 生产者先发布批次再读_sleeping, 写线程先置_sleeping再检查各环, 两边的全屏障保证至少一方看到对方
+void Journal::notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lk(_mtx);
+        _cv.notify_one();
+    }
+}
+
+void Journal::open_segment() {
+    if (_fd >= 0) {
+        close(_fd);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/journal-%06u.log", ++_segment_seq);
+    std::string path = _cfg.dir() + name;
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        LOG_ERROR("journal open %s failed: %s", path.c_str(), strerror(errno));
+        exit(1);
+    }
+    _segment_size = 0;
+    // 新文件的目录项也要落盘, 否则崩溃后整个段可能不见
+    int dir_fd = open(_cfg.dir().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    LOG_INFO("journal segment %s opened", path.c_str());
+}
+
+// 各通道轮流取一个批次, 直到取空或凑满batch_bytes; 顺带移除已关闭且取空的通道
+bool Journal::collect(std::vector<std::shared_ptr<JournalChunk>>& batch,
+                      std::vector<std::shared_ptr<JournalLane>>& touched) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    size_t bytes = 0;
+    bool more = true;
+    while (more && bytes < _cfg.batch_bytes()) {
+        more = false;
+        for (auto& lane : _lanes) {
+            std::shared_ptr<JournalChunk> chunk;
+            if (!lane->_ring.pop(chunk)) {
+                if (!lane->_closed || lane->_orphans.empty()) {
+                    continue;
+                }
+                chunk = std::move(lane->_orphans.front());
+                lane->_orphans.pop_front();
+            }
+            bytes += chunk->_data.size();
+            batch.push_back(std::move(chunk));
+            if (std::find(touched.begin(), touched.end(), lane) == touched.end()) {
+                touched.push_back(lane);
+            }
+            more = true;
+        }
+    }
+    _lanes.erase(std::remove_if(_lanes.begin(), _lanes.end(), [](const std::shared_ptr<JournalLane>& lane) {
+        return lane->_closed && lane->_orphans.empty() && lane->_ring.empty();
+    }), _lanes.end());
+    return !batch.empty();
+}
+
+void Journal::write_batch(const std::vector<std::shared_ptr<JournalChunk>>& batch) {
+    std::vector<struct iovec> iov;
+    iov.reserve(batch.size());
+    size_t total = 0;
+    uint64_t records = 0;
+    for (auto& chunk : batch) {
+        iov.push_back({(void*)chunk->_data.data(), chunk->_data.size()});
+        total += chunk->_data.size();
+        records += chunk->_records;
+    }
+    // 写满的段在整批写完后切换, 一批记录不跨段
+    size_t idx = 0;
+    while (idx < iov.size()) {
+        ssize_t n = writev(_fd, &iov[idx], (int)std::min<size_t>(iov.size() - idx, IOV_MAX));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // 磁盘满等错误: 记录还在内存里, 隔一会儿重试, 这期间对应的消息一直不会被处理
+            LOG_ERROR("journal write failed: %s", strerror(errno));
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        while (n > 0) {
+            if ((size_t)n >= iov[idx].iov_len) {
+                n -= iov[idx].iov_len;
+                idx++;
+                continue;
+            }
+            iov[idx].iov_base = (char*)iov[idx].iov_base + n;
+            iov[idx].iov_len -= n;
+            n = 0;
+        }
+    }
+    // fdatasync失败后页缓存里的数据是否落盘无从得知, 不能再确认任何消息
+    if (fdatasync(_fd) < 0) {
+        LOG_ERROR("journal fdatasync failed: %s", strerror(errno));
+        exit(1);
+    }
+    _segment_size += total;
+    auto& stats = JournalStats::Inst();
+    stats._records.fetch_add(records, std::memory_order_relaxed);
+    stats._bytes.fetch_add(total, std::memory_order_relaxed);
+    stats._syncs.fetch_add(1, std::memory_order_relaxed);
+    for (auto& chunk : batch) {
+        chunk->_durable.store(true, std::memory_order_release);
+    }
+    if (_segment_size >= _cfg.segment_bytes()) {
+        open_segment();
+    }
+}
+
+void Journal::writer_loop() {
+    std::vector<std::shared_ptr<JournalChunk>> batch;
+    std::vector<std::shared_ptr<JournalLane>> touched;
+    while (true) {
+        batch.clear();
+        touched.clear();
+        if (collect(batch, touched)) {
+            write_batch(batch);
+            // 关闭的通道不再唤醒, 它的IOThread可能已经析构
+            std::lock_guard<std::mutex> lk(_mtx);
+            for (auto& lane : touched) {
+                if (lane->_owner) {
+                    lane->_owner->wakeup();
+                }
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lk(_mtx);
+        if (_stop && _lanes.empty()) {
+            break;
+        }
+        _sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool pending = false;
+        for (auto& lane : _lanes) {
+            if (!lane->_ring.empty() || (lane->_closed && !lane->_orphans.empty())) {
+                pending = true;
+                break;
+            }
+        }
+        // 兜底超时, 防止漏掉通知
+        if (!pending && !_stop) {
+            _cv.wait_for(lk, std::chrono::milliseconds(10));
+        }
+        _sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+size_t Journal::Replay(const std::string& dir, const std::function<bool(uint16_t, const std::string&)>& cb) {
+    size_t count = 0;
+    std::string data;
+    std::string body;
+    for (auto& path : ListSegments(dir)) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            LOG_ERROR("journal open %s failed: %s", path.c_str(), strerror(errno));
+            continue;
+        }
+        data.clear();
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            data.append(buf, n);
+        }
+        close(fd);
+        size_t pos = 0;
+        while (pos + kRecordHead + 2 <= data.size()) {
+            uint32_t len, crc;
+            memcpy(&len, &data[pos], 4);
+            memcpy(&crc, &data[pos + 4], 4);
+            len = ntohl(len);
+            if (len < 2 || pos + kRecordHead + len > data.size() ||
+                ntohl(crc) != crc32(&data[pos + kRecordHead], len)) {
+                break;
+            }
+            uint16_t type;
+            memcpy(&type, &data[pos + kRecordHead], 2);
+            body.assign(&data[pos + kRecordHead + 2], len - 2);
+            pos += kRecordHead + len;
+            count++;
+            if (!cb(ntohs(type), body)) {
+                return count;
+            }
+        }
+        if (pos != data.size()) {
+            LOG_WARN("journal %s: %zu trailing bytes skipped", path.c_str(), data.size() - pos);
+        }
+    }
+    return count;
+}
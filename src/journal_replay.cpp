@@ -0,0 +1,112 @@
+// 把日志目录里的记录按原顺序重新发给服务器, 经过正常的分发路径交给处理函数
+// 用法: journal_replay <dir> [host=127.0.0.1] [port=12345]
+// 目标服务器不应再对这些消息类型开启日志, 否则重放的记录会被再记一遍
+// 回复在另一个线程里读掉并计数, 不检查内容; 全部发完后半关闭连接, 等服务器关闭后退出
+#include "journal.hpp"
+#include "global.hpp"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+static bool write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return false;
+        }
+        p += w;
+        n -= w;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: journal_replay <dir> [host=127.0.0.1] [port=12345]" << std::endl;
+        return 1;
+    }
+    std::string dir = argv[1];
+    const char* host = argc > 2 ? argv[2] : "127.0.0.1";
+    int port = argc > 3 ? atoi(argv[3]) : 12345;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("journal_replay connect");
+        return 1;
+    }
+
+    size_t replies = 0;
+    std::thread reader([fd, &replies] {
+        char buf[65536];
+        std::string pending;
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            pending.append(buf, n);
+            size_t pos = 0;
+            while (pending.size() - pos >= HEAD_LEN) {
+                uint16_t len;
+                memcpy(&len, &pending[pos + 2], 2);
+                size_t frame_len = HEAD_LEN + (size_t)ntohs(len);
+                if (pending.size() - pos < frame_len) {
+                    break;
+                }
+                pos += frame_len;
+                replies++;
+            }
+            pending.erase(0, pos);
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::string batch;
+    size_t bytes = 0;
+    size_t skipped = 0;
+    bool ok = true;
+    size_t records = Journal::Replay(dir, [&](uint16_t type, const std::string& body) {
+        // 二进制帧的长度字段只有16位
+        if (body.size() > 65535) {
+            skipped++;
+            return true;
+        }
+        uint16_t net_type = htons(type);
+        uint16_t net_len = htons((uint16_t)body.size());
+        batch.append((const char*)&net_type, 2);
+        batch.append((const char*)&net_len, 2);
+        batch += body;
+        if (batch.size() >= 64 * 1024) {
+            ok = write_all(fd, batch.data(), batch.size());
+            bytes += batch.size();
+            batch.clear();
+        }
+        return ok;
+    });
+    if (ok && !batch.empty()) {
+        ok = write_all(fd, batch.data(), batch.size());
+        bytes += batch.size();
+    }
+    shutdown(fd, SHUT_WR);
+    reader.join();
+    close(fd);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("replayed %zu records (%zu skipped), %zu bytes in %.3f s, %zu replies\n", records - skipped, skipped,
+           bytes, secs, replies);
+    if (!ok) {
+        std::cerr << "connection closed before all records were sent" << std::endl;
+        return 1;
+    }
+    return 0;
+}
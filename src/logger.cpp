@@ -0,0 +1,410 @@
+#include "logger.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic<int> Logger::s_level{(int)LogLevel::Info};
+std::atomic<uint64_t> Logger::s_coarse_ms{0};
+
+// 记录头: 时间(纳秒) + 格式串指针 + 被抑制条数 + 线程id + 级别 + 参数个数
+static const size_t kHeadLen = 8 + sizeof(const char*) + 4 + 4 + 1 + 1;
+// 环内每条记录前有4字节长度, 按8字节对齐; 长度为kWrap表示环尾剩余空间跳过
+static const uint32_t kWrap = 0xFFFFFFFF;
+// 刷新线程的轮询间隔
+static const int kFlushIntervalMs = 10;
+
+static uint64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 单生产者单消费者的字节环, 生产者是所属线程, 消费者是刷新线程
+class LogRing {
+public:
+    static const size_t kCapacity = 1 << 18;
+
+    LogRing() : _head(0), _tail(0), _dropped(0), _in_use(false), _buf(new char[kCapacity]) {}
+
+    bool push(const char* data, size_t len) {
+        size_t total = (len + 4 + 7) & ~(size_t)7;
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        uint64_t tail = _tail.load(std::memory_order_acquire);
+        size_t pos = head & (kCapacity - 1);
+        size_t skip = kCapacity - pos < total ? kCapacity - pos : 0;
+        if (head + skip + total - tail > kCapacity) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (skip) {
+            memcpy(_buf.get() + pos, &kWrap, 4);
+            head += skip;
+            pos = 0;
+        }
+        uint32_t n = (uint32_t)len;
+        memcpy(_buf.get() + pos, &n, 4);
+        memcpy(_buf.get() + pos + 4, data, len);
+        _head.store(head + total, std::memory_order_release);
+        return true;
+    }
+
+    // 收集所有已提交的记录, 返回新的读位置; 格式化完之后再commit, 在此之前记录内存不会被覆盖
+    template <typename Func>
+    uint64_t peek(Func&& func) {
+        uint64_t tail = _tail.load(std::memory_order_relaxed);
+        uint64_t head = _head.load(std::memory_order_acquire);
+        while (tail < head) {
+            size_t pos = tail & (kCapacity - 1);
+            uint32_t n;
+            memcpy(&n, _buf.get() + pos, 4);
+            if (n == kWrap) {
+                tail += kCapacity - pos;
+                continue;
+            }
+            func(_buf.get() + pos + 4, n);
+            tail += (n + 4 + 7) & ~(size_t)7;
+        }
+        return tail;
+    }
+    void commit(uint64_t tail) {
+        _tail.store(tail, std::memory_order_release);
+    }
+
+    std::atomic<uint64_t> _head;
+    std::atomic<uint64_t> _tail;
+    std::atomic<uint64_t> _dropped;
+    std::atomic<bool> _in_use;          // 有线程正在使用, 线程退出后环留给之后创建的线程复用
+private:
+    std::unique_ptr<char[]> _buf;
+};
+
+// 线程退出时归还环, 环里没刷出的记录带有各自的线程id, 不受复用影响
+struct LogRingHolder {
+    LogRing* _ring = nullptr;
+    int _tid = 0;
+    ~LogRingHolder() {
+        if (_ring) {
+            _ring->_in_use.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local LogRingHolder t_ring;
+
+class LogFlusher {
+public:
+    static LogFlusher& Inst() {
+        // 不析构: 进程退出时其他线程可能还在写日志
+        static LogFlusher* inst = new LogFlusher();
+        return *inst;
+    }
+
+    LogRing* acquire_ring() {
+        std::lock_guard<std::mutex> lk(_mtx);
+        LogRing* ring = nullptr;
+        for (auto& r : _rings) {
+            if (!r->_in_use.load(std::memory_order_acquire)) {
+                ring = r.get();
+                break;
+            }
+        }
+        if (ring == nullptr) {
+            _rings.emplace_back(new LogRing());
+            ring = _rings.back().get();
+        }
+        ring->_in_use.store(true, std::memory_order_relaxed);
+        start_locked();
+        return ring;
+    }
+
+    bool set_output(const std::string& path) {
+        int fd = STDOUT_FILENO;
+        if (!path.empty()) {
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                perror("open log file");
+                return false;
+            }
+        }
+        std::lock_guard<std::mutex> lk(_mtx);
+        // 先把已有记录写到旧的输出
+        flush_locked();
+        if (_fd != STDOUT_FILENO) {
+            close(_fd);
+        }
+        _fd = fd;
+        return true;
+    }
+
+    void shutdown() {
+        std::thread thr;
+        {
+            std::lock_guard<std::mutex> lk(_mtx);
+            _stop = true;
+            thr = std::move(_thread);
+        }
+        _cv.notify_all();
+        if (thr.joinable()) {
+            thr.join();
+        }
+        std::lock_guard<std::mutex> lk(_mtx);
+        flush_locked();
+    }
+
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> lk(_mtx);
+        uint64_t n = 0;
+        for (auto& r : _rings) {
+            n += r->_dropped.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+private:
+    LogFlusher() : _fd(STDOUT_FILENO), _stop(false), _started(false), _reported_dropped(0) {
+        Logger::s_coarse_ms.store(steady_ms(), std::memory_order_relaxed);
+    }
+
+    void start_locked() {
+        if (_started) {
+            return;
+        }
+        _started = true;
+        _thread = std::thread([this] { run(); });
+        atexit(Logger::Shutdown);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lk(_mtx);
+        while (!_stop) {
+            Logger::s_coarse_ms.store(steady_ms(), std::memory_order_relaxed);
+            flush_locked();
+            _cv.wait_for(lk, std::chrono::milliseconds(kFlushIntervalMs));
+        }
+    }
+
+    // 各线程的记录按时间归并后输出, 同一批内跨线程的先后顺序与发生顺序一致
+    void flush_locked() {
+        _pending.clear();
+        _tails.clear();
+        for (auto& r : _rings) {
+            _tails.push_back(r->peek([this](const char* rec, size_t len) {
+                int64_t ns;
+                memcpy(&ns, rec, 8);
+                _pending.push_back(PendingRecord{ns, rec, len});
+            }));
+        }
+        std::stable_sort(_pending.begin(), _pending.end(),
+                         [](const PendingRecord& a, const PendingRecord& b) { return a._ns < b._ns; });
+        for (auto& rec : _pending) {
+            format(rec._rec, rec._len);
+        }
+        for (size_t i = 0; i < _tails.size(); i++) {
+            _rings[i]->commit(_tails[i]);
+        }
+        uint64_t dropped = 0;
+        for (auto& r : _rings) {
+            dropped += r->_dropped.load(std::memory_order_relaxed);
+        }
+        if (dropped != _reported_dropped) {
+            char line[96];
+            int n = snprintf(line, sizeof(line), "logger dropped %llu records, ring full\n",
+                             (unsigned long long)(dropped - _reported_dropped));
+            _out.append(line, n);
+            _reported_dropped = dropped;
+        }
+        const char* p = _out.data();
+        size_t left = _out.size();
+        while (left > 0) {
+            ssize_t w = ::write(_fd, p, left);
+            if (w <= 0) {
+                break;
+            }
+            p += w;
+            left -= w;
+        }
+        _out.clear();
+    }
+
+    void format(const char* rec, size_t len);
+
+    std::mutex _mtx;                            // 保护_rings和输出, 只在创建环和刷新时使用
+    std::condition_variable _cv;
+    std::vector<std::unique_ptr<LogRing>> _rings;
+    struct PendingRecord {
+        int64_t _ns;
+        const char* _rec;
+        size_t _len;
+    };
+    std::vector<PendingRecord> _pending;
+    std::vector<uint64_t> _tails;
+    std::string _out;
+    int _fd;
+    bool _stop;
+    bool _started;
+    uint64_t _reported_dropped;
+    std::thread _thread;
+};
+
+static const char* level_name(int level) {
+    static const char* names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+    return level >= 0 && level < 4 ? names[level] : "?";
+}
+
+// 按格式串逐个转换说明取参数; 长度修饰符按实际存储的类型重写, 所以%d打印long也没问题
+void LogFlusher::format(const char* rec, size_t len) {
+    int64_t ns;
+    const char* fmt;
+    uint32_t suppressed;
+    int tid;
+    memcpy(&ns, rec, 8);
+    memcpy(&fmt, rec + 8, sizeof(fmt));
+    memcpy(&suppressed, rec + 8 + sizeof(fmt), 4);
+    memcpy(&tid, rec + 12 + sizeof(fmt), 4);
+    int level = (uint8_t)rec[8 + sizeof(fmt) + 8];
+    const char* arg = rec + kHeadLen;
+    const char* end = rec + len;
+
+    char tmp[64];
+    time_t sec = ns / 1000000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    size_t n = strftime(tmp, sizeof(tmp), "%Y-%m-%d %H:%M:%S", &tm);
+    _out.append(tmp, n);
+    n = snprintf(tmp, sizeof(tmp), ".%06d %-5s [%d] ", (int)(ns % 1000000000 / 1000), level_name(level), tid);
+    _out.append(tmp, n);
+
+    for (const char* p = fmt; *p; p++) {
+        if (*p != '%') {
+            _out += *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            _out += '%';
+            p++;
+            continue;
+        }
+        // 拆出标志/宽度/精度和转换字符, 丢掉长度修饰符
+        std::string spec = "%";
+        const char* q = p + 1;
+        while (*q && strchr("-+ #0123456789.", *q)) {
+            spec += *q++;
+        }
+        while (*q && strchr("hlLqjzt", *q)) {
+            q++;
+        }
+        char conv = *q;
+        if (conv == 0) {
+            break;
+        }
+        p = q;
+        if (arg >= end) {
+            _out += "<missing>";
+            continue;
+        }
+        char tag = *arg++;
+        char val[256];
+        int vn = 0;
+        if (tag == 's') {
+            uint16_t slen;
+            memcpy(&slen, arg, 2);
+            std::string s(arg + 2, slen);
+            arg += 2 + slen;
+            spec += 's';
+            vn = snprintf(val, sizeof(val), spec.c_str(), s.c_str());
+            if (vn >= (int)sizeof(val)) {
+                _out += s;
+                continue;
+            }
+        }
+        else if (tag == 'f') {
+            double d;
+            memcpy(&d, arg, 8);
+            arg += 8;
+            spec += strchr("eEfgGaA", conv) ? conv : 'g';
+            vn = snprintf(val, sizeof(val), spec.c_str(), d);
+        }
+        else {
+            uint64_t u;
+            memcpy(&u, arg, 8);
+            arg += 8;
+            if (conv == 'c') {
+                spec += 'c';
+                vn = snprintf(val, sizeof(val), spec.c_str(), (int)u);
+            }
+            else if (conv == 'p') {
+                // 指针按十六进制输出, 和printf的%p一致
+                spec += u ? "#llx" : "s";
+                vn = u ? snprintf(val, sizeof(val), spec.c_str(), (unsigned long long)u)
+                       : snprintf(val, sizeof(val), spec.c_str(), "(nil)");
+            }
+            else {
+                spec += "ll";
+                spec += strchr("diouxX", conv) ? conv : (tag == 'i' ? 'd' : 'u');
+                vn = snprintf(val, sizeof(val), spec.c_str(), (long long)u);
+            }
+        }
+        _out.append(val, std::min(vn, (int)sizeof(val) - 1));
+    }
+    if (suppressed > 0) {
+        n = snprintf(tmp, sizeof(tmp), " (suppressed %u similar)", suppressed);
+        _out.append(tmp, n);
+    }
+    _out += '\n';
+}
+
+bool Logger::Init(const std::string& path, LogLevel level) {
+    SetLevel(level);
+    return LogFlusher::Inst().set_output(path);
+}
+
+LogLevel Logger::ParseLevel(const std::string& name, LogLevel def) {
+    static const char* names[] = {"debug", "info", "warn", "error", "off"};
+    for (int i = 0; i < 5; i++) {
+        if (name == names[i]) {
+            return (LogLevel)i;
+        }
+    }
+    return def;
+}
+
+void Logger::Shutdown() {
+    LogFlusher::Inst().shutdown();
+}
+
+uint64_t Logger::Dropped() {
+    return LogFlusher::Inst().dropped();
+}
+
+size_t Logger::encode_head(char* buf, LogLevel level, uint32_t suppressed, const char* fmt, size_t nargs) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    memcpy(buf, &ns, 8);
+    memcpy(buf + 8, &fmt, sizeof(fmt));
+    memcpy(buf + 8 + sizeof(fmt), &suppressed, 4);
+    if (t_ring._tid == 0) {
+        t_ring._tid = (int)syscall(SYS_gettid);
+    }
+    memcpy(buf + 12 + sizeof(fmt), &t_ring._tid, 4);
+    buf[8 + sizeof(fmt) + 8] = (char)level;
+    buf[8 + sizeof(fmt) + 9] = (char)nargs;
+    return kHeadLen;
+}
+
+void Logger::push(const char* buf, size_t len) {
+    LogRing* ring = t_ring._ring;
+    if (ring == nullptr) {
+        ring = LogFlusher::Inst().acquire_ring();
+        t_ring._ring = ring;
+    }
+    ring->push(buf, len);
+}
@@ -0,0 +1,218 @@
+#include "lz_codec.hpp"
+#include <cstdint>
+#include <cstring>
+
+// 序列格式: [token][字面量长度扩展][字面量][2字节小端偏移][匹配长度扩展], token高4位字面量长度, 低4位匹配长度-4,
+// 取15时后面跟若干字节累加(遇到非255的字节结束); 最后一个序列只有字面量
+static const int kHashLog = 12;
+static const size_t kMinMatch = 4;
+static const size_t kLastLiterals = 5;      // 块的最后5个字节总是字面量
+static const size_t kMfLimit = 12;          // 最后一个匹配至少在块尾12字节之前开始
+static const size_t kMaxOffset = 65535;
+static const size_t kShortCopy = 16;
+// 连续这么多次(按64为单位递增)找不到匹配时加大步长, 不可压缩的数据很快扫完
+static const int kSkipTrigger = 6;
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 从p和ref开始的公共长度, p不超过limit; 小端机器上每次比较8字节, 第一个不同的字节由末尾0的个数得出
+static inline size_t common_len(const uint8_t* p, const uint8_t* ref, const uint8_t* limit) {
+    const uint8_t* start = p;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (p + 8 <= limit) {
+        uint64_t diff = read64(p) ^ read64(ref);
+        if (diff != 0) {
+            return p - start + (__builtin_ctzll(diff) >> 3);
+        }
+        p += 8;
+        ref += 8;
+    }
+#endif
+    while (p < limit && *p == *ref) {
+        p++;
+        ref++;
+    }
+    return p - start;
+}
+
+static inline uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - kHashLog);
+}
+
+// 长度扩展字节: 先写掉15, 再按255一段写
+static inline uint8_t* write_len(uint8_t* op, size_t len) {
+    len -= 15;
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static inline uint8_t* write_literals(uint8_t* op, const uint8_t* lit, size_t len, uint8_t* token) {
+    if (len >= 15) {
+        *token = 15 << 4;
+        op = write_len(op, len);
+    }
+    else {
+        *token = (uint8_t)(len << 4);
+    }
+    memcpy(op, lit, len);
+    return op + len;
+}
+
+size_t lz_compress(const char* src, size_t n, char* dst, size_t cap) {
+    const uint8_t* base = (const uint8_t*)src;
+    const uint8_t* ip = base;
+    const uint8_t* end = base + n;
+    const uint8_t* anchor = base;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* oend = op + cap;
+
+    if (n > kMfLimit) {
+        uint32_t table[1 << kHashLog];
+        memset(table, 0, sizeof(table));
+        const uint8_t* mflimit = end - kMfLimit;
+        const uint8_t* matchlimit = end - kLastLiterals;
+        ip++;
+        uint32_t misses = 1 << kSkipTrigger;
+        while (ip < mflimit) {
+            uint32_t h = hash4(read32(ip));
+            const uint8_t* ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+            if (ref >= ip || (size_t)(ip - ref) > kMaxOffset || read32(ref) != read32(ip)) {
+                ip += misses++ >> kSkipTrigger;
+                continue;
+            }
+            misses = 1 << kSkipTrigger;
+            // 向前扩展到上一个序列的末尾
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t* mp = ip + kMinMatch;
+            mp += common_len(mp, ref + kMinMatch, matchlimit);
+            size_t lit = ip - anchor;
+            size_t mlen = mp - ip - kMinMatch;
+            if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1) {
+                return 0;
+            }
+            uint8_t* token = op++;
+            op = write_literals(op, anchor, lit, token);
+            size_t off = ip - ref;
+            *op++ = (uint8_t)off;
+            *op++ = (uint8_t)(off >> 8);
+            if (mlen >= 15) {
+                *token |= 15;
+                op = write_len(op, mlen);
+            }
+            else {
+                *token |= (uint8_t)mlen;
+            }
+            ip = mp;
+            anchor = ip;
+            // 匹配末尾附近的位置也进表, 连续的重复内容能接着匹配
+            if (ip < mflimit) {
+                table[hash4(read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+            }
+        }
+    }
+    size_t lit = end - anchor;
+    if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit) {
+        return 0;
+    }
+    uint8_t* token = op++;
+    op = write_literals(op, anchor, lit, token);
+    return op - (uint8_t*)dst;
+}
+
+// 读长度扩展字节, 越界返回false
+static inline bool read_len(const uint8_t*& ip, const uint8_t* iend, size_t& len) {
+    uint8_t b;
+    do {
+        if (ip >= iend) {
+            return false;
+        }
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+ssize_t lz_decompress(const char* src, size_t n, char* dst, size_t cap) {
+    const uint8_t* ip = (const uint8_t*)src;
+    const uint8_t* iend = ip + n;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* ostart = op;
+    uint8_t* oend = op + cap;
+    while (true) {
+        if (ip >= iend) {
+            return -1;
+        }
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && !read_len(ip, iend, lit)) {
+            return -1;
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) {
+            return -1;
+        }
+        // 短字面量按固定16字节复制, 多写的部分会被后面的内容覆盖
+        if (lit <= kShortCopy && (size_t)(iend - ip) >= kShortCopy && (size_t)(oend - op) >= kShortCopy) {
+            memcpy(op, ip, kShortCopy);
+        }
+        else {
+            memcpy(op, ip, lit);
+        }
+        op += lit;
+        ip += lit;
+        if (ip == iend) {
+            break;
+        }
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - ostart)) {
+            return -1;
+        }
+        size_t mlen = token & 15;
+        if (mlen == 15 && !read_len(ip, iend, mlen)) {
+            return -1;
+        }
+        mlen += kMinMatch;
+        if (mlen > (size_t)(oend - op)) {
+            return -1;
+        }
+        const uint8_t* m = op - off;
+        if (off >= kShortCopy && mlen <= kShortCopy && (size_t)(oend - op) >= kShortCopy) {
+            memcpy(op, m, kShortCopy);
+        }
+        else {
+            // 偏移小于长度时源和目标重叠, 内容以off为周期重复: 每次复制已经展开的整段, 长度逐次翻倍
+            uint8_t* d = op;
+            size_t left = mlen;
+            while (left > (size_t)(d - m)) {
+                size_t step = d - m;
+                memcpy(d, m, step);
+                d += step;
+                left -= step;
+            }
+            memcpy(d, m, left);
+        }
+        op += mlen;
+    }
+    return op - ostart;
+}
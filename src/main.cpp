@@ -1,5 +1,12 @@
 #include "configmgr.hpp"
 #include "server.hpp"
+#include "session.hpp"
+#include "msg_dispatcher.hpp"
+#include "rate_limiter.hpp"
+#include "flight_recorder.hpp"
+#include "journal.hpp"
+#include "compress.hpp"
+#include "logger.hpp"
 #include <csignal>
 
 static Server* g_server = nullptr;
@@ -11,18 +18,78 @@ void signal_handler(int signal) {
     }
 }
 
+// SIGHUP重新加载配置文件
+void reload_signal_handler(int) {
+    if (g_server) {
+        g_server->request_reload();
+    }
+}
+
+// SIGUSR2导出飞行记录器, 需要以EVENT_SERVER_TRACE编译
+void trace_signal_handler(int) {
+    if (g_server) {
+        g_server->request_trace_dump();
+    }
+}
+
+// HTTP端口上的健康检查/管理请求, 帧内容为"METHOD TARGET\n" + 包体
+static void handle_http(std::shared_ptr<Session> sess, uint16_t /*msg_type*/, const std::string& body) {
+    std::string request_line = body.substr(0, body.find('\n'));
+    if (request_line == "GET /health") {
+        sess->Send(200, "ok\n");
+        return;
+    }
+    if (request_line == "GET /stats") {
+        auto& limit = RateLimitStats::Inst();
+        std::string out;
+        out += "ratelimit.paused " + std::to_string(limit._paused.load()) + "\n";
+        out += "ratelimit.dropped " + std::to_string(limit._dropped.load()) + "\n";
+        out += "ratelimit.disconnected " + std::to_string(limit._disconnected.load()) + "\n";
+        auto& journal = JournalStats::Inst();
+        out += "journal.records " + std::to_string(journal._records.load()) + "\n";
+        out += "journal.syncs " + std::to_string(journal._syncs.load()) + "\n";
+        auto& comp = CompressStats::Inst();
+        out += "compress.frames " + std::to_string(comp._frames.load()) + "\n";
+        out += "compress.raw_bytes " + std::to_string(comp._raw_bytes.load()) + "\n";
+        out += "compress.wire_bytes " + std::to_string(comp._wire_bytes.load()) + "\n";
+        out += "compress.skipped " + std::to_string(comp._skipped.load()) + "\n";
+        out += "compress.inflated " + std::to_string(comp._inflated.load()) + "\n";
+        sess->Send(200, out);
+        return;
+    }
+    if (request_line == "GET /trace") {
+        // 导出要等待时钟换算稳定并格式化所有记录, 交给accept线程, 完成后再回复, 不阻塞这个IO线程上的其他连接
+        auto req = sess->Defer();
+        g_server->run_in_accept_thread([sess, req]() {
+            sess->Reply(req, 200, FlightRecorder::DumpChromeTrace());
+        });
+        return;
+    }
+    sess->Send(404, "not found\n");
+}
+
 int main() {
     ConfigMgr& cfg = ConfigMgr::Inst();
     if (!cfg.loadFromFile("ini/config.ini")) {
         std::cerr << "Failed to load config.ini\n";
         return 1;
     }
+    // 日志写到后台线程, 文件为空时输出到标准输出
+    auto level = Logger::ParseLevel(cfg.get<std::string>("log.level", "info"), LogLevel::Info);
+    if (!Logger::Init(cfg.get<std::string>("log.file", ""), level)) {
+        return 1;
+    }
     int port = cfg.get<int>("server.port", 12345);
     std::cout << "server.port= " << port << std::endl;
+    MsgDispatcher::Inst().Register(HTTP_MSG_TYPE, handle_http);
     Server server(port);
     g_server = &server;
     std::signal(SIGINT, signal_handler);
     std::signal(SIGTERM, signal_handler);
+    std::signal(SIGUSR2, trace_signal_handler);
+    std::signal(SIGHUP, reload_signal_handler);
+    // 对端在积压数据未发完时关闭连接, write返回EPIPE即可, 不能让进程被信号杀掉
+    std::signal(SIGPIPE, SIG_IGN);
 
     server.run();
     return 0;
@@ -0,0 +1,15 @@
+#include "msg_dispatcher.hpp"
+#include "session.hpp"
+
+void MsgDispatcher::Register(uint16_t msg_type, MsgHandler handler) {
+    _handlers[msg_type] = std::move(handler);
+}
+
+void MsgDispatcher::Dispatch(std::shared_ptr<Session>& sess, uint16_t msg_type, const std::string& body) const {
+    auto iter = _handlers.find(msg_type);
+    if (iter == _handlers.end()) {
+        sess->Send(msg_type, body);
+        return;
+    }
+    iter->second(sess, msg_type, body);
+}
@@ -0,0 +1,95 @@
+#include "overload.hpp"
+#include "configmgr.hpp"
+#include "logger.hpp"
+#include <arpa/inet.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+OverloadConfig::OverloadConfig() {
+    auto& cfg = ConfigMgr::Inst();
+    _enabled = cfg.get<bool>("overload.enabled", false);
+    _target_ns = (int64_t)std::max(1, cfg.get<int>("overload.target_ms", 5)) * 1000000;
+    _interval_ns = (int64_t)std::max(1, cfg.get<int>("overload.interval_ms", 100)) * 1000000;
+    _max_tasks = (size_t)std::max(1, cfg.get<int>("overload.max_tasks", 10000));
+    _max_send_bytes = (size_t)std::max(1, cfg.get<int>("overload.max_send_mb", 64)) << 20;
+    _accept_defer_ms = std::max(0, cfg.get<int>("overload.accept_defer_ms", 1000));
+    _busy_type = (uint16_t)cfg.get<int>("overload.busy_type", 0);
+    std::stringstream types(cfg.get<std::string>("overload.shed_types", ""));
+    std::string type;
+    while (std::getline(types, type, ',')) {
+        int msg_type = atoi(type.c_str());
+        if (msg_type > 0) {
+            _shed_types.insert((uint16_t)msg_type);
+        }
+    }
+}
+
+OverloadConfig::OverloadConfig(bool enabled, int target_ms, int interval_ms, std::unordered_set<uint16_t> shed_types,
+                               uint16_t busy_type)
+    : _enabled(enabled), _target_ns((int64_t)target_ms * 1000000), _interval_ns((int64_t)interval_ms * 1000000),
+      _max_tasks(10000), _max_send_bytes(64 << 20), _accept_defer_ms(1000), _busy_type(busy_type),
+      _shed_types(std::move(shed_types)) {}
+
+ConfigDerived<OverloadConfig>& OverloadConfig::slot() {
+    static ConfigDerived<OverloadConfig> config([] { return OverloadConfig(); });
+    return config;
+}
+
+// CoDel: 只看窗口内的最小时延, 能在一个窗口内排空的突发不会触发; 持续过载时窗口按1/sqrt(n)缩短,
+// 越是持续过载越频繁地重新判断, 时延一回到目标以下就退出
+void OverloadDetector::sample(int64_t now_ns, int64_t delay_ns, bool loop_end, size_t tasks, size_t send_bytes) {
+    const auto& cfg = OverloadConfig::Inst();
+    if (loop_end) {
+        _window_min = std::min(_window_min, delay_ns);
+    }
+    if (_window_end == 0) {
+        _window_end = now_ns + cfg.interval_ns();
+    }
+    if (now_ns >= _window_end) {
+        // 一轮处理跨过了整个窗口, 这一轮至少已经等了delay_ns
+        int64_t window_min = _window_min == INT64_MAX ? delay_ns : _window_min;
+        _delayed = window_min >= cfg.target_ns();
+        _count = _delayed ? _count + 1 : 0;
+        int64_t interval = cfg.interval_ns();
+        if (_count > 1) {
+            interval = (int64_t)(interval / std::sqrt((double)_count));
+        }
+        _window_end = now_ns + interval;
+        _window_min = INT64_MAX;
+    }
+    // 队列深度和发送积压不是时延, 超过上限直接算过载, 不等窗口
+    bool hard = tasks > cfg.max_tasks() || send_bytes > cfg.max_send_bytes();
+    bool overloaded = _delayed || hard;
+    if (overloaded != _overloaded.load(std::memory_order_relaxed)) {
+        _overloaded.store(overloaded, std::memory_order_relaxed);
+        if (overloaded) {
+            LOG_WARN("io_thread %d overloaded, delay %ld us tasks %zu send bytes %zu", _index, delay_ns / 1000,
+                     tasks, send_bytes);
+        }
+        else {
+            LOG_INFO("io_thread %d recovered from overload", _index);
+        }
+    }
+}
+
+std::string EncodeBusyFrame(CodecType codec) {
+    uint16_t busy_type = OverloadConfig::Inst().busy_type();
+    std::string out;
+    if (busy_type == 0 || codec == CodecType::Relay) {
+        return out;
+    }
+    static const std::string body = "busy";
+    if (codec == CodecType::Binary) {
+        uint16_t net_type = htons(busy_type);
+        uint16_t net_len = htons((uint16_t)body.size());
+        out.append((const char*)&net_type, 2);
+        out.append((const char*)&net_len, 2);
+        out += body;
+        return out;
+    }
+    // HTTP端口的消息类型就是状态码
+    GetCodec(codec)->encode(codec == CodecType::Http ? 503 : busy_type, body, out);
+    return out;
+}
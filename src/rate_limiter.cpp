@@ -0,0 +1,127 @@
+#include "rate_limiter.hpp"
+#include "configmgr.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+bool TokenBucket::consume(const RateRule& rule, int64_t now_ns, bool allow_debt) {
+    // 第一次使用时桶是满的
+    if (_last_ns == 0) {
+        _tokens = rule._burst;
+    }
+    else if (now_ns > _last_ns) {
+        _tokens = std::min(rule._burst, _tokens + (now_ns - _last_ns) * rule._rate / 1e9);
+    }
+    _last_ns = now_ns;
+    if (_tokens >= 1) {
+        _tokens -= 1;
+        return true;
+    }
+    if (allow_debt) {
+        _tokens -= 1;
+    }
+    return false;
+}
+
+int64_t TokenBucket::wait_ns(const RateRule& rule) const {
+    if (_tokens >= 1 || rule._rate <= 0) {
+        return 0;
+    }
+    return (int64_t)((1 - _tokens) * 1e9 / rule._rate);
+}
+
+// 解析"速率,桶容量,策略", 桶容量缺省等于速率, 策略缺省为pause
+static bool parse_rule(const std::string& s, RateRule& rule) {
+    std::stringstream ss(s);
+    std::string rate, burst, policy;
+    std::getline(ss, rate, ',');
+    std::getline(ss, burst, ',');
+    std::getline(ss, policy, ',');
+    auto trim = [](std::string& t) {
+        t.erase(0, t.find_first_not_of(" \t"));
+        t.erase(t.find_last_not_of(" \t") + 1);
+    };
+    trim(rate);
+    trim(burst);
+    trim(policy);
+    rule._rate = atof(rate.c_str());
+    rule._burst = burst.empty() ? rule._rate : atof(burst.c_str());
+    rule._burst = std::max(rule._burst, 1.0);
+    if (policy.empty() || policy == "pause") {
+        rule._policy = LimitPolicy::Pause;
+    }
+    else if (policy == "drop") {
+        rule._policy = LimitPolicy::Drop;
+    }
+    else if (policy == "disconnect") {
+        rule._policy = LimitPolicy::Disconnect;
+    }
+    else {
+        LOG_WARN("unknown rate limit policy: %s", policy);
+        return false;
+    }
+    return rule._rate > 0;
+}
+
+RateLimitConfig::RateLimitConfig() : _session{0, 0, LimitPolicy::None} {
+    auto& cfg = ConfigMgr::Inst();
+    std::string session = cfg.get<std::string>("ratelimit.session", "");
+    if (!session.empty() && !parse_rule(session, _session)) {
+        _session = RateRule{0, 0, LimitPolicy::None};
+    }
+    std::stringstream types(cfg.get<std::string>("ratelimit.msg_types", ""));
+    std::string type;
+    while (std::getline(types, type, ',')) {
+        int msg_type = atoi(type.c_str());
+        RateRule rule;
+        std::string value = cfg.get<std::string>("ratelimit.msg_" + std::to_string(msg_type), "");
+        if (msg_type > 0 && parse_rule(value, rule)) {
+            _types[msg_type] = rule;
+        }
+    }
+}
+
+const RateRule* RateLimitConfig::type_rule(uint16_t msg_type) const {
+    if (_types.empty()) {
+        return nullptr;
+    }
+    auto iter = _types.find(msg_type);
+    return iter == _types.end() ? nullptr : &iter->second;
+}
+
+const RateLimitConfig& RateLimitConfig::Inst() {
+    static RateLimitConfig config;
+    return config;
+}
+
+LimitPolicy SessionLimiter::check(uint16_t msg_type, int64_t now_ns, int64_t& pause_ns) {
+    const auto& cfg = RateLimitConfig::Inst();
+    LimitPolicy result = LimitPolicy::None;
+    pause_ns = 0;
+    if (cfg.session_rule()._rate > 0) {
+        apply(cfg.session_rule(), _session_bucket, now_ns, result, pause_ns);
+    }
+    const RateRule* rule = cfg.type_rule(msg_type);
+    if (rule) {
+        auto iter = std::find_if(_type_buckets.begin(), _type_buckets.end(),
+            [msg_type](const std::pair<uint16_t, TokenBucket>& p) { return p.first == msg_type; });
+        if (iter == _type_buckets.end()) {
+            _type_buckets.emplace_back(msg_type, TokenBucket());
+            iter = _type_buckets.end() - 1;
+        }
+        apply(*rule, iter->second, now_ns, result, pause_ns);
+    }
+    return result;
+}
+
+void SessionLimiter::apply(const RateRule& rule, TokenBucket& bucket, int64_t now_ns, LimitPolicy& result, int64_t& pause_ns) {
+    bool pause = rule._policy == LimitPolicy::Pause;
+    if (bucket.consume(rule, now_ns, pause)) {
+        return;
+    }
+    if (pause) {
+        pause_ns = std::max(pause_ns, bucket.wait_ns(rule));
+    }
+    result = std::max(result, rule._policy);
+}
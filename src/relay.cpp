@@ -0,0 +1,162 @@
+#include "relay.hpp"
+#include "global.hpp"
+#include "logger.hpp"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+
+// 一次splice/read的最大字节数, 与默认pipe容量一致
+static const size_t kRelayChunk = 65536;
+// 每次事件最多搬运的块数, 剩余数据由水平触发的EPOLLIN在下一轮继续, 避免一个大流量连接饿死其他连接
+static const int kRelayRounds = 16;
+
+static ssize_t flush_pending(int dst, RelayPipe& p, bool copy) {
+    if (copy) {
+        return write(dst, p._buf.data() + (p._buf.size() - p._pending), p._pending);
+    }
+    return splice(p._rd, nullptr, dst, nullptr, p._pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+
+int RelayPump(int src, int dst, RelayPipe& p, bool copy, std::vector<char>& scratch) {
+    for (int round = 0; round < kRelayRounds; ) {
+        // 先把积压的数据写出去, pipe/缓冲为空时才从源socket读
+        if (p._pending > 0) {
+            ssize_t n = flush_pending(dst, p, copy);
+            if (n > 0) {
+                p._pending -= n;
+                if (copy && p._pending == 0) {
+                    std::string().swap(p._buf);
+                }
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return IO_EAGAIN;
+            }
+            return IO_ERROR;
+        }
+        if (p._eof) {
+            return IO_SUCCESS;
+        }
+        round++;
+        ssize_t n;
+        if (copy) {
+            n = read(src, scratch.data(), scratch.size());
+        }
+        else {
+            n = splice(src, nullptr, p._wr, nullptr, kRelayChunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+        if (n > 0) {
+            p._pending = n;
+            if (copy) {
+                // 直接从scratch写, 写不完的部分才留在_buf里
+                ssize_t w = write(dst, scratch.data(), n);
+                if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    return IO_ERROR;
+                }
+                size_t written = w > 0 ? w : 0;
+                p._pending = n - written;
+                if (p._pending > 0) {
+                    p._buf.assign(scratch.data() + written, p._pending);
+                }
+            }
+            continue;
+        }
+        if (n == 0) {
+            p._eof = true;
+            return IO_SUCCESS;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        // pipe是空的, EAGAIN只可能是源socket读空了
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return IO_SUCCESS;
+        }
+        return IO_ERROR;
+    }
+    return IO_CONTINUE;
+}
+
+BackendPool::BackendPool(const RelayConfig& cfg) : _size(cfg._pool_size), _valid(false) {
+    memset(&_addr, 0, sizeof(_addr));
+    _addr.sin_family = AF_INET;
+    _addr.sin_port = htons(cfg._backend_port);
+    if (inet_pton(AF_INET, cfg._backend_host.c_str(), &_addr.sin_addr) == 1) {
+        _valid = true;
+    }
+    else {
+        struct addrinfo hints, *res = nullptr;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(cfg._backend_host.c_str(), nullptr, &hints, &res) == 0 && res) {
+            _addr.sin_addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
+            _valid = true;
+        }
+        if (res) {
+            freeaddrinfo(res);
+        }
+    }
+    if (!_valid) {
+        LOG_ERROR("relay backend %s can not be resolved", cfg._backend_host);
+    }
+}
+
+BackendPool::~BackendPool() {
+    for (int fd : _idle) {
+        close(fd);
+    }
+}
+
+int BackendPool::connect_backend() {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERROR("relay socket: %s", strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*)&_addr, sizeof(_addr)) < 0 && errno != EINPROGRESS) {
+        LOG_ERROR("relay connect: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int BackendPool::acquire() {
+    if (!_valid) {
+        return -1;
+    }
+    while (!_idle.empty()) {
+        int fd = _idle.back();
+        _idle.pop_back();
+        // 空闲期间被后端关闭或出错的连接读到EOF或错误; 还在connect中的连接返回EAGAIN, 可以使用
+        char c;
+        ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return fd;
+        }
+        close(fd);
+    }
+    return connect_backend();
+}
+
+void BackendPool::refill() {
+    while (_valid && _idle.size() < _size) {
+        int fd = connect_backend();
+        if (fd < 0) {
+            return;
+        }
+        _idle.push_back(fd);
+    }
+}
@@ -0,0 +1,196 @@
+#include "response_cache.hpp"
+#include "configmgr.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string_view>
+
+// 每个条目在两段字符串之外的大致开销: 槽位, 哈希表节点, 字符串头
+static const size_t kEntryOverhead = 128;
+
+ResponseCacheConfig::ResponseCacheConfig() {
+    auto& cfg = ConfigMgr::Inst();
+    std::stringstream types(cfg.get<std::string>("cache.msg_types", ""));
+    std::string type;
+    while (std::getline(types, type, ',')) {
+        int msg_type = atoi(type.c_str());
+        if (msg_type > 0) {
+            _types.insert((uint16_t)msg_type);
+        }
+    }
+    _max_bytes = (size_t)std::max(0, cfg.get<int>("cache.max_mb", 16)) << 20;
+}
+
+ResponseCacheConfig::ResponseCacheConfig(std::unordered_set<uint16_t> types, size_t max_bytes)
+    : _types(std::move(types)), _max_bytes(max_bytes) {}
+
+ResponseCacheConfig& ResponseCacheConfig::slot() {
+    static ResponseCacheConfig config;
+    return config;
+}
+
+std::mutex ResponseCache::_inv_mtx;
+std::vector<ResponseCache::Invalidation> ResponseCache::_invalidations;
+std::atomic<uint64_t> ResponseCache::_inv_seq{0};
+
+ResponseCache::ResponseCache(size_t max_bytes) : _max_bytes(max_bytes), _bytes(0), _hand(0),
+    _seen_seq(_inv_seq.load(std::memory_order_acquire)) {}
+
+uint64_t ResponseCache::hash_of(uint16_t type, const char* body, size_t len) {
+    uint64_t h = std::hash<std::string_view>()(std::string_view(body, len));
+    return h ^ ((uint64_t)type * 0x9E3779B97F4A7C15ull);
+}
+
+ResponseCache::Entry* ResponseCache::find(const Codec* codec, uint16_t type, const char* body, size_t len,
+                                          uint64_t hash) {
+    auto range = _index.equal_range(hash);
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        Entry& e = _slots[iter->second];
+        if (e._codec == codec && e._type == type && e._req.size() == len && memcmp(e._req.data(), body, len) == 0) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+const ResponseCache::Entry* ResponseCache::lookup(const Codec* codec, uint16_t type, const char* body, size_t len) {
+    if (_inv_seq.load(std::memory_order_acquire) != _seen_seq) {
+        sync_invalidations();
+    }
+    Entry* e = find(codec, type, body, len, hash_of(type, body, len));
+    if (e) {
+        e->_ref = true;
+    }
+    return e;
+}
+
+void ResponseCache::store(const Codec* codec, uint16_t type, const char* body, size_t len, uint16_t resp_type,
+                          std::string&& resp) {
+    size_t cost = len + resp.size() + kEntryOverhead;
+    // 单个回复超过上限的1/8时不缓存, 避免一条大回复冲掉整个缓存
+    if (cost > _max_bytes / 8) {
+        return;
+    }
+    uint64_t hash = hash_of(type, body, len);
+    if (Entry* old = find(codec, type, body, len, hash)) {
+        erase_slot((uint32_t)(old - _slots.data()));
+    }
+    evict_until(cost);
+    uint32_t idx;
+    if (!_free.empty()) {
+        idx = _free.back();
+        _free.pop_back();
+    }
+    else {
+        idx = (uint32_t)_slots.size();
+        _slots.emplace_back();
+    }
+    Entry& e = _slots[idx];
+    e._type = type;
+    e._resp_type = resp_type;
+    e._codec = codec;
+    e._ref = false;
+    e._live = true;
+    e._hash = hash;
+    e._req.assign(body, len);
+    e._resp = std::move(resp);
+    _index.emplace(hash, idx);
+    _bytes += cost;
+}
+
+void ResponseCache::erase_slot(uint32_t idx) {
+    Entry& e = _slots[idx];
+    _bytes -= e._req.size() + e._resp.size() + kEntryOverhead;
+    auto range = _index.equal_range(e._hash);
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        if (iter->second == idx) {
+            _index.erase(iter);
+            break;
+        }
+    }
+    e._live = false;
+    // 释放字符串内存, 空槽位只保留对象本身
+    std::string().swap(e._req);
+    std::string().swap(e._resp);
+    _free.push_back(idx);
+}
+
+// CLOCK: 访问位为1的清零后跳过, 为0的淘汰
+void ResponseCache::evict_until(size_t need) {
+    while (_bytes + need > _max_bytes && !_index.empty()) {
+        if (_hand >= _slots.size()) {
+            _hand = 0;
+        }
+        Entry& e = _slots[_hand];
+        if (e._live) {
+            if (e._ref) {
+                e._ref = false;
+            }
+            else {
+                erase_slot((uint32_t)_hand);
+                ResponseCacheStats::Inst()._evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        _hand++;
+    }
+}
+
+void ResponseCache::sync_invalidations() {
+    std::lock_guard<std::mutex> lk(_inv_mtx);
+    uint64_t seq = _inv_seq.load(std::memory_order_relaxed);
+    // 记录已经被截掉, 无法知道错过了哪些, 全部清空
+    if (_invalidations.empty() || _invalidations.front()._seq > _seen_seq + 1) {
+        for (uint32_t i = 0; i < _slots.size(); i++) {
+            if (_slots[i]._live) {
+                erase_slot(i);
+            }
+        }
+        _seen_seq = seq;
+        return;
+    }
+    for (auto& inv : _invalidations) {
+        if (inv._seq <= _seen_seq) {
+            continue;
+        }
+        if (!inv._all) {
+            // 只有哈希, 同哈希同类型的条目都失效, 冲突时多删几条无妨
+            auto range = _index.equal_range(inv._hash);
+            std::vector<uint32_t> victims;
+            for (auto iter = range.first; iter != range.second; ++iter) {
+                if (_slots[iter->second]._type == inv._type) {
+                    victims.push_back(iter->second);
+                }
+            }
+            for (uint32_t idx : victims) {
+                erase_slot(idx);
+            }
+            continue;
+        }
+        for (uint32_t i = 0; i < _slots.size(); i++) {
+            if (_slots[i]._live && _slots[i]._type == inv._type) {
+                erase_slot(i);
+            }
+        }
+    }
+    _seen_seq = seq;
+}
+
+void ResponseCache::Invalidate(uint16_t type) {
+    std::lock_guard<std::mutex> lk(_inv_mtx);
+    uint64_t seq = _inv_seq.load(std::memory_order_relaxed) + 1;
+    _invalidations.push_back(Invalidation{seq, type, true, 0});
+    if (_invalidations.size() > kMaxInvalidations) {
+        _invalidations.erase(_invalidations.begin(), _invalidations.begin() + _invalidations.size() / 2);
+    }
+    _inv_seq.store(seq, std::memory_order_release);
+}
+
+void ResponseCache::Invalidate(uint16_t type, const std::string& body) {
+    std::lock_guard<std::mutex> lk(_inv_mtx);
+    uint64_t seq = _inv_seq.load(std::memory_order_relaxed) + 1;
+    _invalidations.push_back(Invalidation{seq, type, false, hash_of(type, body.data(), body.size())});
+    if (_invalidations.size() > kMaxInvalidations) {
+        _invalidations.erase(_invalidations.begin(), _invalidations.begin() + _invalidations.size() / 2);
+    }
+    _inv_seq.store(seq, std::memory_order_release);
+}
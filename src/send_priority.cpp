@@ -0,0 +1,58 @@
+#include "send_priority.hpp"
+#include "configmgr.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+SendPriorityConfig::SendPriorityConfig() {
+    auto& cfg = ConfigMgr::Inst();
+    _classes = cfg.get<int>("priority.classes", 1);
+    _default = (uint8_t)cfg.get<int>("priority.default", std::max(_classes - 1, 0));
+    std::stringstream types(cfg.get<std::string>("priority.msg_types", ""));
+    std::string type;
+    while (std::getline(types, type, ',')) {
+        int msg_type = atoi(type.c_str());
+        std::string key = "priority.msg_" + std::to_string(msg_type);
+        if (msg_type > 0 && cfg.hasKey(key)) {
+            _types[msg_type] = (uint8_t)cfg.get<int>(key, 0);
+        }
+    }
+    std::stringstream weights(cfg.get<std::string>("priority.weights", ""));
+    std::string w;
+    while (std::getline(weights, w, ',')) {
+        _weights.push_back((uint32_t)std::max(1, atoi(w.c_str())));
+    }
+    normalize();
+}
+
+SendPriorityConfig::SendPriorityConfig(int classes, uint8_t default_class, std::unordered_map<uint16_t, uint8_t> types,
+                                       std::vector<uint32_t> weights)
+    : _classes(classes), _default(default_class), _types(std::move(types)), _weights(std::move(weights)) {
+    normalize();
+}
+
+// 优先级超出范围时归到最低一级, 权重个数不足时用1补齐
+void SendPriorityConfig::normalize() {
+    _classes = std::min(std::max(_classes, 1), kMaxClasses);
+    uint8_t lowest = (uint8_t)(_classes - 1);
+    _default = std::min(_default, lowest);
+    for (auto& kv : _types) {
+        kv.second = std::min(kv.second, lowest);
+    }
+    if (_classes == 1) {
+        _types.clear();
+        _weights.clear();
+    }
+    if (!_weights.empty()) {
+        if ((int)_weights.size() > _classes) {
+            LOG_WARN("priority weights has %zu entries, only %d classes", _weights.size(), _classes);
+        }
+        _weights.resize(_classes, 1);
+    }
+}
+
+SendPriorityConfig& SendPriorityConfig::slot() {
+    static SendPriorityConfig config;
+    return config;
+}
@@ -1,41 +1,86 @@
 #include "server.hpp"
 #include "configmgr.hpp"
+#include "flight_recorder.hpp"
+#include "logger.hpp"
+#include "overload.hpp"
+#include <sys/inotify.h>
+#include <libgen.h>
+#include <cstdio>
 
-Server::Server(int port) : _port(port), _event_count(32), _stop(true) {
-    auto b_res = create_and_bind(port);
-    if (!b_res) {
+// 用到时才读取, 配置重载后立即生效
+static const ConfigKey<int>& drain_timeout_ms() {
+    static ConfigKey<int> key("server.drain_timeout_ms", 30000);
+    return key;
+}
+
+static const ConfigKey<std::string>& trace_file() {
+    static ConfigKey<std::string> key("server.trace_file", "event_server_trace.json");
+    return key;
+}
+
+Server::Server(int port) : _port(port), _listen_fd(-1), _upgrade_fd(-1), _draining(false),
+    _start_time(std::chrono::steady_clock::now()), _first_accepted(false), _dump_trace(false), _event_count(32), _stop(true),
+    _overload_on(false), _accept_paused(false), _reload(false), _inotify_fd(-1) {
+    _epoll_fd = epoll_create1(0);
+    if (_epoll_fd == -1) {
+        LOG_ERROR("epoll_create1: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
+    LOG_INFO("server _epoll_fd is %d", _epoll_fd);
 
-    auto n_res = set_nonblocking(_listen_fd);
-    if (n_res == -1) {
-        perror("fcntl error: ");
-        exit(EXIT_FAILURE);
+    // 热升级: 交接socket上有旧进程在等待时, 直接接管它的监听socket, 不重新bind
+    auto &cfg = ConfigMgr::Inst();
+    _upgrade_path = cfg.get<std::string>("server.upgrade_socket", "");
+    _overload_on = OverloadConfig::Inst().enabled();
+    // 交接连接等构造完成(监听fd已加入epoll, UDP端口已绑定)后才确认; 中途失败退出时不确认, 旧进程继续服务
+    int handoff_conn = -1;
+    if (!_upgrade_path.empty() && HandoffRecv(_upgrade_path, _inherited, handoff_conn)) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start_time).count();
+        LOG_INFO("server inherited %zu listeners from old process in %ld us", _inherited.size(), us);
     }
-    std::cout << "server listen_fd is " << _listen_fd << std::endl;
 
-    _event_fd = eventfd(0, EFD_NONBLOCK);
-    if (_event_fd == -1) {
-        perror("eventfd");
+    if (!add_listener(port, CodecType::Binary)) {
+        exit(EXIT_FAILURE);
+    }
+    // 文本行与HTTP端口, 0表示不开启
+    int line_port = cfg.get<int>("server.line_port", 0);
+    if (line_port > 0 && !add_listener(line_port, CodecType::Line)) {
+        exit(EXIT_FAILURE);
+    }
+    int http_port = cfg.get<int>("server.http_port", 0);
+    if (http_port > 0 && !add_listener(http_port, CodecType::Http)) {
+        exit(EXIT_FAILURE);
+    }
+    // 中继端口接入的连接原样转发给relay_backend
+    int relay_port = cfg.get<int>("server.relay_port", 0);
+    if (relay_port > 0 && !add_listener(relay_port, CodecType::Relay)) {
         exit(EXIT_FAILURE);
     }
-    std::cout << "server _event_fd is " << _event_fd << std::endl;
+    // 新配置里已经不用的端口直接关闭
+    for (auto& l : _inherited) {
+        LOG_INFO("server drop inherited listener port %d", l._port);
+        close(l._fd);
+    }
+    _inherited.clear();
 
-    _epoll_fd = epoll_create1(0);
-    if (_epoll_fd == -1) {
-        perror("epoll_create1");
+    _event_fd = eventfd(0, EFD_NONBLOCK);
+    if (_event_fd == -1) {
+        LOG_ERROR("eventfd: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
-    std::cout << "server _epoll_fd is " << _epoll_fd << std::endl;
+    LOG_INFO("server _event_fd is %d", _event_fd);
 
-    {
-        struct epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;
-        ev.data.fd = _listen_fd;
-        if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev) == -1) {
-            perror("epoll_ctl add listen_fd");
+    if (!_upgrade_path.empty()) {
+        // 交接中先绑在临时路径上, 确认后再改名覆盖; 启动失败时旧进程的交接socket仍然可达, 可以再次升级
+        _upgrade_fd = HandoffListen(handoff_conn != -1 ? _upgrade_path + ".new" : _upgrade_path);
+        struct epoll_event ev3;
+        ev3.events = EPOLLIN;
+        ev3.data.fd = _upgrade_fd;
+        if (_upgrade_fd == -1 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _upgrade_fd, &ev3) == -1) {
+            LOG_ERROR("epoll_ctl add upgrade_fd: %s", strerror(errno));
             exit(EXIT_FAILURE);
         }
+        LOG_INFO("server upgrade socket %s", _upgrade_path);
     }
 
     {
@@ -43,19 +88,56 @@ Server::Server(int port) : _port(port), _event_count(32), _stop(true) {
         ev2.events = EPOLLIN;
         ev2.data.fd = _event_fd;
         if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _event_fd, &ev2) == -1) {
-            perror("epoll_ctl add event_fd");
+            LOG_ERROR("epoll_ctl add event_fd: %s", strerror(errno));
             exit(EXIT_FAILURE);
         }
     }
 
+    if (cfg.get<bool>("server.config_watch", true)) {
+        watch_config();
+    }
+
     _event_addr = (struct epoll_event*)malloc(sizeof(epoll_event) * _event_count);
     if (_event_addr == nullptr) {
-        perror("malloc events failed: ");
+        LOG_ERROR("malloc events failed: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
-    auto &cfg = ConfigMgr::Inst();
     int thread_num = cfg.get<int>("server.thread_num", 2);
     _loop = std::make_unique<EventLoop>(thread_num);
+    // 处理函数通过ShardStore访问按线程分区的状态
+    if (cfg.get<bool>("server.sharded_state", false)) {
+        _loop->EnableShards();
+    }
+    int udp_port = cfg.get<int>("server.udp_port", 0);
+    if (udp_port > 0) {
+        if (!_loop->AddUdpListener(udp_port)) {
+            exit(EXIT_FAILURE);
+        }
+        LOG_INFO("server udp port %d", udp_port);
+    }
+    if (relay_port > 0) {
+        RelayConfig relay;
+        std::string backend = cfg.get<std::string>("server.relay_backend", "");
+        auto pos = backend.rfind(':');
+        if (pos == std::string::npos) {
+            LOG_ERROR("server relay_backend should be host:port");
+            exit(EXIT_FAILURE);
+        }
+        relay._backend_host = backend.substr(0, pos);
+        relay._backend_port = atoi(backend.c_str() + pos + 1);
+        relay._pool_size = cfg.get<int>("server.relay_pool_size", 8);
+        relay._copy = cfg.get<bool>("server.relay_copy", false);
+        _loop->EnableRelay(relay);
+        LOG_INFO("server relay port %d to %s", relay_port, backend);
+    }
+    if (handoff_conn != -1) {
+        if (!HandoffAck(handoff_conn)) {
+            exit(EXIT_FAILURE);
+        }
+        if (rename((_upgrade_path + ".new").c_str(), _upgrade_path.c_str()) < 0) {
+            LOG_ERROR("rename upgrade socket: %s", strerror(errno));
+        }
+    }
 }
 
 Server::~Server() {
@@ -64,29 +146,44 @@ Server::~Server() {
         free(_event_addr);
         _event_addr = nullptr;
     }
-    if (_listen_fd != -1) {
-        close(_listen_fd);
+    for (auto& kv : _listeners) {
+        close(kv.first);
+    }
+    // 交接之后路径已经属于新进程, 不能删除
+    if (_upgrade_fd != -1) {
+        close(_upgrade_fd);
+        unlink(_upgrade_path.c_str());
     }
     if (_event_fd != -1) {
         close(_event_fd);
     }
+    if (_inotify_fd != -1) {
+        close(_inotify_fd);
+    }
     if (_epoll_fd != -1) {
         close(_epoll_fd);
     }
-    std::cout << "Server exit" << std::endl;
+    LOG_INFO("Server exit");
 }
 
 void Server::run() {
     _stop = false;
     while (!_stop) {
-        int nfds = epoll_wait(_epoll_fd, _event_addr, _event_count, -1);
+        // 排空期间定期检查剩余Session, 暂停accept期间定期检查是否恢复
+        int nfds = epoll_wait(_epoll_fd, _event_addr, _event_count, _draining ? 100 : (_accept_paused ? 10 : -1));
         if (nfds < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            perror("epoll wait");
+            LOG_ERROR("epoll wait: %s", strerror(errno));
             break;
         }
+        if (_draining && drain_done()) {
+            return;
+        }
+        if (_accept_paused) {
+            check_paused_accept();
+        }
         for (int i = 0; i < nfds; i++) {
             int fd = _event_addr[i].data.fd;
             uint32_t evs = _event_addr[i].events;
@@ -94,29 +191,29 @@ void Server::run() {
             if (evs & (EPOLLERR | EPOLLHUP)) {
                 int err = 0, errlen = sizeof(err);
                 getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, (socklen_t*)&errlen);
-                fprintf(stderr, "fd=%d  error: %s\n", fd, strerror(err));
+                LOG_WARN("fd=%d  error: %s", fd, strerror(err));
                 continue;
             }
 
-            if (fd == _listen_fd) {
-                struct sockaddr_in cli;
-                socklen_t len = sizeof(cli);
-                while (1) {
-                    int conn_fd = accept(_listen_fd, (struct sockaddr*)&cli, &len);
-                    if (conn_fd < 0) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK)    break;
-                        if (errno == EINTR) continue;
-                        perror("accept");
-                        break;
-                    }
-
-                    _con_fds.push_back(conn_fd);
-                    printf("Accepted fd = %d", conn_fd);
+            auto listener = _listeners.find(fd);
+            if (listener != _listeners.end()) {
+                if (_overload_on && _loop->Overloaded()) {
+                    defer_or_reject(listener->second);
                 }
-                if (!_con_fds.empty()) {
-                    // 将新的连接交给EventLoop处理
-                    _loop->NotifyNewCons(_con_fds);
-                    _con_fds.clear();
+                else {
+                    accept_all(listener->second);
+                }
+                continue;
+            }
+
+            if (fd == _upgrade_fd) {
+                handle_upgrade();
+                continue;
+            }
+
+            if (fd == _inotify_fd) {
+                if (config_changed()) {
+                    reload_config();
                 }
                 continue;
             }
@@ -124,42 +221,259 @@ void Server::run() {
             if (fd == _event_fd) {
                 uint64_t cnt;
                 read(_event_fd, &cnt, sizeof(cnt));
-                std::cout << "receive exit eventfd" << std::endl;
+                bool handled = false;
+                if (_dump_trace.exchange(false)) {
+                    const std::string& path = trace_file().get();
+                    bool ok = FlightRecorder::DumpChromeTraceToFile(path);
+                    LOG_INFO("dump trace to %s%s", path, ok ? "" : " failed");
+                    handled = true;
+                }
+                if (_reload.exchange(false)) {
+                    reload_config();
+                    handled = true;
+                }
+                std::vector<std::function<void()>> tasks;
+                {
+                    std::lock_guard<std::mutex> lk(_task_mtx);
+                    tasks.swap(_tasks);
+                }
+                for (auto& fn : tasks) {
+                    fn();
+                    handled = true;
+                }
+                if (handled && !_stop) {
+                    continue;
+                }
+                LOG_INFO("receive exit eventfd");
                 return;
             }
         }
     }
 }
 
+void Server::accept_all(const ListenerInfo& listener) {
+    struct sockaddr_in cli;
+    socklen_t len = sizeof(cli);
+    while (1) {
+        int conn_fd = accept(listener._fd, (struct sockaddr*)&cli, &len);
+        if (conn_fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)    break;
+            if (errno == EINTR) continue;
+            LOG_ERROR("accept: %s", strerror(errno));
+            break;
+        }
+
+        _con_fds.push_back(conn_fd);
+        LOG_DEBUG("Accepted fd = %d", conn_fd);
+        if (!_first_accepted) {
+            _first_accepted = true;
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start_time).count();
+            LOG_INFO("server first accept %ld us after start", us);
+        }
+    }
+    if (!_con_fds.empty()) {
+        // 将新的连接交给EventLoop处理
+        _loop->NotifyNewCons(_con_fds, listener._codec);
+        _con_fds.clear();
+    }
+}
+
+// 暂停时连接留在backlog里, 短暂过载过去后照常接入; 持续过载时backlog里的连接等下去只会超时,
+// 不如尽快回一帧busy让客户端退避或换一台
+void Server::defer_or_reject(const ListenerInfo& listener) {
+    auto now = std::chrono::steady_clock::now();
+    if (!_accept_paused) {
+        _accept_paused = true;
+        _accept_paused_at = now;
+        OverloadStats::Inst()._deferred.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARN("server all io threads overloaded, pause accept");
+    }
+    if (now - _accept_paused_at >= std::chrono::milliseconds(OverloadConfig::Inst().accept_defer_ms())) {
+        reject_all(listener);
+    }
+}
+
+void Server::reject_all(const ListenerInfo& listener) {
+    std::string busy = EncodeBusyFrame(listener._codec);
+    while (1) {
+        int conn_fd = accept(listener._fd, nullptr, nullptr);
+        if (conn_fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        // 新连接的发送缓冲区是空的, 一小帧不会阻塞
+        if (!busy.empty()) {
+            send(conn_fd, busy.data(), busy.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+        close(conn_fd);
+        OverloadStats::Inst()._rejected.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Server::check_paused_accept() {
+    if (_loop->Overloaded()) {
+        for (auto& kv : _listeners) {
+            defer_or_reject(kv.second);
+        }
+        return;
+    }
+    _accept_paused = false;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _accept_paused_at).count();
+    LOG_INFO("server resume accept after %ld ms, %lu connections rejected so far", ms,
+             OverloadStats::Inst()._rejected.load(std::memory_order_relaxed));
+    // 监听socket是边沿触发, 暂停期间到达的连接不会再通知, 需要主动接受
+    for (auto& kv : _listeners) {
+        accept_all(kv.second);
+    }
+}
+
 void Server::stop() {
     _stop = true;
     uint64_t one = 1;
     write(_event_fd, &one, sizeof(one));
 }
 
-bool Server::create_and_bind(int port) {
-    _listen_fd =socket(AF_INET, SOCK_STREAM, 0);
-    if (_listen_fd < 0) {
-        perror("socket");
-        return false;
+void Server::request_trace_dump() {
+    _dump_trace = true;
+    uint64_t one = 1;
+    write(_event_fd, &one, sizeof(one));
+}
+
+void Server::request_reload() {
+    _reload = true;
+    uint64_t one = 1;
+    write(_event_fd, &one, sizeof(one));
+}
+
+void Server::run_in_accept_thread(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lk(_task_mtx);
+        _tasks.push_back(std::move(fn));
+    }
+    uint64_t one = 1;
+    write(_event_fd, &one, sizeof(one));
+}
+
+// 监视配置文件所在目录: 编辑器常常写临时文件再改名, 直接监视文件会在改名后失效
+void Server::watch_config() {
+    const std::string& path = ConfigMgr::Inst().path();
+    if (path.empty()) {
+        return;
+    }
+    std::string dir_buf = path;
+    std::string name_buf = path;
+    std::string dir = dirname(&dir_buf[0]);
+    _config_name = basename(&name_buf[0]);
+    _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify_fd == -1 || inotify_add_watch(_inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        LOG_WARN("watch config %s failed: %s, reload on SIGHUP only", path, strerror(errno));
+        if (_inotify_fd != -1) {
+            close(_inotify_fd);
+            _inotify_fd = -1;
+        }
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = _inotify_fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _inotify_fd, &ev) == -1) {
+        LOG_ERROR("epoll_ctl add inotify_fd: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    LOG_INFO("server watching config %s", path);
+}
+
+bool Server::config_changed() {
+    alignas(struct inotify_event) char buf[4096];
+    bool changed = false;
+    ssize_t n;
+    while ((n = read(_inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + n;) {
+            auto* ev = (struct inotify_event*)p;
+            if (ev->len > 0 && _config_name == ev->name) {
+                changed = true;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return changed;
+}
+
+// 新快照发布后IO线程在下一轮换上新的预算, EventLoop按新的间隔重平衡, 这里处理需要主动调整的部分
+void Server::reload_config() {
+    auto& cfg = ConfigMgr::Inst();
+    if (!cfg.Reload()) {
+        return;
+    }
+    Logger::SetLevel(Logger::ParseLevel(cfg.get<std::string>("log.level", "info"), Logger::Level()));
+    int thread_num = cfg.get<int>("server.thread_num", 2);
+    if (thread_num > 0 && !_loop->ScaleTo(thread_num)) {
+        LOG_WARN("server can not apply server.thread_num = %d", thread_num);
+    }
+}
+
+int Server::create_and_bind(int port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        LOG_ERROR("socket: %s", strerror(errno));
+        return -1;
     }
     int opt = 1;
-    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(_port);
+    addr.sin_port = htons(port);
 
-    if (bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind");
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        LOG_ERROR("bind: %s", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+    if (listen(listen_fd, SOMAXCONN) < 0) {
+        LOG_ERROR("listen: %s", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
+
+bool Server::add_listener(int port, CodecType codec) {
+    for (auto it = _inherited.begin(); it != _inherited.end(); ++it) {
+        if (it->_port == port) {
+            int listen_fd = it->_fd;
+            _inherited.erase(it);
+            return watch_listener(listen_fd, port, codec);
+        }
+    }
+    int listen_fd = create_and_bind(port);
+    if (listen_fd == -1) {
         return false;
     }
-    if (listen(_listen_fd, SOMAXCONN) < 0) {
-        perror("listen");
+    return watch_listener(listen_fd, port, codec);
+}
+
+bool Server::watch_listener(int listen_fd, int port, CodecType codec) {
+    if (set_nonblocking(listen_fd) == -1) {
+        LOG_ERROR("fcntl error: %s", strerror(errno));
+        close(listen_fd);
+        return false;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listen_fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+        LOG_ERROR("epoll_ctl add listen_fd: %s", strerror(errno));
+        close(listen_fd);
         return false;
     }
+    if (codec == CodecType::Binary) {
+        _listen_fd = listen_fd;
+    }
+    _listeners[listen_fd] = ListenerInfo{listen_fd, port, codec};
+    LOG_INFO("server listen port %d fd is %d", port, listen_fd);
     return true;
 }
 
@@ -170,3 +484,52 @@ int Server::set_nonblocking(int fd) {
     }
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
+
+void Server::handle_upgrade() {
+    int conn = accept4(_upgrade_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0) {
+        return;
+    }
+    std::vector<ListenerInfo> listeners;
+    for (auto& kv : _listeners) {
+        listeners.push_back(kv.second);
+    }
+    bool ok = !_draining && HandoffSend(conn, listeners, 5000);
+    close(conn);
+    if (!ok) {
+        LOG_WARN("server upgrade handoff failed, keep serving");
+        return;
+    }
+    begin_drain();
+}
+
+// 监听socket已经由新进程持有, 这里关闭只是去掉本进程的引用, 积压在backlog里的连接由新进程accept
+void Server::begin_drain() {
+    for (auto& kv : _listeners) {
+        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, kv.first, nullptr);
+        close(kv.first);
+    }
+    _listeners.clear();
+    _listen_fd = -1;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, _upgrade_fd, nullptr);
+    close(_upgrade_fd);
+    _upgrade_fd = -1;
+    // UDP是SO_REUSEPORT各自绑定的, 新进程已经绑好, 关掉本进程的socket后内核只分给新进程
+    _loop->CloseUdpListeners();
+    _draining = true;
+    _drain_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(drain_timeout_ms().get());
+    LOG_INFO("server handed listeners to new process, draining %zu sessions", _loop->SessionCount());
+}
+
+bool Server::drain_done() {
+    size_t left = _loop->SessionCount();
+    if (left == 0) {
+        LOG_INFO("server drained all sessions");
+        return true;
+    }
+    if (std::chrono::steady_clock::now() >= _drain_deadline) {
+        LOG_INFO("server drain timeout, closing %zu sessions", left);
+        return true;
+    }
+    return false;
+}
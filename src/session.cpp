@@ -1,36 +1,24 @@
 #include "session.hpp"
 #include "io_thread.hpp"
-#include "defer.hpp"
-
-HeadBuf::HeadBuf(size_t head_len) :_head_len(head_len), _offset(0) {
-    _buf = (char*)malloc(sizeof(char) * head_len);
-    if (!_buf) {
-        perror("malloc head buf failed!\n");
-        exit(EXIT_FAILURE);
-    }
-}
-
-HeadBuf::~HeadBuf() {
-    if (_buf) {
-        std::free(_buf);
-        _buf = nullptr;
-    }
-}
+#include "coro.hpp"
+#include "logger.hpp"
+#include "udp_channel.hpp"
+#include "stage_stats.hpp"
 
 // 接收用构造函数 从socket中收到包头时就已经知道消息体的长度
-DataBuf::DataBuf(uint16_t type, size_t data_len) :_type(type), _data_len(data_len), _offset(0) { 
+DataBuf::DataBuf(uint16_t type, size_t data_len) :_type(type), _data_len(data_len), _offset(0), _req_id(0) { 
     _buf = static_cast<char*>(std::malloc(data_len));
     if (!_buf) {
-        perror("malloc data buf failed!\n");
+        LOG_ERROR("malloc data buf failed: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
 }
 
 // 发送用构造函数 需要自己将消息体与包头拼接成一个完整的数据包
-DataBuf::DataBuf(uint16_t type, std::string data, size_t data_len) :_type(type), _data_len(data_len + HEAD_LEN), _offset(0) {
+DataBuf::DataBuf(uint16_t type, std::string data, size_t data_len) :_type(type), _data_len(data_len + HEAD_LEN), _offset(0), _req_id(0) {
     _buf = static_cast<char*>(std::malloc(_data_len));
     if (!_buf) {
-        perror("malloc data buf failed!\n");
+        LOG_ERROR("malloc data buf failed: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
     uint16_t net_type = htons(type);
@@ -47,11 +35,69 @@ DataBuf::~DataBuf() {
     }
 }
 
-Session::Session(int fd, IOThread *pthread) : _fd(fd), p_ownerthread(pthread) {
-    _head_buf = std::make_shared<HeadBuf>(HEAD_LEN);
+void SendQueue::push(std::shared_ptr<DataBuf> data) {
+    if (!_que) {
+        _que = std::make_unique<Classes>();
+    }
+    uint8_t cls = SendPriorityConfig::Inst().class_of(data->_type);
+    auto& q = _que->_q[cls];
+    if (!q) {
+        q = std::make_unique<FrameQueue>();
+    }
+    // 直接写了一部分的帧进队时队列一定是空的, 下次从它接着写
+    if (data->_offset > 0) {
+        _que->_cur = cls;
+    }
+    _que->_bytes += data->_data_len;
+    q->push_back(std::move(data));
+    _que->_size++;
+}
+
+std::shared_ptr<DataBuf>& SendQueue::front() {
+    auto& cur = _que->_q[_que->_cur];
+    if (cur && !cur->empty() && cur->front()->_offset > 0) {
+        return cur->front();
+    }
+    select();
+    return _que->_q[_que->_cur]->front();
+}
+
+void SendQueue::pop() {
+    auto& q = *_que;
+    q._bytes -= q._q[q._cur]->front()->_data_len;
+    q._q[q._cur]->pop_front();
+    q._size--;
+    if (q._credit[q._cur] > 0) {
+        q._credit[q._cur]--;
+    }
+}
+
+// 严格优先: 取最高的非空优先级; 加权: 按优先级顺序取还有额度的非空队列, 都没有额度时按权重重新发放
+void SendQueue::select() {
+    auto& q = *_que;
+    const auto& cfg = SendPriorityConfig::Inst();
+    int classes = cfg.classes();
+    bool weighted = cfg.weighted();
+    for (int round = 0; round < 2; round++) {
+        for (int c = 0; c < classes; c++) {
+            if (q._q[c] && !q._q[c]->empty() && (!weighted || q._credit[c] > 0)) {
+                q._cur = (uint8_t)c;
+                return;
+            }
+        }
+        for (int c = 0; c < classes; c++) {
+            q._credit[c] = cfg.weight(c);
+        }
+    }
+}
+
+Session::Session(int fd, IOThread *pthread, Codec* codec) : _fd(fd), _head_off(0), _req_ext(false), _compress(false), _codec(codec), _p_ownerthread(pthread) {
     _data_buf = nullptr;
     _recv_stage = NO_RECV;
     _send_stage = NO_SEND;
+    _load = 0;
+    _read_paused = false;
+    _read_deferred = false;
 }
 
 Session::~Session() {
@@ -59,7 +105,82 @@ Session::~Session() {
 }
 
 void Session::Send(int msg_type, const std::string &data) {
-   _p_ownerthread->enqueue_send_data(_fd, data, msg_type);
+    STAGE_SCOPE(Stage::Enqueue);
+    IOThread* owner = _p_ownerthread.load(std::memory_order_acquire);
+    // Session已关闭
+    if (owner == nullptr) {
+        return;
+    }
+    owner->enqueue_send_data(shared_from_this(), data, msg_type);
+}
+
+void Session::Send(const std::shared_ptr<const SharedFrame>& frame) {
+    STAGE_SCOPE(Stage::Enqueue);
+    IOThread* owner = _p_ownerthread.load(std::memory_order_acquire);
+    // Session已关闭
+    if (owner == nullptr) {
+        return;
+    }
+    owner->enqueue_send_frame(shared_from_this(), frame);
+}
+
+uint32_t Session::RequestId() const {
+    IOThread* cur = IOThread::current();
+    return cur ? cur->current_request_id(this) : 0;
+}
+
+DeferredReq Session::Defer() {
+    IOThread* cur = IOThread::current();
+    if (cur == nullptr || cur != _p_ownerthread.load(std::memory_order_relaxed)) {
+        LOG_ERROR("Defer must be called in handler, fd is %d", _fd);
+        return DeferredReq();
+    }
+    return cur->defer_request(this);
+}
+
+void Session::Reply(const DeferredReq& req, int msg_type, const std::string& data) {
+    IOThread* owner = _p_ownerthread.load(std::memory_order_acquire);
+    // Session已关闭
+    if (owner == nullptr) {
+        return;
+    }
+    owner->enqueue_reply(shared_from_this(), req, data, msg_type);
+}
+
+std::shared_ptr<DataBuf> Session::make_send_buf(int msg_type, const std::string &data, uint32_t req_id) {
+    if (_codec == nullptr && (_req_ext || _compress)) {
+        auto buf = std::make_shared<DataBuf>(msg_type, BinaryFrameBound(data.size(), _req_ext, _compress));
+        size_t n = EncodeBinaryFrame(buf->_buf, msg_type, data.data(), data.size(), _req_ext, req_id, _compress);
+        if (n == 0) {
+            LOG_WARN("reply body %zu too big for negotiated header, fd is %d", data.size(), _fd);
+            return nullptr;
+        }
+        buf->_data_len = n;
+        return buf;
+    }
+    if (_codec == nullptr) {
+        return std::make_shared<DataBuf>(msg_type, data, data.size());
+    }
+    std::string out;
+    _codec->encode(msg_type, data, out);
+    auto buf = std::make_shared<DataBuf>(msg_type, out.size());
+    memcpy(buf->_buf, out.data(), out.size());
+    return buf;
+}
+
+// 二进制连接(包括UDP)复制共用的编码结果, 文本协议单独编码
+std::shared_ptr<DataBuf> Session::make_send_buf(const SharedFrame& frame) {
+    if (_codec != nullptr) {
+        return make_send_buf(frame.type(), frame.body());
+    }
+    const std::string& enc = frame.encoded(_req_ext, _compress);
+    if (enc.empty()) {
+        LOG_WARN("shared frame body %zu too big for negotiated header, fd is %d", frame.body().size(), _fd);
+        return nullptr;
+    }
+    auto buf = std::make_shared<DataBuf>(frame.type(), enc.size());
+    memcpy(buf->_buf, enc.data(), enc.size());
+    return buf;
 }
 
 void Session::enqueue_data(std::shared_ptr<DataBuf> data) {
@@ -67,39 +188,25 @@ void Session::enqueue_data(std::shared_ptr<DataBuf> data) {
 }
 
 int Session::send_data(std::shared_ptr<DataBuf> data) {
-    _send_stage = SENDING;
-    Defer defer([this](){
-        this->_send_stage = NO_SEND;
-    });
-
-    _send_que.push(data);
-    while (!_send_que.empty()) {
-        auto send_node = _send_que.front();
-        while (send_node->_offset < send_node->_data_len) {
-            auto result = write(_fd, send_node->_buf + send_node->_offset, send_node->_data_len - send_node->_offset);
-            if (result > 0) {
-                send_node->_offset += result;
-                continue;
-            }
-            if (result < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    return IO_EAGAIN;
-                }
-                if (errno == EINTR) {
-                    continue;
-                }
-                perror("send failed: ");
-                return IO_ERROR;
+    while (data->_offset < data->_data_len) {
+        auto result = write(_fd, data->_buf + data->_offset, data->_data_len - data->_offset);
+        if (result > 0) {
+            data->_offset += result;
+            continue;
+        }
+        if (result < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                _send_que.push(data);
+                return IO_EAGAIN;
             }
-            if (result == 0) {
-                std::cout << "send peer closed, fd is " << _fd << std::endl;
-                return IO_ERROR;
+            if (errno == EINTR) {
+                continue;
             }
+            LOG_WARN("send failed: %s", strerror(errno));
+            return IO_ERROR;
         }
-        if (send_node->_offset == send_node->_data_len) {
-            _send_que.pop();
-            continue;
-        }
+        LOG_DEBUG("send peer closed, fd is %d", _fd);
+        return IO_ERROR;
     }
     return IO_SUCCESS;
 }
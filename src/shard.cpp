@@ -0,0 +1,174 @@
+#include "shard.hpp"
+#include "io_thread.hpp"
+#include "logger.hpp"
+
+ShardRouter::ShardRouter(const std::vector<IOThread*>& threads) : _threads(threads) {
+    size_t n = threads.size();
+    _rings.reserve(n * n);
+    for (size_t i = 0; i < n * n; i++) {
+        _rings.emplace_back(new SpscRing<ShardMsg>(kRingCapacity));
+    }
+}
+
+Shard::Shard(ShardRouter* router, size_t index) : _router(router), _index(index), _next_id(1),
+    _overflow(router->size()), _doorbell(router->size(), 0) {}
+
+void Shard::submit(ShardMsg&& msg, ShardCallback cb) {
+    msg._from = (uint32_t)_index;
+    // 请求号为0表示不需要回复
+    msg._id = 0;
+    if (cb) {
+        msg._id = _next_id++;
+        _pending.emplace(msg._id, std::move(cb));
+    }
+    size_t to = _router->shard_of(msg._key);
+    send(to, std::move(msg));
+}
+
+void Shard::send(size_t to, ShardMsg&& msg) {
+    _doorbell[to] = 1;
+    // 前面还有暂存的消息时也要排在后面, 保证同一对线程之间的顺序
+    if (!_overflow[to].empty() || !_router->ring(_index, to).push(std::move(msg))) {
+        _overflow[to].push_back(std::move(msg));
+    }
+}
+
+void Shard::apply(ShardMsg& msg) {
+    switch (msg._op) {
+    case ShardOp::Get: {
+        auto iter = _store.find(msg._key);
+        msg._found = iter != _store.end();
+        if (msg._found) {
+            msg._num = iter->second._num;
+            msg._str = iter->second._str;
+        }
+        break;
+    }
+    case ShardOp::Put: {
+        auto& entry = _store[msg._key];
+        entry._str = std::move(msg._str);
+        msg._str.clear();
+        msg._found = true;
+        msg._num = entry._num;
+        break;
+    }
+    case ShardOp::Incr: {
+        auto& entry = _store[msg._key];
+        entry._num += msg._num;
+        msg._found = true;
+        msg._num = entry._num;
+        break;
+    }
+    case ShardOp::Erase:
+        msg._found = _store.erase(msg._key) > 0;
+        break;
+    case ShardOp::Reply:
+        break;
+    }
+}
+
+void Shard::poll() {
+    size_t n = _router->size();
+    ShardMsg msg;
+    for (size_t from = 0; from < n; from++) {
+        auto& ring = _router->ring(from, _index);
+        // 每个环每轮最多处理一个容量的消息, 回调里发给本线程的新请求留到下一轮
+        for (size_t i = 0; i < ShardRouter::kRingCapacity && ring.pop(msg); i++) {
+            if (msg._op != ShardOp::Reply) {
+                apply(msg);
+                // 没有回调的请求不需要回复
+                if (msg._id == 0) {
+                    continue;
+                }
+                msg._op = ShardOp::Reply;
+                msg._key.clear();
+                send(msg._from, std::move(msg));
+                continue;
+            }
+            auto iter = _pending.find(msg._id);
+            if (iter == _pending.end()) {
+                continue;
+            }
+            auto cb = std::move(iter->second);
+            _pending.erase(iter);
+            cb(ShardReply{msg._found, msg._num, msg._str});
+        }
+    }
+    for (size_t to = 0; to < n; to++) {
+        auto& pending = _overflow[to];
+        auto& ring = _router->ring(_index, to);
+        while (!pending.empty() && ring.push(std::move(pending.front()))) {
+            pending.pop_front();
+        }
+        if (_doorbell[to]) {
+            _doorbell[to] = 0;
+            if (to != _index) {
+                _router->thread(to)->wakeup();
+            }
+        }
+    }
+}
+
+bool Shard::busy() const {
+    if (!_router->ring(_index, _index).empty()) {
+        return true;
+    }
+    for (auto& pending : _overflow) {
+        if (!pending.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static Shard* local_shard() {
+    IOThread* thr = IOThread::current();
+    Shard* shard = thr ? thr->shard() : nullptr;
+    if (shard == nullptr) {
+        LOG_ERROR("shard store used outside an IO thread or before EnableShards");
+    }
+    return shard;
+}
+
+bool ShardStore::Enabled() {
+    IOThread* thr = IOThread::current();
+    return thr && thr->shard();
+}
+
+void ShardStore::Get(const std::string& key, ShardCallback cb) {
+    if (Shard* shard = local_shard()) {
+        ShardMsg msg;
+        msg._op = ShardOp::Get;
+        msg._key = key;
+        shard->submit(std::move(msg), std::move(cb));
+    }
+}
+
+void ShardStore::Put(const std::string& key, const std::string& value, ShardCallback cb) {
+    if (Shard* shard = local_shard()) {
+        ShardMsg msg;
+        msg._op = ShardOp::Put;
+        msg._key = key;
+        msg._str = value;
+        shard->submit(std::move(msg), std::move(cb));
+    }
+}
+
+void ShardStore::Incr(const std::string& key, int64_t delta, ShardCallback cb) {
+    if (Shard* shard = local_shard()) {
+        ShardMsg msg;
+        msg._op = ShardOp::Incr;
+        msg._key = key;
+        msg._num = delta;
+        shard->submit(std::move(msg), std::move(cb));
+    }
+}
+
+void ShardStore::Erase(const std::string& key, ShardCallback cb) {
+    if (Shard* shard = local_shard()) {
+        ShardMsg msg;
+        msg._op = ShardOp::Erase;
+        msg._key = key;
+        shard->submit(std::move(msg), std::move(cb));
+    }
+}
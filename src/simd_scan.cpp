@@ -0,0 +1,131 @@
+#include "simd_scan.hpp"
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_SCAN_X86 1
+#endif
+
+static size_t find_byte_scalar(const char* p, size_t n, char c) {
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] == c) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static size_t find_crlfcrlf_scalar(const char* p, size_t n) {
+    for (size_t i = 0; i + 3 < n; i++) {
+        if (p[i] == '\r' && p[i + 1] == '\n' && p[i + 2] == '\r' && p[i + 3] == '\n') {
+            return i;
+        }
+    }
+    return n;
+}
+
+#ifdef SIMD_SCAN_X86
+__attribute__((target("sse2")))
+static size_t find_byte_sse2(const char* p, size_t n, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_byte_scalar(p + i, n - i, c);
+}
+
+// 四个错位加载分别比较\r\n\r\n, 与运算后的掩码即为候选起点
+__attribute__((target("sse2")))
+static size_t find_crlfcrlf_sse2(const char* p, size_t n) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 19 <= n; i += 16) {
+        __m128i m0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), cr);
+        __m128i m1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i + 1)), lf);
+        __m128i m2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i + 2)), cr);
+        __m128i m3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i + 3)), lf);
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(m0, m1), _mm_and_si128(m2, m3)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_crlfcrlf_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_byte_avx2(const char* p, size_t n, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_byte_sse2(p + i, n - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t find_crlfcrlf_avx2(const char* p, size_t n) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 35 <= n; i += 32) {
+        __m256i m0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), cr);
+        __m256i m1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 1)), lf);
+        __m256i m2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 2)), cr);
+        __m256i m3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 3)), lf);
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(m0, m1), _mm256_and_si256(m2, m3)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_crlfcrlf_sse2(p + i, n - i);
+}
+#endif
+
+typedef size_t (*FindByteFn)(const char*, size_t, char);
+typedef size_t (*FindSeqFn)(const char*, size_t);
+
+struct SimdImpl {
+    FindByteFn _find_byte;
+    FindSeqFn _find_crlfcrlf;
+    const char* _name;
+};
+
+static SimdImpl select_impl() {
+#ifdef SIMD_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdImpl{find_byte_avx2, find_crlfcrlf_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdImpl{find_byte_sse2, find_crlfcrlf_sse2, "sse2"};
+    }
+#endif
+    return SimdImpl{find_byte_scalar, find_crlfcrlf_scalar, "scalar"};
+}
+
+static const SimdImpl& impl() {
+    static const SimdImpl s_impl = select_impl();
+    return s_impl;
+}
+
+size_t simd_find_byte(const char* p, size_t n, char c) {
+    return impl()._find_byte(p, n, c);
+}
+
+size_t simd_find_crlfcrlf(const char* p, size_t n) {
+    return impl()._find_crlfcrlf(p, n);
+}
+
+const char* simd_level() {
+    return impl()._name;
+}
@@ -0,0 +1,40 @@
+#include "stage_stats.hpp"
+
+std::mutex StageStats::_registry_mtx;
+std::vector<std::unique_ptr<StageStats>> StageStats::_registry;
+
+static const char* kStageNames[(int)Stage::Count] = {"decode", "dispatch", "enqueue", "tasks", "flush"};
+
+const char* StageStats::Name(Stage stage) {
+    return kStageNames[(int)stage];
+}
+
+StageStats* StageStats::create_local() {
+    std::lock_guard<std::mutex> lk(_registry_mtx);
+    _registry.emplace_back(new StageStats());
+    t_local = _registry.back().get();
+    return t_local;
+}
+
+StageTotals StageStats::Collect() {
+    StageTotals totals;
+    std::lock_guard<std::mutex> lk(_registry_mtx);
+    for (auto& stats : _registry) {
+        for (int i = 0; i < (int)Stage::Count; i++) {
+            totals._calls[i] += stats->_calls[i].load(std::memory_order_relaxed);
+            totals._ns[i] += stats->_ns[i].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+// 只在没有IO线程运行时调用, 否则会和写入方的读改写交错丢掉一部分计数
+void StageStats::Reset() {
+    std::lock_guard<std::mutex> lk(_registry_mtx);
+    for (auto& stats : _registry) {
+        for (int i = 0; i < (int)Stage::Count; i++) {
+            stats->_calls[i].store(0, std::memory_order_relaxed);
+            stats->_ns[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,202 @@
+#include "udp_channel.hpp"
+#include "session.hpp"
+#include "io_thread.hpp"
+#include "logger.hpp"
+#include <netinet/udp.h>
+#include <fcntl.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+// GSO一次最多携带的分段数, 与内核UDP_MAX_SEGMENTS一致
+static const size_t kMaxSegments = 64;
+static const size_t kMaxGsoBytes = 65000;
+
+UdpChannel::UdpChannel(int fd, int batch, bool gro, bool gso) : _fd(fd), _batch(batch), _gro(gro), _gso(gso) {
+    // 开启GRO时内核可能把多个数据报合并后一次交付, 每个槽位需要按最大UDP包准备
+    _slot_size = gro ? 65536 : BUFF_SIZE + HEAD_LEN;
+    _rbuf.resize(_slot_size * batch);
+    _rmsgs.resize(batch);
+    _riov.resize(batch);
+    _raddrs.resize(batch);
+    _rctrl.resize(CMSG_SPACE(sizeof(int)) * batch);
+}
+
+UdpChannel::~UdpChannel() {
+    release_all();
+    close(_fd);
+}
+
+int UdpChannel::recv_batch() {
+    for (int i = 0; i < _batch; i++) {
+        _riov[i].iov_base = &_rbuf[i * _slot_size];
+        _riov[i].iov_len = _slot_size;
+        struct msghdr& hdr = _rmsgs[i].msg_hdr;
+        hdr.msg_name = &_raddrs[i];
+        hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        hdr.msg_iov = &_riov[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = _gro ? &_rctrl[i * CMSG_SPACE(sizeof(int))] : nullptr;
+        hdr.msg_controllen = _gro ? CMSG_SPACE(sizeof(int)) : 0;
+        hdr.msg_flags = 0;
+        _rmsgs[i].msg_len = 0;
+    }
+    while (1) {
+        int n = recvmmsg(_fd, _rmsgs.data(), _batch, MSG_DONTWAIT, nullptr);
+        if (n >= 0) {
+            return n;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        LOG_ERROR("recvmmsg: %s", strerror(errno));
+        return -1;
+    }
+}
+
+size_t UdpChannel::segment(int i) const {
+    if (!_gro) {
+        return 0;
+    }
+    const struct msghdr& hdr = _rmsgs[i].msg_hdr;
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr); cm != nullptr; cm = CMSG_NXTHDR((struct msghdr*)&hdr, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int seg = 0;
+            memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+            return seg > 0 ? seg : 0;
+        }
+    }
+    return 0;
+}
+
+void UdpChannel::queue(const struct sockaddr_storage& addr, socklen_t addr_len, std::shared_ptr<DataBuf> buf) {
+    _out.push_back(Pending{addr, addr_len, std::move(buf)});
+    if ((int)_out.size() >= _batch) {
+        flush();
+    }
+}
+
+// 开启GSO时, 发往同一对端且长度相同的连续数据报合并为一个带UDP_SEGMENT的消息, 最后一段可以更短
+int UdpChannel::flush() {
+    size_t n = _out.size();
+    if (n == 0) {
+        return 0;
+    }
+    _wmsgs.assign(n, mmsghdr{});
+    _wiov.resize(n);
+    _wctrl.assign(n * CMSG_SPACE(sizeof(uint16_t)), 0);
+    size_t msg_count = 0;
+    size_t i = 0;
+    while (i < n) {
+        size_t seg = _out[i]._buf->_data_len;
+        size_t j = i + 1;
+        size_t total = seg;
+        if (_gso) {
+            while (j < n && j - i < kMaxSegments
+                && _out[j]._addr_len == _out[i]._addr_len
+                && memcmp(&_out[j]._addr, &_out[i]._addr, _out[i]._addr_len) == 0
+                && _out[j - 1]._buf->_data_len == seg
+                && _out[j]._buf->_data_len <= seg
+                && total + _out[j]._buf->_data_len <= kMaxGsoBytes) {
+                total += _out[j]._buf->_data_len;
+                j++;
+            }
+        }
+        for (size_t k = i; k < j; k++) {
+            _wiov[k].iov_base = _out[k]._buf->_buf;
+            _wiov[k].iov_len = _out[k]._buf->_data_len;
+        }
+        struct msghdr& hdr = _wmsgs[msg_count].msg_hdr;
+        hdr.msg_name = &_out[i]._addr;
+        hdr.msg_namelen = _out[i]._addr_len;
+        hdr.msg_iov = &_wiov[i];
+        hdr.msg_iovlen = j - i;
+        if (j - i > 1) {
+            char* ctrl = &_wctrl[msg_count * CMSG_SPACE(sizeof(uint16_t))];
+            hdr.msg_control = ctrl;
+            hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t seg16 = seg;
+            memcpy(CMSG_DATA(cm), &seg16, sizeof(seg16));
+        }
+        msg_count++;
+        i = j;
+    }
+
+    size_t sent = 0;
+    while (sent < msg_count) {
+        int res = sendmmsg(_fd, &_wmsgs[sent], msg_count - sent, MSG_DONTWAIT);
+        if (res > 0) {
+            sent += res;
+            continue;
+        }
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        // UDP不重传, 缓冲区满或者出错时丢弃剩余部分
+        if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG_ERROR("sendmmsg: %s", strerror(errno));
+        }
+        break;
+    }
+    _out.clear();
+    return sent;
+}
+
+void UdpChannel::retain(std::shared_ptr<Session> sess) {
+    // 定期清理已经释放的会话
+    if (_retained.size() >= 64 && _retained.size() == _retained.capacity()) {
+        _retained.erase(std::remove_if(_retained.begin(), _retained.end(),
+            [](const std::weak_ptr<Session>& w) { return w.expired(); }), _retained.end());
+    }
+    _retained.push_back(sess);
+}
+
+void UdpChannel::release_all() {
+    for (auto& w : _retained) {
+        auto sess = w.lock();
+        if (sess) {
+            sess->_p_ownerthread.store(nullptr, std::memory_order_release);
+            sess->_udp->_channel = nullptr;
+        }
+    }
+    _retained.clear();
+}
+
+int UdpChannel::open_socket(int port, bool gro) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        LOG_ERROR("udp socket: %s", strerror(errno));
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    if (gro && setsockopt(fd, SOL_UDP, UDP_GRO, &opt, sizeof(opt)) < 0) {
+        LOG_ERROR("setsockopt UDP_GRO: %s", strerror(errno));
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        LOG_ERROR("udp bind: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}